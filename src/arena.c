@@ -0,0 +1,137 @@
+/*
+ * arena.c: allocate many small objects that are freed together
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#include <config.h>
+
+#include "internal.h"
+#include "memory.h"
+#include "arena.h"
+
+/* Chunks grow by doubling from the size of the first one up to
+ * ARENA_MAX_CHUNK; requests bigger than a quarter of the current chunk
+ * get a chunk of their own, so that we do not waste the rest of the
+ * current one */
+#define ARENA_MIN_CHUNK 256
+#define ARENA_MAX_CHUNK (1024 * 1024)
+
+union arena_align {
+    void      *p;
+    long long  l;
+    double     d;
+};
+
+#define ARENA_ALIGN __alignof__(union arena_align)
+
+struct arena_chunk {
+    struct arena_chunk *next;
+    size_t              size;
+    union arena_align   data[];
+};
+
+static struct arena_chunk *make_chunk(size_t size) {
+    struct arena_chunk *chunk;
+
+    chunk = malloc(sizeof(*chunk) + size);
+    if (chunk == NULL)
+        return NULL;
+    chunk->next = NULL;
+    chunk->size = size;
+    return chunk;
+}
+
+struct arena *make_arena(size_t size) {
+    struct arena *arena;
+
+    if (make_ref(arena) < 0)
+        return NULL;
+    if (size < ARENA_MIN_CHUNK)
+        size = ARENA_MIN_CHUNK;
+    else if (size > ARENA_MAX_CHUNK)
+        size = ARENA_MAX_CHUNK;
+    arena->chunks = make_chunk(size);
+    if (arena->chunks == NULL) {
+        free(arena);
+        return NULL;
+    }
+    return arena;
+}
+
+static void *arena_take(struct arena *arena, size_t size, size_t align) {
+    struct arena_chunk *chunk = arena->chunks;
+    size_t start = (arena->used + align - 1) & ~(align - 1);
+
+    if (start + size > chunk->size) {
+        struct arena_chunk *c;
+
+        if (size > chunk->size / 4) {
+            c = make_chunk(size);
+            if (c == NULL)
+                return NULL;
+            c->next = chunk->next;
+            chunk->next = c;
+            return c->data;
+        }
+
+        c = make_chunk(chunk->size < ARENA_MAX_CHUNK ?
+                       2 * chunk->size : ARENA_MAX_CHUNK);
+        if (c == NULL)
+            return NULL;
+        c->next = chunk;
+        arena->chunks = chunk = c;
+        start = 0;
+    }
+    arena->used = start + size;
+    return (char *) chunk->data + start;
+}
+
+void *arena_alloc(struct arena *arena, size_t size) {
+    return arena_take(arena, size, ARENA_ALIGN);
+}
+
+char *arena_strndup(struct arena *arena, const char *s, size_t len) {
+    char *result = arena_take(arena, len + 1, 1);
+
+    if (result != NULL) {
+        memcpy(result, s, len);
+        result[len] = '\0';
+    }
+    return result;
+}
+
+void free_arena(struct arena *arena) {
+    if (arena == NULL)
+        return;
+    assert(arena->ref == 0);
+    while (arena->chunks != NULL) {
+        struct arena_chunk *del = arena->chunks;
+        arena->chunks = del->next;
+        free(del);
+    }
+    free(arena);
+}
+
+/*
+ * Local variables:
+ *  indent-tabs-mode: nil
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  tab-width: 4
+ * End:
+ */
@@ -0,0 +1,65 @@
+/*
+ * arena.h: allocate many small objects that are freed together
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include <stddef.h>
+#include "ref.h"
+
+/*
+ * An arena hands out memory from a few large chunks, and only frees them
+ * all at once when its last reference goes away. lns_get allocates the
+ * nodes of the tree for a file together with their labels and values
+ * from one arena; each node holds a reference to it.
+ */
+
+struct arena_chunk;
+
+struct arena {
+    ref_t               ref;
+    struct arena_chunk *chunks;   /* The chunk we allocate from first */
+    size_t              used;     /* Bytes used in CHUNKS */
+};
+
+/* Make a new arena, expecting about SIZE bytes to be allocated from
+ * it. Return NULL if we run out of memory */
+struct arena *make_arena(size_t size);
+
+/* Allocate SIZE bytes from ARENA, aligned for any kind of object; the
+ * memory is not initialized */
+void *arena_alloc(struct arena *arena, size_t size);
+
+/* Copy LEN bytes of S into ARENA and terminate them with a '\0' */
+char *arena_strndup(struct arena *arena, const char *s, size_t len);
+
+void free_arena(struct arena *arena);
+
+#endif
+
+
+/*
+ * Local variables:
+ *  indent-tabs-mode: nil
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  tab-width: 4
+ * End:
+ */
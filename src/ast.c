@@ -32,6 +32,7 @@ struct dict_entry {
     struct dict_entry *next;
     struct skel *skel;
     struct dict *dict;
+    struct skel_origin origin;
 };
 
 /* Associates a KEY with a list of skel/dict pairs.
@@ -63,7 +64,8 @@ static const int dict_initial_size = 2;
 static const int dict_max_expansion = 128;
 static const uint32_t dict_max_size = (1<<24) - 1;
 
-struct dict *make_dict(char *key, struct skel *skel, struct dict *subdict) {
+struct dict *make_dict(char *key, struct skel *skel, struct dict *subdict,
+                       const struct skel_origin *origin) {
     struct dict *dict = NULL;
     if (ALLOC(dict) < 0)
         goto error;
@@ -79,6 +81,7 @@ struct dict *make_dict(char *key, struct skel *skel, struct dict *subdict) {
     dict->nodes[0]->key = key;
     dict->nodes[0]->entry->skel = skel;
     dict->nodes[0]->entry->dict = subdict;
+    dict->nodes[0]->entry->origin = *origin;
     dict->nodes[0]->mark = dict->nodes[0]->entry;
 
     return dict;
@@ -191,9 +194,11 @@ int dict_append(struct dict **dict, struct dict *d2) {
 }
 
 void dict_lookup(const char *key, struct dict *dict,
-                 struct skel **skel, struct dict **subdict) {
+                 struct skel **skel, struct dict **subdict,
+                 const struct skel_origin **origin) {
     *skel = NULL;
     *subdict = NULL;
+    *origin = NULL;
     if (dict != NULL) {
         if (! dict->marked) {
             for (int i=0; i < dict->used; i++) {
@@ -207,6 +212,7 @@ void dict_lookup(const char *key, struct dict *dict,
             if (node->entry != NULL) {
                 *skel = node->entry->skel;
                 *subdict = node->entry->dict;
+                *origin = &node->entry->origin;
                 node->entry = node->entry->next;
             }
         }
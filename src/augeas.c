@@ -26,13 +26,17 @@
 #include "memory.h"
 #include "syntax.h"
 #include "transform.h"
+#include "watch.h"
 #include "errcode.h"
+#include "arena.h"
+#include "hash.h"
 
 #include <fnmatch.h>
 #include <argz.h>
 #include <string.h>
 #include <stdarg.h>
 #include <locale.h>
+#include <limits.h>
 #include <libxml/tree.h>
 
 /* Some popular labels that we use in /augeas */
@@ -42,6 +46,7 @@ static const char *const s_load   = "load";
 static const char *const s_pathx  = "pathx";
 static const char *const s_error  = "error";
 static const char *const s_pos    = "pos";
+static const char *const s_cache  = "cache";
 static const char *const s_vars   = "variables";
 static const char *const s_lens   = "lens";
 static const char *const s_excl   = "excl";
@@ -102,10 +107,228 @@ void tree_clean(struct tree *tree) {
     tree->dirty = 0;
 }
 
+/*
+ * Index of the children of a node by label
+ */
+
+/* Nodes get an index once they have more than this many children */
+#define TREE_INDEX_MIN 32
+
+/* The COUNT children of a node with the same label; the key of NODE is
+ * the label of FIRST, the first of them in the list of children */
+struct tree_label {
+    hnode_t      node;
+    struct tree *first;
+    size_t       count;
+    size_t       numbered;    /* Used while renumbering the children */
+};
+
+/* Children are numbered as they are added to the end of the list. Only
+ * removing a child that is not the last one with its label changes the
+ * ordinals of other children; we then renumber all children the next
+ * time we need an ordinal */
+struct tree_index {
+    hash_t      *labels;
+    hash_t      *values;      /* Children by label and value, or NULL */
+    struct tree *last;        /* The last child, or NULL if not known */
+    bool         renumber;    /* The ordinals of the children are stale */
+};
+
+/* The COUNT children of a node with label LABEL and value VALUE, in the
+ * order in which they appear among the children. The entry is its own
+ * key in the VALUES hash of the index.
+ *
+ * The VALUES hash is only built when it is needed, and dropped whenever
+ * a child is added, removed or gets a new value */
+struct tree_value {
+    hnode_t       node;
+    const char   *label;
+    const char   *value;
+    struct tree **children;
+    size_t        count;
+    size_t        size;
+};
+
+/* NULL labels are indexed as "", since path expressions can not tell
+ * them apart */
+static const char *index_key(const struct tree *tree) {
+    return tree->label == NULL ? "" : tree->label;
+}
+
+/* Same for values */
+static const char *index_value(const struct tree *tree) {
+    return tree->value == NULL ? "" : tree->value;
+}
+
+static hash_val_t tree_value_hash(const void *key) {
+    const struct tree_value *tv = key;
+    hash_val_t hash = 5381;
+
+    for (const char *c = tv->label; *c != '\0'; c++)
+        hash = hash * 33 + (unsigned char) *c;
+    hash = hash * 33;
+    for (const char *c = tv->value; *c != '\0'; c++)
+        hash = hash * 33 + (unsigned char) *c;
+    return hash;
+}
+
+static int tree_value_cmp(const void *key1, const void *key2) {
+    const struct tree_value *tv1 = key1, *tv2 = key2;
+
+    return STRNEQ(tv1->label, tv2->label) || STRNEQ(tv1->value, tv2->value);
+}
+
+static void tree_index_drop_values(struct tree_index *index) {
+    hscan_t scan;
+    hnode_t *node;
+
+    if (index == NULL || index->values == NULL)
+        return;
+    hash_scan_begin(&scan, index->values);
+    while ((node = hash_scan_next(&scan)) != NULL) {
+        struct tree_value *tv = hnode_get(node);
+        hash_scan_delete(index->values, node);
+        free(tv->children);
+        free(tv);
+    }
+    hash_destroy(index->values);
+    index->values = NULL;
+}
+
+static void free_tree_index(struct tree_index *index) {
+    hscan_t scan;
+    hnode_t *node;
+
+    if (index == NULL)
+        return;
+    tree_index_drop_values(index);
+    hash_scan_begin(&scan, index->labels);
+    while ((node = hash_scan_next(&scan)) != NULL) {
+        hash_scan_delete(index->labels, node);
+        free(hnode_get(node));
+    }
+    hash_destroy(index->labels);
+    free(index);
+}
+
+static void tree_index_drop(struct tree *tree) {
+    free_tree_index(tree->index);
+    tree->index = NULL;
+}
+
+/* Add CHILD, which is already in the list of children of PARENT, to the
+ * index of PARENT. If we don't know that CHILD comes after all the other
+ * children with the same label, we have to drop the index instead */
+static void tree_index_add(struct tree *parent, struct tree *child,
+                           bool after) {
+    struct tree_label *tl;
+    hnode_t *node;
+
+    if (parent->index == NULL)
+        return;
+
+    tree_index_drop_values(parent->index);
+    node = hash_lookup(parent->index->labels, index_key(child));
+    if (node != NULL) {
+        if (after) {
+            tl = hnode_get(node);
+            tl->count += 1;
+            child->ordinal = tl->count;
+        } else {
+            tree_index_drop(parent);
+        }
+        return;
+    }
+
+    if (ALLOC(tl) < 0) {
+        tree_index_drop(parent);
+        return;
+    }
+    tl->first = child;
+    tl->count = 1;
+    child->ordinal = 1;
+    hnode_init(&tl->node, tl);
+    hash_insert(parent->index->labels, &tl->node, index_key(child));
+}
+
+/* Remove CHILD from the index of PARENT, before it is removed from the
+ * list of children */
+static void tree_index_remove(struct tree *parent, struct tree *child) {
+    struct tree_index *index = parent->index;
+    struct tree_label *tl;
+    hnode_t *node;
+
+    if (index == NULL)
+        return;
+    tree_index_drop_values(index);
+    if (index->last == child)
+        index->last = NULL;
+
+    node = hash_lookup(index->labels, index_key(child));
+    if (node == NULL) {
+        tree_index_drop(parent);
+        return;
+    }
+    tl = hnode_get(node);
+    if (child->ordinal != tl->count)
+        index->renumber = true;
+    tl->count -= 1;
+    if (tl->count == 0) {
+        hash_delete(index->labels, node);
+        free(tl);
+    } else if (tl->first == child) {
+        struct tree *next = child->next;
+        while (STRNEQ(index_key(next), index_key(child)))
+            next = next->next;
+        hash_delete(index->labels, node);
+        tl->first = next;
+        hash_insert(index->labels, node, index_key(next));
+    }
+}
+
+/* Return the index of TREE, building it if TREE has enough children */
+static struct tree_index *tree_index(struct tree *tree) {
+    struct tree *last = NULL;
+    int n = 0;
+
+    if (tree->index != NULL)
+        return tree->index;
+
+    list_for_each(c, tree->children) {
+        if (++n > TREE_INDEX_MIN)
+            break;
+    }
+    if (n <= TREE_INDEX_MIN)
+        return NULL;
+
+    if (ALLOC(tree->index) < 0)
+        return NULL;
+    tree->index->labels = hash_create(HASHCOUNT_T_MAX, NULL, NULL);
+    if (tree->index->labels == NULL) {
+        FREE(tree->index);
+        return NULL;
+    }
+    list_for_each(c, tree->children) {
+        tree_index_add(tree, c, true);
+        if (tree->index == NULL)
+            return NULL;
+        last = c;
+    }
+    tree->index->last = last;
+    return tree->index;
+}
+
 struct tree *tree_child(struct tree *tree, const char *label) {
     if (tree == NULL)
         return NULL;
 
+    if (label != NULL && *label != '\0' && tree_index(tree) != NULL) {
+        hnode_t *node = hash_lookup(tree->index->labels, label);
+        if (node == NULL)
+            return NULL;
+        return ((struct tree_label *) hnode_get(node))->first;
+    }
+
     list_for_each(child, tree->children) {
         if (streqv(label, child->label))
             return child;
@@ -113,8 +336,192 @@ struct tree *tree_child(struct tree *tree, const char *label) {
     return NULL;
 }
 
+struct tree *tree_child_labelled(struct tree *tree, const char *label,
+                                 size_t *count) {
+    struct tree *first = NULL;
+
+    *count = 0;
+    if (label == NULL)
+        label = "";
+
+    if (tree_index(tree) != NULL) {
+        hnode_t *node = hash_lookup(tree->index->labels, label);
+        if (node != NULL) {
+            struct tree_label *tl = hnode_get(node);
+            first = tl->first;
+            *count = tl->count;
+        }
+        return first;
+    }
+
+    list_for_each(child, tree->children) {
+        if (STREQ(index_key(child), label)) {
+            if (first == NULL)
+                first = child;
+            *count += 1;
+        }
+    }
+    return first;
+}
+
+/* Add CHILD to the entry for its label and value in the VALUES hash of
+ * INDEX */
+static int tree_index_add_value(struct tree_index *index,
+                                struct tree *child) {
+    struct tree_value key, *tv;
+    hnode_t *node;
+
+    key.label = index_key(child);
+    key.value = index_value(child);
+    node = hash_lookup(index->values, &key);
+    if (node != NULL) {
+        tv = hnode_get(node);
+    } else {
+        if (ALLOC(tv) < 0)
+            return -1;
+        tv->label = key.label;
+        tv->value = key.value;
+        hnode_init(&tv->node, tv);
+        hash_insert(index->values, &tv->node, tv);
+    }
+    if (tv->count >= tv->size) {
+        size_t size = tv->size == 0 ? 1 : 2 * tv->size;
+        if (REALLOC_N(tv->children, size) < 0)
+            return -1;
+        tv->size = size;
+    }
+    tv->children[tv->count++] = child;
+    return 0;
+}
+
+int tree_child_valued(struct tree *tree, const char *label,
+                      const char *value, struct tree *const **children) {
+    struct tree_index *index = tree_index(tree);
+    struct tree_value key;
+    hnode_t *node;
+
+    if (index == NULL)
+        return -1;
+
+    if (index->values == NULL) {
+        index->values = hash_create(HASHCOUNT_T_MAX, tree_value_cmp,
+                                    tree_value_hash);
+        if (index->values == NULL)
+            return -1;
+        list_for_each(c, tree->children) {
+            if (tree_index_add_value(index, c) < 0) {
+                tree_index_drop_values(index);
+                return -1;
+            }
+        }
+    }
+
+    key.label = label == NULL ? "" : label;
+    key.value = value == NULL ? "" : value;
+    node = hash_lookup(index->values, &key);
+    if (node == NULL) {
+        *children = NULL;
+        return 0;
+    }
+    *children = ((struct tree_value *) hnode_get(node))->children;
+    return ((struct tree_value *) hnode_get(node))->count;
+}
+
+static void tree_index_renumber(struct tree *tree) {
+    struct tree_index *index = tree->index;
+    hscan_t scan;
+    hnode_t *node;
+
+    hash_scan_begin(&scan, index->labels);
+    while ((node = hash_scan_next(&scan)) != NULL)
+        ((struct tree_label *) hnode_get(node))->numbered = 0;
+
+    list_for_each(c, tree->children) {
+        struct tree_label *tl;
+        node = hash_lookup(index->labels, index_key(c));
+        tl = hnode_get(node);
+        tl->numbered += 1;
+        c->ordinal = tl->numbered;
+    }
+    index->renumber = false;
+}
+
+int tree_sibling_index(struct tree *tree, int *count) {
+    struct tree *parent = tree->parent;
+    int ind = 0;
+
+    if (tree->label != NULL && *tree->label != '\0'
+        && tree_index(parent) != NULL) {
+        hnode_t *node = hash_lookup(parent->index->labels, tree->label);
+        struct tree_label *tl = hnode_get(node);
+
+        if (parent->index->renumber)
+            tree_index_renumber(parent);
+        *count = tl->count;
+        return tree->ordinal;
+    }
+
+    *count = 0;
+    list_for_each(t, parent->children) {
+        if (streqv(t->label, tree->label)) {
+            *count += 1;
+            if (t == tree)
+                ind = *count;
+        }
+    }
+    return ind;
+}
+
+/* The summary of the labels below a node is a small Bloom filter: each
+ * label sets two of the 64 bits in LABELS_BELOW */
+static uint64_t label_bits(const char *label) {
+    uint32_t hash = 5381;
+
+    if (label != NULL) {
+        for (const char *c = label; *c != '\0'; c++)
+            hash = hash * 33 + (unsigned char) *c;
+    }
+    return (UINT64_C(1) << (hash & 63)) | (UINT64_C(1) << ((hash >> 6) & 63));
+}
+
+/* A node only has a label summary if all its descendants have one, so we
+ * can stop at the first node that has none */
+void tree_labels_changed(struct tree *tree) {
+    while (tree != NULL && tree->has_labels_below) {
+        tree->has_labels_below = 0;
+        tree = tree->parent;
+    }
+}
+
+static uint64_t tree_labels_below(struct tree *tree) {
+    if (! tree->has_labels_below) {
+        uint64_t bits = 0;
+        list_for_each(c, tree->children)
+            bits |= label_bits(c->label) | tree_labels_below(c);
+        tree->labels_below = bits;
+        tree->has_labels_below = 1;
+    }
+    return tree->labels_below;
+}
+
+bool tree_maybe_below(struct tree *tree, const char *label) {
+    uint64_t bits = label_bits(label);
+
+    return (tree_labels_below(tree) & bits) == bits;
+}
+
+void tree_detach(struct tree *tree) {
+    struct tree *parent = tree->parent;
+
+    tree_labels_changed(parent);
+    tree_index_remove(parent, tree);
+    list_remove(tree, parent->children);
+    if (parent->children == NULL)
+        tree_index_drop(parent);
+}
+
 struct tree *tree_child_cr(struct tree *tree, const char *label) {
-    static struct tree *child = NULL;
+    struct tree *child = NULL;
 
     if (tree == NULL)
         return NULL;
@@ -215,16 +622,31 @@ struct tree *tree_find_cr(struct augeas *aug, const char *path) {
     return result;
 }
 
+/* Free the label of TREE, unless it belongs to the arena of TREE */
+static void tree_free_label(struct tree *tree) {
+    if (! tree->arena_label)
+        free(tree->label);
+    tree->label = NULL;
+    tree->arena_label = 0;
+}
+
+/* Free the value of TREE, unless it belongs to the arena of TREE */
+static void tree_free_value(struct tree *tree) {
+    if (! tree->arena_value)
+        free(tree->value);
+    tree->value = NULL;
+    tree->arena_value = 0;
+}
+
 void tree_store_value(struct tree *tree, char **value) {
     if (streqv(tree->value, *value)) {
         free(*value);
         *value = NULL;
         return;
     }
-    if (tree->value != NULL) {
-        free(tree->value);
-        tree->value = NULL;
-    }
+    if (tree->parent != NULL)
+        tree_index_drop_values(tree->parent->index);
+    tree_free_value(tree);
     if (*value != NULL) {
         tree->value = *value;
         *value = NULL;
@@ -280,6 +702,45 @@ static void store_pathx_error(const struct augeas *aug) {
                 2, s_pos, aug->error->details);
 }
 
+/* Set the child LABEL of TREE to COUNT. The counters change with almost
+ * every API call, and do not mark the tree dirty like tree_set_value */
+static void store_pathx_cache_counter(struct tree *tree, const char *label,
+                                      unsigned long count) {
+    struct tree *t = tree_child_cr(tree, label);
+    char *v = NULL;
+
+    if (t == NULL || xasprintf(&v, "%lu", count) < 0)
+        return;
+    tree_index_drop_values(tree->index);
+    tree_free_value(t);
+    t->value = v;
+}
+
+/* Report how often path expressions were found in the cache in
+ * /augeas/pathx/cache, including the one that was just looked up, so that
+ * reading the counters shows them up to date. Only counters that changed
+ * since they were last reported are written */
+static void store_pathx_cache_stats(struct augeas *aug) {
+    unsigned long hits, misses;
+    struct tree *tree;
+
+    if (aug->pathx_cache == NULL)
+        return;
+    pathx_cache_stats(aug->pathx_cache, &hits, &misses);
+    if (hits == aug->pathx_hits && misses == aug->pathx_misses)
+        return;
+
+    tree = tree_path_cr(aug->origin, 3, s_augeas, s_pathx, s_cache);
+    if (tree == NULL)
+        return;
+    if (hits != aug->pathx_hits)
+        store_pathx_cache_counter(tree, "hits", hits);
+    if (misses != aug->pathx_misses)
+        store_pathx_cache_counter(tree, "misses", misses);
+    aug->pathx_hits = hits;
+    aug->pathx_misses = misses;
+}
+
 struct pathx *pathx_aug_parse(const struct augeas *aug,
                               struct tree *tree,
                               struct tree *root_ctx,
@@ -290,7 +751,9 @@ struct pathx *pathx_aug_parse(const struct augeas *aug,
     if (tree == NULL)
         tree = aug->origin;
 
-    pathx_parse(tree, err, path, need_nodeset, aug->symtab, root_ctx, &result);
+    pathx_cache_parse(aug->pathx_cache, tree, err, path, need_nodeset,
+                      aug->symtab, root_ctx, &result);
+    store_pathx_cache_stats((struct augeas *) aug);
     return result;
 }
 
@@ -344,8 +807,20 @@ struct tree *tree_root_ctx(const struct augeas *aug) {
 struct tree *tree_append(struct tree *parent,
                          char *label, char *value) {
     struct tree *result = make_tree(label, value, parent, NULL);
-    if (result != NULL)
+
+    if (result == NULL)
+        return NULL;
+
+    if (parent->index != NULL) {
+        if (parent->index->last != NULL)
+            parent->index->last->next = result;
+        else
+            list_append(parent->children, result);
+        parent->index->last = result;
+        tree_index_add(parent, result, true);
+    } else {
         list_append(parent->children, result);
+    }
     return result;
 }
 
@@ -533,6 +1008,15 @@ static int init_loadpath(struct augeas *aug, const char *loadpath) {
     return 0;
 }
 
+static int init_lens_cache(struct augeas *aug) {
+    const char *dir = getenv(AUGEAS_LENS_CACHE_ENV);
+
+    if (dir == NULL || dir[0] == '\0')
+        return 0;
+    aug->lens_cache = strdup(dir);
+    return aug->lens_cache == NULL ? -1 : 0;
+}
+
 static void init_save_mode(struct augeas *aug) {
     const char *v = AUG_SAVE_OVERWRITE_TEXT;
 
@@ -547,8 +1031,30 @@ static void init_save_mode(struct augeas *aug) {
     aug_set(aug, AUGEAS_META_SAVE_MODE, v);
 }
 
-struct augeas *aug_init(const char *root, const char *loadpath,
-                        unsigned int flags) {
+/* Parse files with one thread per processor if AUG_PARALLEL_LOAD is set,
+ * and with just one thread otherwise */
+static int init_threads(struct augeas *aug) {
+    char *threads = NULL;
+    long n = 1;
+    int r;
+
+    if (aug->flags & AUG_PARALLEL_LOAD) {
+        n = sysconf(_SC_NPROCESSORS_ONLN);
+        if (n < 1)
+            n = 1;
+    }
+    r = xasprintf(&threads, "%ld", n);
+    if (r < 0)
+        return -1;
+    r = aug_set(aug, AUGEAS_THREADS_OPTION, threads);
+    free(threads);
+    return r;
+}
+
+/* Create a new handle. If SHARED is not NULL, use its search path and
+ * modules instead of loading modules from LOADPATH */
+static struct augeas *init_handle(const char *root, const char *loadpath,
+                                  unsigned int flags, struct augeas *shared) {
     struct augeas *result;
     struct tree *tree_root = make_tree(NULL, NULL, NULL, NULL);
     int r;
@@ -559,7 +1065,7 @@ struct augeas *aug_init(const char *root, const char *loadpath,
 
     if (ALLOC(result) < 0)
         goto error;
-    if (ALLOC(result->error) < 0)
+    if (make_ref(result->error) < 0)
         goto error;
     if (make_ref(result->error->info) < 0)
         goto error;
@@ -584,11 +1090,24 @@ struct augeas *aug_init(const char *root, const char *loadpath,
 
     result->origin->children->label = strdup(s_augeas);
 
+    result->pathx_cache = make_pathx_cache();
+    ERR_NOMEM(result->pathx_cache == NULL, result);
+    /* Make sure both counters get written the first time */
+    result->pathx_hits = ULONG_MAX;
+    result->pathx_misses = ULONG_MAX;
+
     /* We are now initialized enough that we can dare return RESULT even
      * when we encounter errors if the caller so wishes */
     close_on_error = !(flags & AUG_NO_ERR_CLOSE);
 
-    r = init_loadpath(result, loadpath);
+    if (shared != NULL)
+        r = argz_append(&result->modpathz, &result->nmodpath,
+                        shared->modpathz, shared->nmodpath);
+    else
+        r = init_loadpath(result, loadpath);
+    ERR_NOMEM(r != 0, result);
+
+    r = init_lens_cache(result);
     ERR_NOMEM(r < 0, result);
 
     /* We report the root dir in AUGEAS_META_ROOT, but we only use the
@@ -613,8 +1132,26 @@ struct augeas *aug_init(const char *root, const char *loadpath,
     aug_set(result, AUGEAS_SPAN_OPTION, v);
     ERR_BAIL(result);
 
-    if (interpreter_init(result) == -1)
-        goto error;
+    v = (flags & AUG_ENABLE_WATCH) ? AUG_ENABLE : AUG_DISABLE;
+    aug_set(result, AUGEAS_WATCH_OPTION, v);
+    ERR_BAIL(result);
+
+    v = (flags & AUG_INCREMENTAL_SAVE) ? AUG_ENABLE : AUG_DISABLE;
+    aug_set(result, AUGEAS_INCREMENTAL_SAVE_OPTION, v);
+    ERR_BAIL(result);
+
+    r = init_threads(result);
+    ERR_NOMEM(r < 0, result);
+
+    if (shared != NULL) {
+        if (interpreter_share(result, shared) == -1)
+            goto error;
+        shared->shared_modules = true;
+        result->shared_modules = true;
+    } else {
+        if (interpreter_init(result) == -1)
+            goto error;
+    }
 
     list_for_each(modl, result->modules) {
         struct transform *xform = modl->autoload;
@@ -640,6 +1177,18 @@ struct augeas *aug_init(const char *root, const char *loadpath,
     return result;
 }
 
+struct augeas *aug_init(const char *root, const char *loadpath,
+                        unsigned int flags) {
+    return init_handle(root, loadpath, flags, NULL);
+}
+
+struct augeas *aug_init_shared(struct augeas *aug, const char *root,
+                               unsigned int flags) {
+    if (aug == NULL)
+        return NULL;
+    return init_handle(root, NULL, flags, aug);
+}
+
 /* Free one tree node */
 static void free_tree_node(struct tree *tree) {
     if (tree == NULL)
@@ -647,9 +1196,15 @@ static void free_tree_node(struct tree *tree) {
 
     if (tree->span != NULL)
         free_span(tree->span);
-    free(tree->label);
-    free(tree->value);
-    free(tree);
+    free_tree_index(tree->index);
+    tree_free_label(tree);
+    tree_free_value(tree);
+    if (tree->arena != NULL) {
+        struct arena *arena = tree->arena;
+        unref(arena, arena);
+    } else {
+        free(tree);
+    }
 }
 
 /* Only unlink; assume we know TREE is not in the symtab */
@@ -657,7 +1212,7 @@ static int tree_unlink_raw(struct tree *tree) {
     int result = 0;
 
     assert (tree->parent != NULL);
-    list_remove(tree, tree->parent->children);
+    tree_detach(tree);
     tree_mark_dirty(tree->parent);
     result = free_tree(tree->children) + 1;
     free_tree_node(tree);
@@ -677,6 +1232,7 @@ void tree_unlink_children(struct augeas *aug, struct tree *tree) {
 
     pathx_symtab_remove_descendants(aug->symtab, tree);
 
+    tree_index_drop(tree);
     while (tree->children != NULL)
         tree_unlink_raw(tree->children);
 }
@@ -726,6 +1282,24 @@ static void tree_rm_dirty_leaves(struct augeas *aug, struct tree *tree,
         tree_unlink(aug, tree);
 }
 
+/* Mark the entries under /augeas/files for the NFILES files in FILES,
+ * which all start with AUG->ROOT, as dirty */
+static void tree_mark_changed_files(struct augeas *aug,
+                                    int nfiles, char **files) {
+    for (int i=0; i < nfiles; i++) {
+        struct tree *finfo;
+        char *path = NULL;
+
+        if (pathjoin(&path, 2, AUGEAS_META_FILES,
+                     files[i] + strlen(aug->root) - 1) < 0)
+            continue;
+        finfo = tree_fpath(aug, path);
+        free(path);
+        if (finfo != NULL && tree_child(finfo, "path") != NULL)
+            tree_mark_dirty(finfo);
+    }
+}
+
 int aug_load(struct augeas *aug) {
     const char *option = NULL;
     struct tree *meta = tree_child_cr(aug->origin, s_augeas);
@@ -733,6 +1307,11 @@ int aug_load(struct augeas *aug) {
     struct tree *files = tree_child_cr(aug->origin, s_files);
     struct tree *load = tree_child_cr(meta, s_load);
     struct tree *vars = tree_child_cr(meta, s_vars);
+    char **changed = NULL;
+    int nchanged = 0;
+    bool incremental = false;
+    int64_t nthreads = 1;
+    int r;
 
     api_entry(aug);
 
@@ -751,6 +1330,15 @@ int aug_load(struct augeas *aug) {
      *     anymore
      * (4) Remove entries from /augeas/files and /files that correspond
      *     to directories without any files of interest
+     *
+     * With more than one thread, the files that need to be parsed in
+     * step (2) are only queued; they are parsed in parallel once all
+     * transforms have been processed, and then put into the tree in the
+     * order in which they were queued.
+     *
+     * When we are watching files, and nothing in the tree has changed
+     * since the last load, steps (1) and (2) only look at the files that
+     * the watch reported as changed.
      */
 
     /* update flags according to option value */
@@ -762,13 +1350,75 @@ int aug_load(struct augeas *aug) {
         }
     }
 
-    tree_clean(meta_files);
-    tree_mark_files(meta_files);
+    if (aug_get(aug, AUGEAS_WATCH_OPTION, &option) == 1) {
+        if (strcmp(option, AUG_ENABLE) == 0) {
+            aug->flags |= AUG_ENABLE_WATCH;
+        } else {
+            aug->flags &= ~AUG_ENABLE_WATCH;
+        }
+    }
+
+    if (aug_get(aug, AUGEAS_INCREMENTAL_SAVE_OPTION, &option) == 1) {
+        if (strcmp(option, AUG_ENABLE) == 0) {
+            aug->flags |= AUG_INCREMENTAL_SAVE;
+        } else {
+            aug->flags &= ~AUG_INCREMENTAL_SAVE;
+        }
+    }
+    /* Loading clears the dirty flags of files it does not reload */
+    transform_forget_files(aug, !(aug->flags & AUG_INCREMENTAL_SAVE));
+
+    if (aug_get(aug, AUGEAS_THREADS_OPTION, &option) == 1) {
+        if (option == NULL || xstrtoint64(option, 10, &nthreads) < 0
+            || nthreads < 1)
+            nthreads = 1;
+        if (nthreads > 1) {
+            aug->flags |= AUG_PARALLEL_LOAD;
+        } else {
+            aug->flags &= ~AUG_PARALLEL_LOAD;
+        }
+    }
+
+    if (aug->flags & AUG_ENABLE_WATCH) {
+        if (aug->watch != NULL
+            && !load->dirty && !meta_files->dirty && !files->dirty) {
+            r = watch_changes(aug->watch, &changed, &nchanged);
+            ERR_NOMEM(r < 0, aug);
+            incremental = (r == 1);
+        }
+        /* Start watching before we look at any files so that we do not
+         * miss changes made while we load. If we can't watch, we simply
+         * look at all files every time */
+        if (! incremental)
+            watch_start(aug, load);
+    } else {
+        free_watch(aug->watch);
+        aug->watch = NULL;
+    }
+
+    if (nthreads > 1) {
+        r = transform_load_start(aug, nthreads);
+        ERR_NOMEM(r < 0, aug);
+    }
+
+    if (incremental) {
+        tree_mark_changed_files(aug, nchanged, changed);
+        if (nchanged > 0) {
+            list_for_each(xfm, load->children) {
+                if (transform_validate(aug, xfm) == 0)
+                    transform_load_files(aug, xfm, nchanged, changed);
+            }
+        }
+    } else {
+        tree_clean(meta_files);
+        tree_mark_files(meta_files);
 
-    list_for_each(xfm, load->children) {
-        if (transform_validate(aug, xfm) == 0)
-            transform_load(aug, xfm);
+        list_for_each(xfm, load->children) {
+            if (transform_validate(aug, xfm) == 0)
+                transform_load(aug, xfm);
+        }
     }
+    transform_load_finish(aug);
 
     /* This makes it possible to spot 'directories' that are now empty
      * because we removed their file contents */
@@ -785,9 +1435,15 @@ int aug_load(struct augeas *aug) {
         ERR_BAIL(aug);
     }
 
+    for (int i=0; i < nchanged; i++)
+        free(changed[i]);
+    free(changed);
     api_exit(aug);
     return 0;
  error:
+    for (int i=0; i < nchanged; i++)
+        free(changed[i]);
+    free(changed);
     api_exit(aug);
     return -1;
 }
@@ -809,16 +1465,13 @@ static int find_one_node(struct pathx *p, struct tree **match) {
     return -1;
 }
 
-int aug_get(const struct augeas *aug, const char *path, const char **value) {
-    struct pathx *p = NULL;
+/* Find the value of the one node matching P, the path expression for
+ * PATH. Return the number of matching nodes, or -1 on error */
+static int get_pathx(const struct augeas *aug, struct pathx *p,
+                     const char *path, const char **value) {
     struct tree *match;
     int r;
 
-    api_entry(aug);
-
-    p = pathx_aug_parse(aug, aug->origin, tree_root_ctx(aug), path, true);
-    ERR_BAIL(aug);
-
     if (value != NULL)
         *value = NULL;
 
@@ -829,14 +1482,25 @@ int aug_get(const struct augeas *aug, const char *path, const char **value) {
 
     if (r == 1 && value != NULL)
         *value = match->value;
-    free_pathx(p);
-
-    api_exit(aug);
     return r;
+ error:
+    return -1;
+}
+
+int aug_get(const struct augeas *aug, const char *path, const char **value) {
+    struct pathx *p = NULL;
+    int r = -1;
+
+    api_entry(aug);
+
+    p = pathx_aug_parse(aug, aug->origin, tree_root_ctx(aug), path, true);
+    ERR_BAIL(aug);
+
+    r = get_pathx(aug, p, path, value);
  error:
     free_pathx(p);
     api_exit(aug);
-    return -1;
+    return r;
 }
 
 int aug_label(const struct augeas *aug, const char *path, const char **label) {
@@ -885,6 +1549,13 @@ static void record_var_meta(struct augeas *aug, const char *name,
     return;
 }
 
+/* Path expressions that were typechecked against the old symtab need to
+ * be checked again */
+static void symtab_changed(struct augeas *aug) {
+    pathx_cache_clear(aug->pathx_cache);
+    aug->symtab_version += 1;
+}
+
 int aug_defvar(augeas *aug, const char *name, const char *expr) {
     struct pathx *p = NULL;
     int result = -1;
@@ -898,6 +1569,7 @@ int aug_defvar(augeas *aug, const char *name, const char *expr) {
         ERR_BAIL(aug);
         result = pathx_symtab_define(&(aug->symtab), name, p);
     }
+    symtab_changed(aug);
     ERR_BAIL(aug);
 
     record_var_meta(aug, name, expr);
@@ -951,6 +1623,7 @@ int aug_defnode(augeas *aug, const char *name, const char *expr,
     }
 
  done:
+    symtab_changed(aug);
     free_pathx(p);
     api_exit(aug);
     return result;
@@ -1069,7 +1742,10 @@ int tree_insert(struct pathx *p, const char *label, int before) {
     } else {
         new->next = match->next;
         match->next = new;
+        if (new->parent->index != NULL && new->parent->index->last == match)
+            new->parent->index->last = new;
     }
+    tree_index_add(new->parent, new, false);
     return 0;
  error:
     free_tree(new);
@@ -1105,10 +1781,33 @@ struct tree *make_tree(char *label, char *value, struct tree *parent,
     tree->children = children;
     list_for_each(c, tree->children)
         c->parent = tree;
-    if (parent != NULL)
+    if (parent != NULL) {
         tree_mark_dirty(tree);
-    else
+        tree_labels_changed(parent);
+    } else {
         tree->dirty = 1;
+    }
+    return tree;
+}
+
+struct tree *make_tree_arena(struct arena *arena, char *label, char *value,
+                             struct tree *children) {
+    struct tree *tree;
+
+    tree = arena_alloc(arena, sizeof(*tree));
+    if (tree == NULL)
+        return NULL;
+    MEMZERO(tree, 1);
+
+    tree->arena = ref(arena);
+    tree->label = label;
+    tree->arena_label = (label != NULL);
+    tree->value = value;
+    tree->arena_value = (value != NULL);
+    tree->children = children;
+    list_for_each(c, tree->children)
+        c->parent = tree;
+    tree->dirty = 1;
     return tree;
 }
 
@@ -1190,6 +1889,58 @@ int aug_rm(struct augeas *aug, const char *path) {
     return -1;
 }
 
+int aug_batch(struct augeas *aug, struct aug_op *ops, size_t nops) {
+    struct error *err = aug->error;
+    struct error last;
+    int failed = 0;
+
+    api_entry(aug);
+
+    MEMZERO(&last, 1);
+    for (size_t i=0; i < nops; i++) {
+        struct aug_op *op = ops + i;
+
+        /* The calls below are nested inside our api_entry, and therefore
+         * neither reset the error nor switch the locale themselves */
+        reset_error(err);
+        if (op->path == NULL
+            || (op->op == AUG_OP_INSERT && op->value == NULL)) {
+            op->result = -1;
+            report_error(err, AUG_EBADARG,
+                         "operation %zu of the batch lacks a path or label",
+                         i);
+        } else if (op->op == AUG_OP_SET) {
+            op->result = aug_set(aug, op->path, op->value);
+        } else if (op->op == AUG_OP_INSERT) {
+            op->result = aug_insert(aug, op->path, op->value, op->before);
+        } else if (op->op == AUG_OP_RM) {
+            op->result = aug_rm(aug, op->path);
+        } else {
+            op->result = -1;
+            report_error(err, AUG_EBADARG,
+                         "operation %zu of the batch has unknown type %d",
+                         i, op->op);
+        }
+        op->code = err->code;
+        if (op->result < 0) {
+            failed += 1;
+            free(last.details);
+            last = *err;
+            err->details = NULL;
+        }
+    }
+
+    /* Report the last failure as if it came from this call */
+    reset_error(err);
+    err->code = last.code;
+    err->minor = last.minor;
+    err->details = last.details;
+    err->minor_details = last.minor_details;
+
+    api_exit(aug);
+    return failed;
+}
+
 int aug_span(struct augeas *aug, const char *path, char **filename,
         uint *label_start, uint *label_end, uint *value_start, uint *value_end,
         uint *span_start, uint *span_end) {
@@ -1250,6 +2001,8 @@ int aug_span(struct augeas *aug, const char *path, char **filename,
 int aug_mv(struct augeas *aug, const char *src, const char *dst) {
     struct pathx *s = NULL, *d = NULL;
     struct tree *ts, *td, *t;
+    char *value;
+    bool arena_value;
     int r, ret;
 
     api_entry(aug);
@@ -1277,16 +2030,31 @@ int aug_mv(struct augeas *aug, const char *src, const char *dst) {
         t = t->parent;
     } while (t != aug->origin);
 
+    /* The value of TS can only be used for TD as is if it does not belong
+     * to an arena other than that of TD */
+    value = ts->value;
+    arena_value = ts->arena_value && ts->arena == td->arena;
+    if (ts->arena_value && ! arena_value) {
+        value = strdup(ts->value);
+        ERR_NOMEM(value == NULL, aug);
+    }
+
     free_tree(td->children);
+    tree_index_drop(td);
+    tree_index_drop(ts);
 
     td->children = ts->children;
     list_for_each(c, td->children) {
         c->parent = td;
     }
-    free(td->value);
-    td->value = ts->value;
+    tree_labels_changed(td);
+    tree_index_drop_values(td->parent->index);
+    tree_free_value(td);
+    td->value = value;
+    td->arena_value = arena_value;
 
     ts->value = NULL;
+    ts->arena_value = 0;
     ts->children = NULL;
 
     tree_unlink(aug, ts);
@@ -1343,6 +2111,7 @@ int aug_cp(struct augeas *aug, const char *src, const char *dst) {
 
     tree_set_value(td, ts->value);
     free_tree(td->children);
+    tree_index_drop(td);
     td->children = NULL;
     tree_copy_rec(ts, td);
     tree_mark_dirty(td);
@@ -1371,8 +2140,11 @@ int aug_rename(struct augeas *aug, const char *src, const char *lbl) {
     ERR_BAIL(aug);
 
     for (ts = pathx_first(s); ts != NULL; ts = pathx_next(s)) {
-        free(ts->label);
+        tree_index_remove(ts->parent, ts);
+        tree_free_label(ts);
         ts->label = strdup(lbl);
+        tree_index_add(ts->parent, ts, false);
+        tree_labels_changed(ts->parent);
         tree_mark_dirty(ts);
         count ++;
     }
@@ -1386,23 +2158,16 @@ int aug_rename(struct augeas *aug, const char *src, const char *lbl) {
     return ret;
 }
 
-int aug_match(const struct augeas *aug, const char *pathin, char ***matches) {
-    struct pathx *p = NULL;
+/* Set *MATCHES to the paths of the nodes matching P, unless MATCHES is
+ * NULL. Return the number of matching nodes, or -1 on error */
+static int match_pathx(const struct augeas *aug, struct pathx *p,
+                       char ***matches) {
     struct tree *tree;
     int cnt = 0;
 
-    api_entry(aug);
-
     if (matches != NULL)
         *matches = NULL;
 
-    if (STREQ(pathin, "/")) {
-        pathin = "/*";
-    }
-
-    p = pathx_aug_parse(aug, aug->origin, tree_root_ctx(aug), pathin, true);
-    ERR_BAIL(aug);
-
     for (tree = pathx_first(p); tree != NULL; tree = pathx_next(p)) {
         if (! TREE_HIDDEN(tree))
             cnt += 1;
@@ -1427,8 +2192,6 @@ int aug_match(const struct augeas *aug, const char *pathin, char ***matches) {
     }
     ERR_BAIL(aug);
  done:
-    free_pathx(p);
-    api_exit(aug);
     return cnt;
 
  error:
@@ -1436,14 +2199,266 @@ int aug_match(const struct augeas *aug, const char *pathin, char ***matches) {
         if (*matches != NULL) {
             for (i=0; i < cnt; i++)
                 free((*matches)[i]);
-            free(*matches);
+            FREE(*matches);
         }
     }
+    return -1;
+}
+
+int aug_match(const struct augeas *aug, const char *pathin, char ***matches) {
+    struct pathx *p = NULL;
+    int cnt = -1;
+
+    api_entry(aug);
+
+    if (matches != NULL)
+        *matches = NULL;
+
+    if (STREQ(pathin, "/")) {
+        pathin = "/*";
+    }
+
+    p = pathx_aug_parse(aug, aug->origin, tree_root_ctx(aug), pathin, true);
+    ERR_BAIL(aug);
+
+    cnt = match_pathx(aug, p, matches);
+ error:
     free_pathx(p);
+    api_exit(aug);
+    return cnt;
+}
+
+/*
+ * Iterating over matches
+ */
+struct aug_iter {
+    struct augeas *aug;
+    struct pathx  *pathx;
+    struct tree   *next;      /* The match aug_iter_next returns next */
+};
+
+/* Starting from TREE, find the next match of ITER that is not hidden */
+static struct tree *iter_skip_hidden(struct aug_iter *iter,
+                                     struct tree *tree) {
+    while (tree != NULL && TREE_HIDDEN(tree))
+        tree = pathx_next(iter->pathx);
+    return tree;
+}
+
+aug_iter *aug_iter_match(struct augeas *aug, const char *path) {
+    struct aug_iter *iter = NULL;
+    struct tree *tree;
+
+    api_entry(aug);
+
+    ARG_CHECK(path == NULL, aug, "aug_iter_match: PATH must not be NULL");
+
+    if (STREQ(path, "/")) {
+        path = "/*";
+    }
+
+    ERR_NOMEM(ALLOC(iter) < 0, aug);
+    iter->aug = aug;
+    iter->pathx = pathx_aug_parse(aug, aug->origin, tree_root_ctx(aug),
+                                  path, true);
+    ERR_BAIL(aug);
+
+    tree = pathx_first(iter->pathx);
+    ERR_BAIL(aug);
+    iter->next = iter_skip_hidden(iter, tree);
+
+    api_exit(aug);
+    return iter;
+ error:
+    aug_iter_free(iter);
+    api_exit(aug);
+    return NULL;
+}
+
+aug_node *aug_iter_next(aug_iter *iter) {
+    struct tree *tree = iter->next;
+
+    if (tree != NULL)
+        iter->next = iter_skip_hidden(iter, pathx_next(iter->pathx));
+    return (aug_node *) tree;
+}
+
+void aug_iter_free(aug_iter *iter) {
+    if (iter == NULL)
+        return;
+    free_pathx(iter->pathx);
+    free(iter);
+}
+
+const char *aug_node_label(const aug_node *node) {
+    return ((const struct tree *) node)->label;
+}
+
+const char *aug_node_value(const aug_node *node) {
+    return ((const struct tree *) node)->value;
+}
+
+char *aug_node_path(const aug_node *node) {
+    return path_of_tree((struct tree *) node);
+}
+
+/*
+ * Prepared statements
+ */
+struct aug_stmt {
+    struct augeas *aug;
+    char          *path;
+    struct pathx  *pathx;
+    uint           symtab_version; /* AUG->SYMTAB_VERSION when PATHX was
+                                      last typechecked */
+};
+
+aug_stmt *aug_prepare(struct augeas *aug, const char *path) {
+    struct aug_stmt *stmt = NULL;
+
+    api_entry(aug);
+
+    ARG_CHECK(path == NULL, aug, "aug_prepare: PATH must not be NULL");
+
+    ERR_NOMEM(ALLOC(stmt) < 0, aug);
+    stmt->aug = aug;
+    stmt->path = strdup(path);
+    ERR_NOMEM(stmt->path == NULL, aug);
+
+    pathx_parse(aug->origin, aug->error, stmt->path, true, aug->symtab,
+                NULL, &stmt->pathx);
+    ERR_BAIL(aug);
+    stmt->symtab_version = aug->symtab_version;
+
+    api_exit(aug);
+    return stmt;
+ error:
+    aug_finalize(stmt);
+    api_exit(aug);
+    return NULL;
+}
+
+/* Get the path expression of STMT ready to be evaluated against the
+ * current tree and variables */
+static struct pathx *stmt_pathx(struct aug_stmt *stmt) {
+    struct augeas *aug = stmt->aug;
+    struct tree *root_ctx = NULL;
+
+    /* Get-out clause, in case context is broken */
+    if (STRNEQ(stmt->path, AUGEAS_CONTEXT)) {
+        root_ctx = tree_root_ctx(aug);
+        ERR_BAIL(aug);
+    }
+
+    pathx_reuse(stmt->pathx, aug->origin, aug->error, aug->symtab, root_ctx);
+    if (stmt->symtab_version != aug->symtab_version) {
+        pathx_typecheck(stmt->pathx, true);
+        ERR_BAIL(aug);
+        stmt->symtab_version = aug->symtab_version;
+    }
+    return stmt->pathx;
+ error:
+    return NULL;
+}
+
+int aug_bind(aug_stmt *stmt, int n, const char *value) {
+    struct augeas *aug = stmt->aug;
+    int r;
+
+    api_entry(aug);
+
+    ARG_CHECK(n < 1 || n > pathx_nparams(stmt->pathx), aug,
+              "aug_bind: %s does not have a parameter $%d", stmt->path, n);
+    ARG_CHECK(value == NULL, aug, "aug_bind: VALUE must not be NULL");
+
+    r = pathx_bind(stmt->pathx, n, value);
+    ERR_NOMEM(r < 0, aug);
+
+    api_exit(aug);
+    return 0;
+ error:
+    api_exit(aug);
+    return -1;
+}
+
+int aug_stmt_get(aug_stmt *stmt, const char **value) {
+    struct augeas *aug = stmt->aug;
+    struct pathx *p;
+    int r = -1;
+
+    api_entry(aug);
+
+    p = stmt_pathx(stmt);
+    ERR_BAIL(aug);
+
+    r = get_pathx(aug, p, stmt->path, value);
+ error:
+    api_exit(aug);
+    return r;
+}
+
+int aug_stmt_set(aug_stmt *stmt, const char *value) {
+    struct augeas *aug = stmt->aug;
+    struct pathx *p;
+    int r = -1;
+
+    api_entry(aug);
+
+    p = stmt_pathx(stmt);
+    ERR_BAIL(aug);
+
+    r = tree_set(p, value) == NULL ? -1 : 0;
+ error:
+    api_exit(aug);
+    return r;
+}
+
+int aug_stmt_rm(aug_stmt *stmt) {
+    struct augeas *aug = stmt->aug;
+    struct pathx *p;
+    int r = -1;
+
+    api_entry(aug);
+
+    p = stmt_pathx(stmt);
+    ERR_BAIL(aug);
+
+    r = tree_rm(p);
+    ERR_BAIL(aug);
+    api_exit(aug);
+    return r;
+ error:
     api_exit(aug);
     return -1;
 }
 
+int aug_stmt_match(aug_stmt *stmt, char ***matches) {
+    struct augeas *aug = stmt->aug;
+    struct pathx *p;
+    int r = -1;
+
+    api_entry(aug);
+
+    if (matches != NULL)
+        *matches = NULL;
+
+    p = stmt_pathx(stmt);
+    ERR_BAIL(aug);
+
+    r = match_pathx(aug, p, matches);
+ error:
+    api_exit(aug);
+    return r;
+}
+
+void aug_finalize(aug_stmt *stmt) {
+    if (stmt == NULL)
+        return;
+    free_pathx(stmt->pathx);
+    free(stmt->path);
+    free(stmt);
+}
+
 static int tree_save(struct augeas *aug, struct tree *tree,
                      const char *path) {
     int result = 0;
@@ -1591,6 +2606,7 @@ int aug_save(struct augeas *aug) {
         }
     }
     if (!(aug->flags & AUG_SAVE_NOOP)) {
+        transform_forget_files(aug, false);
         tree_clean(aug->origin);
     }
 
@@ -2028,18 +3044,18 @@ void aug_close(struct augeas *aug) {
 
     /* There's no point in bothering with api_entry/api_exit here */
     free_tree(aug->origin);
+    transform_forget_files(aug, true);
     unref(aug->modules, module);
-    if (aug->error->exn != NULL) {
-        aug->error->exn->ref = 0;
-        free_value(aug->error->exn);
-        aug->error->exn = NULL;
-    }
     free((void *) aug->root);
     free(aug->modpathz);
+    free(aug->lens_cache);
+    free_watch(aug->watch);
     free_symtab(aug->symtab);
-    unref(aug->error->info, info);
-    free(aug->error->details);
-    free(aug->error);
+    free_pathx_cache(aug->pathx_cache);
+    /* Modules shared with other handles might still use the error */
+    if (aug->error != NULL)
+        aug->error->aug = NULL;
+    unref(aug->error, error);
     free(aug);
 }
 
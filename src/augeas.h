@@ -27,6 +27,9 @@
 #define AUGEAS_H_
 
 typedef struct augeas augeas;
+typedef struct aug_stmt aug_stmt;
+typedef struct aug_iter aug_iter;
+typedef struct aug_node aug_node;
 
 /* Enum: aug_flags
  *
@@ -52,7 +55,18 @@ enum aug_flags {
     AUG_ENABLE_SPAN  = (1 << 7),  /* Track the span in the input of nodes */
     AUG_NO_ERR_CLOSE = (1 << 8),  /* Do not close automatically when
                                      encountering error during aug_init */
-    AUG_TRACE_MODULE_LOADING = (1 << 9) /* For use by augparse -t */
+    AUG_TRACE_MODULE_LOADING = (1 << 9), /* For use by augparse -t */
+    AUG_LAZY_MODULES = (1 << 10), /* Only index modules on startup, and
+                                     compile them when they are first
+                                     used */
+    AUG_ENABLE_WATCH = (1 << 11), /* Watch loaded files with inotify, and
+                                     only look at changed files in
+                                     aug_load */
+    AUG_PARALLEL_LOAD = (1 << 12), /* Parse files in aug_load with one
+                                     thread per processor */
+    AUG_INCREMENTAL_SAVE = (1 << 13) /* Keep the text of loaded files, and
+                                     only put the parts of their tree
+                                     that changed when saving */
 };
 
 #ifdef __cplusplus
@@ -87,6 +101,29 @@ extern "C" {
  */
 augeas *aug_init(const char *root, const char *loadpath, unsigned int flags);
 
+/* Function: aug_init_shared
+ *
+ * Initialize a new handle that uses the modules AUG has already compiled
+ * instead of compiling its own. All handles created like this share one
+ * copy of the compiled modules, which makes it cheap to give every thread
+ * of a program its own handle.
+ *
+ * ROOT and FLAGS have the same meaning as for aug_init. The new handle
+ * looks for modules in the same places as AUG; modules that AUG has not
+ * compiled yet, e.g. because of AUG_LAZY_MODULES, are compiled by each
+ * handle that needs them.
+ *
+ * A handle must still only be used by one thread at a time, but handles
+ * that share modules can be used from different threads at the same
+ * time. AUG must not be in use while aug_init_shared runs; it can be
+ * closed at any time afterwards.
+ *
+ * Returns:
+ * a handle to the Augeas tree upon success, and NULL or a handle with an
+ * error, like aug_init, on failure
+ */
+augeas *aug_init_shared(augeas *aug, const char *root, unsigned int flags);
+
 /* Function: aug_defvar
  *
  * Define a variable NAME whose value is the result of evaluating EXPR. If
@@ -295,6 +332,158 @@ int aug_rename(augeas *aug, const char *src, const char *lbl);
  */
 int aug_match(const augeas *aug, const char *path, char ***matches);
 
+/* Function: aug_iter_match
+ *
+ * Start iterating over the nodes matching PATH; the path expression is
+ * evaluated right away, but unlike aug_match, nothing is allocated for the
+ * individual matches. Use aug_iter_next to go through the matches, and
+ * aug_iter_free when done.
+ *
+ * The iterator must be freed before AUG is closed. No nodes must be
+ * removed from the tree while iterating; changing values is fine, and
+ * nodes that are added to the tree are not visited.
+ *
+ * Returns:
+ * the iterator, or NULL on error
+ */
+aug_iter *aug_iter_match(augeas *aug, const char *path);
+
+/* Function: aug_iter_next
+ *
+ * Returns:
+ * the next match of ITER, or NULL if there are no more matches. The node
+ * stays valid as long as it is in the tree
+ */
+aug_node *aug_iter_next(aug_iter *iter);
+
+/* Function: aug_iter_free
+ *
+ * Free ITER
+ */
+void aug_iter_free(aug_iter *iter);
+
+/* Function: aug_node_label
+ *
+ * Returns:
+ * the label of NODE. The string must not be freed by the caller, and is
+ * valid as long as NODE remains unchanged
+ */
+const char *aug_node_label(const aug_node *node);
+
+/* Function: aug_node_value
+ *
+ * Returns:
+ * the value of NODE, which might be NULL. The string must not be freed by
+ * the caller, and is valid as long as NODE remains unchanged
+ */
+const char *aug_node_value(const aug_node *node);
+
+/* Function: aug_node_path
+ *
+ * Returns:
+ * a path that matches exactly NODE, as aug_match would return it, or
+ * NULL if we run out of memory. The caller must free the path
+ */
+char *aug_node_path(const aug_node *node);
+
+/* Function: aug_prepare
+ *
+ * Parse the path expression PATH once, so that it can be used with
+ * aug_stmt_get, aug_stmt_set, aug_stmt_rm and aug_stmt_match many times
+ * without being parsed again. PATH can contain the parameters $1, $2,
+ * ... up to $1024 wherever a string can appear, e.g. in
+ * "/files/etc/hosts//ipaddr[../canonical = $1]"; they must be given a
+ * value with aug_bind before the statement is used. The value of a
+ * parameter is always a string, and is never interpreted as a path
+ * expression.
+ *
+ * PATH is evaluated relative to /augeas/context and against the variables
+ * defined with aug_defvar and aug_defnode at the time the statement is
+ * used, just like the path passed to aug_get.
+ *
+ * The statement must be freed with aug_finalize before AUG is closed.
+ *
+ * Returns:
+ * the statement, or NULL if PATH is not a valid path expression or on
+ * any other error
+ */
+aug_stmt *aug_prepare(augeas *aug, const char *path);
+
+/* Function: aug_bind
+ *
+ * Set the parameter $N of STMT to VALUE. The value is copied, and stays
+ * bound until the next aug_bind of the same parameter.
+ *
+ * Returns:
+ * 0 on success, -1 on error, e.g. when STMT has no parameter $N
+ */
+int aug_bind(aug_stmt *stmt, int n, const char *value);
+
+/* Function: aug_stmt_get
+ *
+ * Like aug_get, for the path of STMT with the values currently bound to
+ * its parameters
+ */
+int aug_stmt_get(aug_stmt *stmt, const char **value);
+
+/* Function: aug_stmt_set
+ *
+ * Like aug_set, for the path of STMT with the values currently bound to
+ * its parameters
+ */
+int aug_stmt_set(aug_stmt *stmt, const char *value);
+
+/* Function: aug_stmt_rm
+ *
+ * Like aug_rm, for the path of STMT with the values currently bound to
+ * its parameters
+ */
+int aug_stmt_rm(aug_stmt *stmt);
+
+/* Function: aug_stmt_match
+ *
+ * Like aug_match, for the path of STMT with the values currently bound to
+ * its parameters
+ */
+int aug_stmt_match(aug_stmt *stmt, char ***matches);
+
+/* Function: aug_finalize
+ *
+ * Free STMT
+ */
+void aug_finalize(aug_stmt *stmt);
+
+/* Operations for aug_batch */
+typedef enum {
+    AUG_OP_SET,         /* aug_set(PATH, VALUE) */
+    AUG_OP_INSERT,      /* aug_insert(PATH, VALUE, BEFORE) */
+    AUG_OP_RM           /* aug_rm(PATH) */
+} aug_op_t;
+
+struct aug_op {
+    aug_op_t     op;
+    const char  *path;
+    const char  *value;    /* The label for AUG_OP_INSERT */
+    int          before;   /* Only used by AUG_OP_INSERT */
+    /* Set by aug_batch */
+    int          result;   /* What the call for OP returned */
+    int          code;     /* The aug_errcode_t of the call for OP */
+};
+
+/* Function: aug_batch
+ *
+ * Perform the NOPS operations in OPS in order, as if each of them was
+ * done with its own call to aug_set, aug_insert or aug_rm, but at the
+ * cost of a single API call. An operation that fails does not stop the
+ * ones after it; the RESULT and CODE of each operation tell how it went.
+ * Afterwards, aug_error and aug_error_details describe the last operation
+ * that failed.
+ *
+ * Returns:
+ * the number of operations that failed, i.e. 0 if all of them succeeded
+ */
+int aug_batch(augeas *aug, struct aug_op *ops, size_t nops);
+
 /* Function: aug_save
  *
  * Write all pending changes to disk.
@@ -311,6 +500,12 @@ int aug_match(const augeas *aug, const char *path, char ***matches);
  * move the original file to a new file with extension ".augsave".
  *
  * If neither of these flags is set, overwrite the original file.
+ *
+ * With AUG_INCREMENTAL_SAVE, or when /augeas/save/incremental is set to
+ * 'enable' before AUG_LOAD, the text of loaded files is kept in memory,
+ * and the parts of a file whose tree has not been modified are copied
+ * from it as they are. This only applies to the first save of a file
+ * after it was loaded, and only if the file has not changed on disk.
  */
 int aug_save(augeas *aug);
 
@@ -339,6 +534,18 @@ int aug_save(augeas *aug);
  * /augeas/files and /files, regardless of whether any entries have been
  * modified or not.
  *
+ * With AUG_PARALLEL_LOAD, files are parsed by as many threads as there
+ * are processors. The number of threads can be changed by setting
+ * /augeas/threads; files are always put into the tree in the same order,
+ * regardless of the number of threads. More threads than processors only
+ * make loading slower.
+ *
+ * With AUG_ENABLE_WATCH, or when /augeas/watch is set to 'enable',
+ * AUG_LOAD uses inotify to watch the directories that files are loaded
+ * from, and only looks at files that changed on disk since the last
+ * AUG_LOAD, as long as /augeas/load, /augeas/files and /files have not
+ * been modified in the meantime.
+ *
  * Returns -1 on error, 0 on success. Note that success includes the case
  * where some files could not be loaded. Details of such files can be found
  * as '/augeas//error'.
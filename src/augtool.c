@@ -293,6 +293,10 @@ static void usage(void) {
     fprintf(stderr, "  -L, --noload         do not load any files into the tree on startup\n");
     fprintf(stderr, "  -A, --noautoload     do not autoload modules from the search path\n");
     fprintf(stderr, "  --span               load span positions for nodes related to a file\n");
+    fprintf(stderr, "  --lazy               only compile modules when they are needed\n");
+    fprintf(stderr, "  --watch              only reload changed files in the load command\n");
+    fprintf(stderr, "  --parallel           parse files with one thread per processor\n");
+    fprintf(stderr, "  --incremental        only put the changed parts of files when saving\n");
     fprintf(stderr, "  --version            print version information and exit.\n");
 
     exit(EXIT_FAILURE);
@@ -303,7 +307,11 @@ static void parse_opts(int argc, char **argv) {
     size_t loadpathlen = 0;
     enum {
         VAL_VERSION = CHAR_MAX + 1,
-        VAL_SPAN = VAL_VERSION + 1
+        VAL_SPAN = VAL_VERSION + 1,
+        VAL_LAZY = VAL_SPAN + 1,
+        VAL_WATCH = VAL_LAZY + 1,
+        VAL_PARALLEL = VAL_WATCH + 1,
+        VAL_INCREMENTAL = VAL_PARALLEL + 1
     };
     struct option options[] = {
         { "help",        0, 0, 'h' },
@@ -321,6 +329,10 @@ static void parse_opts(int argc, char **argv) {
         { "noload",      0, 0, 'L' },
         { "noautoload",  0, 0, 'A' },
         { "span",        0, 0, VAL_SPAN },
+        { "lazy",        0, 0, VAL_LAZY },
+        { "watch",       0, 0, VAL_WATCH },
+        { "parallel",    0, 0, VAL_PARALLEL },
+        { "incremental", 0, 0, VAL_INCREMENTAL },
         { "version",     0, 0, VAL_VERSION },
         { 0, 0, 0, 0}
     };
@@ -377,6 +389,18 @@ static void parse_opts(int argc, char **argv) {
         case VAL_SPAN:
             flags |= AUG_ENABLE_SPAN;
             break;
+        case VAL_LAZY:
+            flags |= AUG_LAZY_MODULES;
+            break;
+        case VAL_WATCH:
+            flags |= AUG_ENABLE_WATCH;
+            break;
+        case VAL_PARALLEL:
+            flags |= AUG_PARALLEL_LOAD;
+            break;
+        case VAL_INCREMENTAL:
+            flags |= AUG_INCREMENTAL_SAVE;
+            break;
         default:
             usage();
             break;
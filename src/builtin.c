@@ -86,13 +86,21 @@ static struct value *lns_counter(struct info *info, struct value *str) {
     return lns_make_prim(L_COUNTER, ref(info), NULL, ref(str->string));
 }
 
+/* Whether lenses built at INFO should be typechecked. Functions from
+ * modules that are shared with other handles can still be called after
+ * the handle whose error INFO reports to has been closed */
+static int type_check(struct info *info) {
+    const struct augeas *aug = info->error->aug;
+    return aug != NULL && (aug->flags & AUG_TYPE_CHECK);
+}
+
 /* V_LENS -> V_LENS -> V_LENS -> V_LENS */
 static struct value *lns_square(struct info *info, struct value *l1,
                                 struct value *l2, struct value *l3) {
     assert(l1->tag == V_LENS);
     assert(l2->tag == V_LENS);
     assert(l3->tag == V_LENS);
-    int check = info->error->aug->flags & AUG_TYPE_CHECK;
+    int check = type_check(info);
 
     return lns_make_square(ref(info), ref(l1->lens), ref(l2->lens), ref(l3->lens), check);
 }
@@ -180,7 +188,7 @@ static struct value *lens_get(struct info *info, struct value *l,
     struct value *v;
     const char *text = str->string->str;
 
-    struct tree *tree = lns_get(info, l->lens, text, &err);
+    struct tree *tree = lns_get(info, l->lens, text, strlen(text), &err);
     if (err == NULL && ! HAS_ERR(info)) {
         v = make_value(V_TREE, ref(info));
         v->origin = make_tree_origin(tree);
@@ -215,7 +223,7 @@ static struct value *lens_put(struct info *info, struct value *l,
 
     init_memstream(&ms);
     lns_put(ms.stream, l->lens, tree->origin->children,
-            str->string->str, &err);
+            str->string->str, strlen(str->string->str), &err);
     close_memstream(&ms);
 
     if (err == NULL && ! HAS_ERR(info)) {
@@ -259,7 +267,7 @@ static struct value *tree_set_glue(struct info *info, struct value *path,
         goto done;
     }
     if (fake != NULL) {
-        list_remove(fake, tree->origin->children);
+        tree_detach(fake);
         free_tree(fake);
     }
     result = ref(tree);
@@ -298,7 +306,7 @@ static struct value *tree_clear_glue(struct info *info, struct value *path,
         goto done;
     }
     if (fake != NULL) {
-        list_remove(fake, tree->origin->children);
+        tree_detach(fake);
         free_tree(fake);
     }
     result = ref(tree);
@@ -460,7 +468,7 @@ static struct value *lns_check_rec_glue(struct info *info,
                                         struct value *l, struct value *r) {
     assert(l->tag == V_LENS);
     assert(r->tag == V_LENS);
-    int check = info->error->aug->flags & AUG_TYPE_CHECK;
+    int check = type_check(info);
 
     return lns_check_rec(info, l->lens, r->lens, check);
 }
@@ -24,6 +24,7 @@
 
 #include "errcode.h"
 #include "memory.h"
+#include "syntax.h"
 #include <stdarg.h>
 
 static void vreport_error(struct error *err, aug_errcode_t errcode,
@@ -80,6 +81,19 @@ void reset_error(struct error *err) {
     err->minor_details = NULL;
 }
 
+void free_error(struct error *err) {
+    if (err == NULL)
+        return;
+    assert(err->ref == 0);
+    if (err->exn != NULL) {
+        err->exn->ref = 0;
+        free_value(err->exn);
+    }
+    unref(err->info, info);
+    free(err->details);
+    free(err);
+}
+
 /*
  * Local variables:
  *  indent-tabs-mode: nil
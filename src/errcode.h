@@ -24,6 +24,7 @@
 #define ERRCODE_H_
 
 #include "internal.h"
+#include "ref.h"
 /* Include augeas.h for the error codes */
 #include "augeas.h"
 
@@ -31,6 +32,7 @@
  * Error details in a separate struct that we can pass around
  */
 struct error {
+    ref_t          ref;
     aug_errcode_t  code;
     int            minor;
     char          *details;       /* Human readable explanation */
@@ -60,6 +62,11 @@ void bug_on(struct error *err, const char *srcfile, int srclineno,
 
 void reset_error(struct error *err);
 
+/* Do not call this directly. Use unref(err, error) instead. Lenses report
+ * errors to the struct error of the handle that compiled them; modules
+ * shared with other handles keep it alive with a reference */
+void free_error(struct error *err);
+
 #define HAS_ERR(obj) ((obj)->error->code != AUG_NOERROR)
 
 #define ERR_BAIL(obj) if ((obj)->error->code != AUG_NOERROR) goto error;
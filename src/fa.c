@@ -4442,6 +4442,323 @@ int fa_expand_nocase(const char *regexp, size_t regexp_len,
     return result;
 }
 
+/*
+ * Table-driven matching
+ *
+ * The DFA is built lazily from the automaton passed to fa_make_dfa with
+ * the subset construction: a state of the DFA is a set of states of the
+ * automaton, and its transitions are only computed when the matcher first
+ * needs them. Full determinization can take exponential time for the
+ * large regexps that lenses generate, whereas matching a text only ever
+ * visits a handful of states. If more than MAX_STATES states are built,
+ * the table is thrown away and built up again from scratch.
+ */
+
+/* A transition of the automaton, on characters in [MIN, MAX] */
+struct dfa_trans {
+    uchar  min;
+    uchar  max;
+    int    to;
+};
+
+/* A set of states of the automaton, sorted by index */
+struct dfa_set {
+    int    dstate;             /* The DFA state for this set */
+    int    n;
+    int    elts[];
+};
+
+#define DFA_UNKNOWN (-2)
+#define DFA_DEAD    (-1)
+
+struct fa_dfa {
+    /* The automaton, with states numbered from 0 */
+    int               nnfa;
+    int              *ntrans;     /* Transitions of state i are TRANS[ */
+    int              *ftrans;     /* FTRANS[i] .. FTRANS[i] + NTRANS[i]) */
+    struct dfa_trans *trans;
+    uchar            *nfa_accept;
+    /* Characters between two consecutive start points behave the same in
+     * every state, and share one column in the table */
+    int               nclasses;
+    uchar             classes[UCHAR_NUM];
+    uchar             reps[UCHAR_NUM];  /* A character from each class */
+    int               nfa_initial;
+    /* The DFA built so far */
+    int               max_states;
+    int               initial;
+    int               nstates;
+    int               sstates;
+    uchar            *accept;
+    int              *table;      /* TABLE[s * NCLASSES + c] */
+    struct dfa_set  **sets;       /* SETS[s] is the set for state s */
+    hash_t           *index;      /* Map from sets to states */
+    /* Scratch space for computing transitions */
+    struct dfa_set   *scratch;
+    int              *mark;
+    int               stamp;
+};
+
+static hash_val_t dfa_set_hash(const void *key) {
+    const struct dfa_set *set = key;
+    hash_val_t hash = set->n;
+
+    for (int i=0; i < set->n; i++)
+        hash = hash * 31 + set->elts[i];
+    return hash;
+}
+
+static int dfa_set_cmp(const void *key1, const void *key2) {
+    const struct dfa_set *set1 = key1;
+    const struct dfa_set *set2 = key2;
+
+    if (set1->n != set2->n)
+        return 1;
+    return memcmp(set1->elts, set2->elts, set1->n * sizeof(int)) != 0;
+}
+
+static void dfa_reset(struct fa_dfa *dfa) {
+    if (dfa->index != NULL) {
+        hash_free_nodes(dfa->index);
+        hash_destroy(dfa->index);
+        dfa->index = NULL;
+    }
+    for (int i=0; i < dfa->nstates; i++)
+        free(dfa->sets[i]);
+    dfa->nstates = 0;
+    dfa->initial = DFA_UNKNOWN;
+}
+
+void fa_dfa_free(struct fa_dfa *dfa) {
+    if (dfa == NULL)
+        return;
+    dfa_reset(dfa);
+    free(dfa->ntrans);
+    free(dfa->ftrans);
+    free(dfa->trans);
+    free(dfa->nfa_accept);
+    free(dfa->accept);
+    free(dfa->table);
+    free(dfa->sets);
+    free(dfa->scratch);
+    free(dfa->mark);
+    free(dfa);
+}
+
+/* Return the DFA state for DFA->SCRATCH, adding one if needed. Return
+ * DFA_DEAD for the empty set, and DFA_UNKNOWN if we run out of memory */
+static int dfa_state(struct fa_dfa *dfa) {
+    struct dfa_set *set = NULL;
+    hnode_t *node;
+    int s;
+
+    if (dfa->scratch->n == 0)
+        return DFA_DEAD;
+
+    if (dfa->index == NULL) {
+        dfa->index = hash_create(HASHCOUNT_T_MAX, dfa_set_cmp, dfa_set_hash);
+        E(dfa->index == NULL);
+    }
+    node = hash_lookup(dfa->index, dfa->scratch);
+    if (node != NULL)
+        return ((struct dfa_set *) hnode_getkey(node))->dstate;
+
+    if (dfa->nstates == dfa->sstates) {
+        int size = 2 * dfa->sstates;
+        F(REALLOC_N(dfa->accept, size));
+        F(REALLOC_N(dfa->sets, size));
+        F(REALLOC_N(dfa->table, size * dfa->nclasses));
+        dfa->sstates = size;
+    }
+
+    s = dfa->nstates;
+    set = malloc(sizeof(*set) + dfa->scratch->n * sizeof(int));
+    E(set == NULL);
+    set->dstate = s;
+    set->n = dfa->scratch->n;
+    memcpy(set->elts, dfa->scratch->elts, set->n * sizeof(int));
+    if (hash_alloc_insert(dfa->index, set, NULL) < 0) {
+        free(set);
+        goto error;
+    }
+    dfa->sets[s] = set;
+
+    dfa->accept[s] = 0;
+    for (int i=0; i < set->n; i++)
+        if (dfa->nfa_accept[set->elts[i]])
+            dfa->accept[s] = 1;
+    for (int c=0; c < dfa->nclasses; c++)
+        dfa->table[s * dfa->nclasses + c] = DFA_UNKNOWN;
+    dfa->nstates += 1;
+    return s;
+ error:
+    return DFA_UNKNOWN;
+}
+
+static int int_cmp(const void *v1, const void *v2) {
+    return *(const int *) v1 - *(const int *) v2;
+}
+
+/* Compute the transition from S on class C. Return the target, which is
+ * DFA_UNKNOWN if we run out of memory. The state S is renumbered if the
+ * table needs to be flushed; *S is updated accordingly */
+static int dfa_step(struct fa_dfa *dfa, int *s, int c) {
+    struct dfa_set *from = dfa->sets[*s];
+    struct dfa_set *to = dfa->scratch;
+    uchar ch = dfa->reps[c];
+    int result;
+
+    if (dfa->nstates >= dfa->max_states) {
+        /* Start over, keeping only the state we are in */
+        dfa->sets[*s] = NULL;
+        dfa_reset(dfa);
+        memcpy(to->elts, from->elts, from->n * sizeof(int));
+        to->n = from->n;
+        free(from);
+        *s = dfa_state(dfa);
+        if (*s < 0)
+            return DFA_UNKNOWN;
+        from = dfa->sets[*s];
+    }
+
+    dfa->stamp += 1;
+    to->n = 0;
+    for (int i=0; i < from->n; i++) {
+        int q = from->elts[i];
+        struct dfa_trans *t = dfa->trans + dfa->ftrans[q];
+        for (int j=0; j < dfa->ntrans[q]; j++) {
+            if (t[j].min <= ch && ch <= t[j].max
+                && dfa->mark[t[j].to] != dfa->stamp) {
+                dfa->mark[t[j].to] = dfa->stamp;
+                to->elts[to->n++] = t[j].to;
+            }
+        }
+    }
+    qsort(to->elts, to->n, sizeof(int), int_cmp);
+    result = dfa_state(dfa);
+    if (result != DFA_UNKNOWN)
+        dfa->table[*s * dfa->nclasses + c] = result;
+    return result;
+}
+
+struct fa_dfa *fa_make_dfa(struct fa *fa, int max_states) {
+    struct fa_dfa *dfa = NULL;
+    struct state_set *states = NULL;
+    uchar *points = NULL;
+    int npoints, ntrans = 0;
+
+    F(ALLOC(dfa));
+
+    states = state_set_init(-1, S_SORTED);
+    E(states == NULL);
+    list_for_each(s, fa->initial) {
+        F(state_set_push(states, s));
+        ntrans += s->tused;
+    }
+    dfa->nnfa = states->used;
+    dfa->nfa_initial = state_set_index(states, fa->initial);
+    dfa->max_states = max_states > 0 ? max_states : INT_MAX;
+    dfa->initial = DFA_UNKNOWN;
+
+    F(ALLOC_N(dfa->ntrans, dfa->nnfa));
+    F(ALLOC_N(dfa->ftrans, dfa->nnfa));
+    F(ALLOC_N(dfa->trans, ntrans));
+    F(ALLOC_N(dfa->nfa_accept, dfa->nnfa));
+    ntrans = 0;
+    for (int i=0; i < dfa->nnfa; i++) {
+        struct state *s = states->states[i];
+        dfa->nfa_accept[i] = s->accept;
+        dfa->ftrans[i] = ntrans;
+        dfa->ntrans[i] = s->tused;
+        for_each_trans(t, s) {
+            dfa->trans[ntrans].min = t->min;
+            dfa->trans[ntrans].max = t->max;
+            dfa->trans[ntrans].to = state_set_index(states, t->to);
+            ntrans += 1;
+        }
+    }
+
+    points = start_points(fa, &npoints);
+    E(points == NULL);
+    dfa->nclasses = npoints;
+    for (int c = 0, k = 0; c < UCHAR_NUM; c++) {
+        if (k + 1 < npoints && c == points[k + 1])
+            k += 1;
+        dfa->classes[c] = k;
+        dfa->reps[k] = points[k];
+    }
+    /* Case-insensitive automata only have transitions on lower case
+     * letters */
+    if (fa->nocase) {
+        for (int c = 'A'; c <= 'Z'; c++)
+            dfa->classes[c] = dfa->classes[tolower(c)];
+    }
+
+    dfa->sstates = 8;
+    F(ALLOC_N(dfa->accept, dfa->sstates));
+    F(ALLOC_N(dfa->sets, dfa->sstates));
+    F(ALLOC_N(dfa->table, dfa->sstates * dfa->nclasses));
+    dfa->scratch = malloc(sizeof(*dfa->scratch) + dfa->nnfa * sizeof(int));
+    E(dfa->scratch == NULL);
+    F(ALLOC_N(dfa->mark, dfa->nnfa));
+
+    free(points);
+    state_set_free(states);
+    return dfa;
+ error:
+    free(points);
+    state_set_free(states);
+    fa_dfa_free(dfa);
+    return NULL;
+}
+
+/* Return the DFA state for the initial state of the automaton */
+static int dfa_initial(struct fa_dfa *dfa) {
+    if (dfa->initial == DFA_UNKNOWN) {
+        dfa->scratch->elts[0] = dfa->nfa_initial;
+        dfa->scratch->n = 1;
+        dfa->initial = dfa_state(dfa);
+    }
+    return dfa->initial;
+}
+
+int fa_dfa_match(struct fa_dfa *dfa, const char *text, size_t len) {
+    return fa_dfa_prefixes(dfa, text, len, NULL);
+}
+
+int fa_dfa_prefixes(struct fa_dfa *dfa, const char *text, size_t len,
+                    char *ends) {
+    int s = dfa_initial(dfa);
+    int result;
+
+    if (s == DFA_UNKNOWN)
+        return -2;
+    result = dfa->accept[s] ? 0 : -1;
+
+    if (ends != NULL) {
+        memset(ends, 0, len + 1);
+        ends[0] = (result == 0);
+    }
+    for (size_t i=0; i < len; i++) {
+        int c = dfa->classes[(uchar) text[i]];
+        int next = dfa->table[s * dfa->nclasses + c];
+        if (next == DFA_UNKNOWN) {
+            next = dfa_step(dfa, &s, c);
+            if (next == DFA_UNKNOWN)
+                return -2;
+        }
+        if (next == DFA_DEAD)
+            break;
+        s = next;
+        if (dfa->accept[s]) {
+            result = i + 1;
+            if (ends != NULL)
+                ends[i + 1] = 1;
+        }
+    }
+    return result;
+}
+
 static void print_char(FILE *out, uchar c) {
     /* We escape '/' as '\\/' since dot chokes on bare slashes in labels;
        Also, a space ' ' is shown as '\s' */
@@ -267,6 +267,34 @@ int fa_expand_nocase(const char *regexp, size_t regexp_len,
  */
 int fa_enumerate(struct fa *fa, int limit, char ***words);
 
+/* A table-driven matcher built from an automaton */
+struct fa_dfa;
+
+/* Build a matcher for FA. FA is not modified, and can be freed once the
+ * matcher has been built. The states of the matcher's deterministic
+ * automaton are only computed as they are needed during matching, and
+ * at most MAX_STATES of them are kept; a MAX_STATES of 0 means there is
+ * no limit. Matching takes time linear in the length of its input.
+ *
+ * Return NULL if we run out of memory.
+ */
+struct fa_dfa *fa_make_dfa(struct fa *fa, int max_states);
+
+/* Return the length of the longest prefix of the LEN characters at TEXT
+ * that is in the language of DFA, -1 if there is no such prefix, and -2
+ * if we run out of memory.
+ */
+int fa_dfa_match(struct fa_dfa *dfa, const char *text, size_t len);
+
+/* Like FA_DFA_MATCH, but also set ENDS[k] to 1 for every k such that the
+ * first k characters at TEXT are in the language of DFA, and to 0
+ * otherwise. ENDS must have room for LEN + 1 entries.
+ */
+int fa_dfa_prefixes(struct fa_dfa *dfa, const char *text, size_t len,
+                    char *ends);
+
+void fa_dfa_free(struct fa_dfa *dfa);
+
 #endif
 
 
@@ -24,6 +24,9 @@
 
 #include <regex.h>
 #include <stdarg.h>
+#if HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
 
 #include "regexp.h"
 #include "list.h"
@@ -32,6 +35,18 @@
 #include "info.h"
 #include "lens.h"
 #include "errcode.h"
+#include "arena.h"
+
+/* Files can be parsed in several threads at once (see transform_load);
+ * this protects the parts of lenses that parsing changes */
+#if HAVE_PTHREAD_H
+static pthread_mutex_t lens_lock = PTHREAD_MUTEX_INITIALIZER;
+# define LOCK_LENSES()   pthread_mutex_lock(&lens_lock)
+# define UNLOCK_LENSES() pthread_mutex_unlock(&lens_lock)
+#else
+# define LOCK_LENSES()
+# define UNLOCK_LENSES()
+#endif
 
 /* Our favorite error message */
 static const char *const short_iteration =
@@ -47,9 +62,14 @@ struct state {
     struct info      *info;
     struct span      *span;
     const char       *text;
+    uint              size;      /* Length of TEXT */
     struct seq       *seqs;
     char             *key;
     char             *value;     /* GET_STORE leaves a value here */
+    /* When getting a tree, its nodes, keys and values are allocated from
+     * ARENA. When we only make a skeleton and dictionary for lns_parse,
+     * ARENA is NULL, no tree is made and keys are allocated with malloc */
+    struct arena     *arena;
     struct lns_error *error;
     /* We use the registers from a regular expression match to keep track
      * of the substring we are currently looking at. REGS are the registers
@@ -73,20 +93,15 @@ struct frame {
     struct lens     *lens;
     char            *key;
     struct span     *span;
-    union {
-        struct { /* MGET */
-            char        *value;
-            struct tree *tree;
-        };
-        struct { /* M_PARSE */
-            struct skel *skel;
-            struct dict *dict;
-        };
-    };
+    char            *value;       /* M_GET */
+    struct tree     *tree;        /* M_GET */
+    struct skel     *skel;        /* M_PARSE */
+    struct dict     *dict;        /* M_PARSE */
 };
 
-/* Used by recursive lenses in get_rec and parse_rec */
-enum mode_t { M_GET, M_PARSE };
+/* What get_rec makes for recursive lenses: the tree (M_GET), the skeleton
+ * and dictionary (M_PARSE), or both at once */
+enum mode_t { M_GET = 1, M_PARSE = 2 };
 
 /* Abstract Syntax Tree for recursive parse */
 struct ast {
@@ -338,13 +353,14 @@ static void get_expected_error(struct state *state, struct lens *l) {
     /* Size of the excerpt of the input text we'll show */
     static const int wordlen = 10;
     char word[wordlen+1];
+    uint start = REG_MATCHED(state) ? REG_START(state) : 0;
+    uint len = state->size - start;
     char *p, *pat;
 
-    if (REG_MATCHED(state))
-        strncpy(word, REG_POS(state), wordlen);
-    else
-        strncpy(word, state->text, wordlen);
-    word[wordlen] = '\0';
+    if (len > wordlen)
+        len = wordlen;
+    memcpy(word, state->text + start, len);
+    word[len] = '\0';
     for (p = word; *p != '\0' && *p != '\n'; p++);
     *p = '\0';
 
@@ -359,9 +375,18 @@ static void get_expected_error(struct state *state, struct lens *l) {
 
 static char *token(struct state *state) {
     ensure0(REG_MATCHED(state), state->info);
+    if (state->arena != NULL)
+        return arena_strndup(state->arena, REG_POS(state), REG_SIZE(state));
     return strndup(REG_POS(state), REG_SIZE(state));
 }
 
+/* Copy S for use as a key or value */
+static char *copy_string(struct state *state, const char *s) {
+    if (state->arena != NULL)
+        return arena_strndup(state->arena, s, strlen(s));
+    return strdup(s);
+}
+
 static char *token_range(const char *text, uint start, uint end) {
     return strndup(text + start, end - start);
 }
@@ -406,6 +431,76 @@ static void no_match_error(struct state *state, struct lens *lens) {
     return;
 }
 
+/* Fill in REGS for the text from START to END, which is matched by
+ * LENS->CTYPE, starting at register NREG. The groups in the ctype of a
+ * lens follow the structure of the lens, which lets us find the
+ * boundaries of the children of a concat or union with the DFAs of their
+ * ctypes instead of backtracking through the ctype of the whole lens.
+ *
+ * Only the registers that get_lens looks at are filled in;
+ * stars, squares and recursive lenses match their children again anyway.
+ *
+ * Return 0 on success, and -1 if the registers need to be computed with
+ * regexp_match
+ */
+static int split_regs(struct state *state, struct lens *lens,
+                      struct re_registers *regs, uint nreg,
+                      uint start, uint end) {
+    struct regexp **types = NULL;
+    int *split = NULL;
+    int r = -1;
+
+    if (lens->recursive || nreg >= regs->num_regs)
+        return -1;
+
+    regs->start[nreg] = start;
+    regs->end[nreg] = end;
+
+    switch(lens->tag) {
+    case L_CONCAT:
+        if (ALLOC_N(types, lens->nchildren) < 0
+            || ALLOC_N(split, lens->nchildren + 1) < 0)
+            goto done;
+        for (int i=0; i < lens->nchildren; i++)
+            types[i] = lens->children[i]->ctype;
+        if (regexp_split(lens->nchildren, types, state->text,
+                         start, end, split) < 0)
+            goto done;
+        nreg += 1;
+        for (int i=0; i < lens->nchildren; i++) {
+            if (split_regs(state, lens->children[i], regs, nreg,
+                           split[i], split[i+1]) < 0)
+                goto done;
+            nreg += 1 + regexp_nsub(lens->children[i]->ctype);
+        }
+        break;
+    case L_UNION:
+        nreg += 1;
+        for (int i=0; i < lens->nchildren; i++) {
+            struct regexp *ctype = lens->children[i]->ctype;
+            int count = regexp_match(ctype, state->text, end, start, NULL);
+            if (count == end - start)
+                return split_regs(state, lens->children[i], regs, nreg,
+                                  start, end);
+            nreg += 1 + regexp_nsub(ctype);
+        }
+        goto done;
+    case L_SUBTREE:
+        return split_regs(state, lens->child, regs, nreg, start, end);
+    case L_MAYBE:
+        if (start < end || regexp_matches_empty(lens->child->ctype))
+            return split_regs(state, lens->child, regs, nreg + 1, start, end);
+        break;
+    default:
+        break;
+    }
+    r = 0;
+ done:
+    free(types);
+    free(split);
+    return r;
+}
+
 /* Modifies STATE->REGS and STATE->NREG. The caller must save these
  * if they are still needed
  *
@@ -419,15 +514,41 @@ static int match(struct state *state, struct lens *lens,
     if (ALLOC(regs) < 0)
         return -1;
 
+    if (re == lens->ctype && ! lens->recursive) {
+        count = regexp_match(re, state->text, size, start, NULL);
+        if (count < 0)
+            goto done;
+
+        int nregs = 1 + regexp_nsub(re);
+        if (ALLOC_N(regs->start, nregs) < 0
+            || ALLOC_N(regs->end, nregs) < 0)
+            goto nomem;
+        regs->num_regs = nregs;
+        for (int i=0; i < nregs; i++)
+            regs->start[i] = regs->end[i] = -1;
+        if (split_regs(state, lens, regs, 0, start, start + count) == 0)
+            goto done;
+        FREE(regs->start);
+        FREE(regs->end);
+        regs->num_regs = 0;
+    }
     count = regexp_match(re, state->text, size, start, regs);
+ done:
     if (count < -1) {
         regexp_match_error(state, lens, count, re);
+        free(regs->start);
+        free(regs->end);
         FREE(regs);
         return -1;
     }
     state->regs = regs;
     state->nreg = 0;
     return count;
+ nomem:
+    free(regs->start);
+    free(regs->end);
+    FREE(regs);
+    return -1;
 }
 
 static void free_regs(struct state *state) {
@@ -438,9 +559,29 @@ static void free_regs(struct state *state) {
     }
 }
 
-static struct tree *get_lens(struct lens *lens, struct state *state);
-static struct skel *parse_lens(struct lens *lens, struct state *state,
-                               struct dict **dict);
+static struct tree *get_lens(struct lens *lens, struct state *state,
+                             struct skel **skel, struct dict **dict);
+
+/* The get_* functions also make the skeleton and dictionary for the text
+ * they process if SKEL is not NULL. DICT must then not be NULL either, and
+ * *DICT must be NULL when they are called */
+static void get_skel(struct lens *lens, struct state *state,
+                     struct skel **skel) {
+    if (skel != NULL) {
+        *skel = make_skel(lens);
+        ERR_NOMEM(*skel == NULL, state->info);
+    }
+ error:
+    return;
+}
+
+/* Return the key for a dict entry made for the subtree with key KEY. The
+ * dict owns its keys, which therefore can't be in the arena */
+static char *dict_key(struct state *state, char *key) {
+    if (state->arena == NULL || key == NULL)
+        return key;
+    return strdup(key);
+}
 
 static void free_seqs(struct seq *seqs) {
     /* Do not free seq->name; it's not owned by the seq, but by some lens */
@@ -465,37 +606,33 @@ static struct seq *find_seq(const char *name, struct state *state) {
     return seq;
 }
 
-static struct tree *get_seq(struct lens *lens, struct state *state) {
+static struct tree *get_seq(struct lens *lens, struct state *state,
+                            struct skel **skel) {
     ensure0(lens->tag == L_SEQ, state->info);
     struct seq *seq = find_seq(lens->string->str, state);
-    int r;
+    char buf[3 * sizeof(int) + 2];
 
-    r = asprintf((char **) &(state->key), "%d", seq->value);
-    ERR_NOMEM(r < 0, state->info);
+    snprintf(buf, sizeof(buf), "%d", seq->value);
+    state->key = copy_string(state, buf);
+    ERR_NOMEM(state->key == NULL, state->info);
 
     seq->value += 1;
+    get_skel(lens, state, skel);
  error:
     return NULL;
 }
 
-static struct skel *parse_seq(struct lens *lens, struct state *state) {
-    get_seq(lens, state);
-    return make_skel(lens);
-}
-
-static struct tree *get_counter(struct lens *lens, struct state *state) {
+static struct tree *get_counter(struct lens *lens, struct state *state,
+                                struct skel **skel) {
     ensure0(lens->tag == L_COUNTER, state->info);
     struct seq *seq = find_seq(lens->string->str, state);
     seq->value = 1;
+    get_skel(lens, state, skel);
     return NULL;
 }
 
-static struct skel *parse_counter(struct lens *lens, struct state *state) {
-    get_counter(lens, state);
-    return make_skel(lens);
-}
-
-static struct tree *get_del(struct lens *lens, struct state *state) {
+static struct tree *get_del(struct lens *lens, struct state *state,
+                            struct skel **skel) {
     ensure0(lens->tag == L_DEL, state->info);
     if (! REG_MATCHED(state)) {
         char *pat = regexp_escape(lens->ctype);
@@ -503,22 +640,18 @@ static struct tree *get_del(struct lens *lens, struct state *state) {
         free(pat);
     }
     update_span(state->span, REG_START(state), REG_END(state));
+    get_skel(lens, state, skel);
+    if (skel != NULL && *skel != NULL && REG_MATCHED(state)) {
+        /* Not from the arena, since the skel owns its text */
+        (*skel)->text = strndup(REG_POS(state), REG_SIZE(state));
+        ERR_NOMEM((*skel)->text == NULL, state->info);
+    }
+ error:
     return NULL;
 }
 
-static struct skel *parse_del(struct lens *lens, struct state *state) {
-    ensure0(lens->tag == L_DEL, state->info);
-    struct skel *skel = NULL;
-
-    skel = make_skel(lens);
-    if (! REG_MATCHED(state))
-        no_match_error(state, lens);
-    else
-        skel->text = token(state);
-    return skel;
-}
-
-static struct tree *get_store(struct lens *lens, struct state *state) {
+static struct tree *get_store(struct lens *lens, struct state *state,
+                              struct skel **skel) {
     ensure0(lens->tag == L_STORE, state->info);
     ensure0(state->value == NULL, state->info);
 
@@ -528,7 +661,8 @@ static struct tree *get_store(struct lens *lens, struct state *state) {
         get_error(state, lens, "More than one store in a subtree");
     else if (! REG_MATCHED(state))
         no_match_error(state, lens);
-    else {
+    else if (state->arena != NULL) {
+        /* Without a tree, there is nothing to store the value in */
         state->value = token(state);
         if (state->span) {
             state->span->value_start = REG_START(state);
@@ -536,28 +670,21 @@ static struct tree *get_store(struct lens *lens, struct state *state) {
             update_span(state->span, REG_START(state), REG_END(state));
         }
     }
+    get_skel(lens, state, skel);
     return tree;
 }
 
-static struct skel *parse_store(struct lens *lens,
-                                ATTRIBUTE_UNUSED struct state *state) {
-    ensure0(lens->tag == L_STORE, state->info);
-    return make_skel(lens);
-}
-
-static struct tree *get_value(struct lens *lens, struct state *state) {
+static struct tree *get_value(struct lens *lens, struct state *state,
+                              struct skel **skel) {
     ensure0(lens->tag == L_VALUE, state->info);
-    state->value = strdup(lens->string->str);
+    if (state->arena != NULL)
+        state->value = copy_string(state, lens->string->str);
+    get_skel(lens, state, skel);
     return NULL;
 }
 
-static struct skel *parse_value(struct lens *lens,
-                                ATTRIBUTE_UNUSED struct state *state) {
-    ensure0(lens->tag == L_VALUE, state->info);
-    return make_skel(lens);
-}
-
-static struct tree *get_key(struct lens *lens, struct state *state) {
+static struct tree *get_key(struct lens *lens, struct state *state,
+                            struct skel **skel) {
     ensure0(lens->tag == L_KEY, state->info);
     if (! REG_MATCHED(state))
         no_match_error(state, lens);
@@ -569,26 +696,20 @@ static struct tree *get_key(struct lens *lens, struct state *state) {
             update_span(state->span, REG_START(state), REG_END(state));
         }
     }
+    get_skel(lens, state, skel);
     return NULL;
 }
 
-static struct skel *parse_key(struct lens *lens, struct state *state) {
-    get_key(lens, state);
-    return make_skel(lens);
-}
-
-static struct tree *get_label(struct lens *lens, struct state *state) {
+static struct tree *get_label(struct lens *lens, struct state *state,
+                              struct skel **skel) {
     ensure0(lens->tag == L_LABEL, state->info);
-    state->key = strdup(lens->string->str);
+    state->key = copy_string(state, lens->string->str);
+    get_skel(lens, state, skel);
     return NULL;
 }
 
-static struct skel *parse_label(struct lens *lens, struct state *state) {
-    get_label(lens, state);
-    return make_skel(lens);
-}
-
-static struct tree *get_union(struct lens *lens, struct state *state) {
+static struct tree *get_union(struct lens *lens, struct state *state,
+                              struct skel **skel, struct dict **dict) {
     ensure0(lens->tag == L_UNION, state->info);
 
     struct tree *tree = NULL;
@@ -598,7 +719,7 @@ static struct tree *get_union(struct lens *lens, struct state *state) {
     state->nreg += 1;
     for (int i=0; i < lens->nchildren; i++) {
         if (REG_MATCHED(state)) {
-            tree = get_lens(lens->children[i], state);
+            tree = get_lens(lens->children[i], state, skel, dict);
             applied = 1;
             break;
         }
@@ -610,40 +731,19 @@ static struct tree *get_union(struct lens *lens, struct state *state) {
     return tree;
 }
 
-static struct skel *parse_union(struct lens *lens, struct state *state,
-                                struct dict **dict) {
-    ensure0(lens->tag == L_UNION, state->info);
-
-    struct skel *skel = NULL;
-    int applied = 0;
-    uint old_nreg = state->nreg;
-
-    state->nreg += 1;
-    for (int i=0; i < lens->nchildren; i++) {
-        struct lens *l = lens->children[i];
-        if (REG_MATCHED(state)) {
-            skel = parse_lens(l, state, dict);
-            applied = 1;
-            break;
-        }
-        state->nreg += 1 + regexp_nsub(lens->children[i]->ctype);
-    }
-    state->nreg = old_nreg;
-    if (! applied)
-        get_expected_error(state, lens);
-
-    return skel;
-}
-
-static struct tree *get_concat(struct lens *lens, struct state *state) {
+static struct tree *get_concat(struct lens *lens, struct state *state,
+                               struct skel **skel, struct dict **dict) {
     ensure0(lens->tag == L_CONCAT, state->info);
 
     struct tree *tree = NULL;
     uint old_nreg = state->nreg;
 
+    get_skel(lens, state, skel);
     state->nreg += 1;
     for (int i=0; i < lens->nchildren; i++) {
         struct tree *t = NULL;
+        struct skel *sk = NULL;
+        struct dict *di = NULL;
         if (! REG_VALID(state)) {
             get_error(state, lens->children[i],
                       "Not enough components in concat");
@@ -652,7 +752,14 @@ static struct tree *get_concat(struct lens *lens, struct state *state) {
             return NULL;
         }
 
-        t = get_lens(lens->children[i], state);
+        if (skel == NULL) {
+            t = get_lens(lens->children[i], state, NULL, NULL);
+        } else {
+            t = get_lens(lens->children[i], state, &sk, &di);
+            if (*skel != NULL)
+                list_append((*skel)->skels, sk);
+            dict_append(dict, di);
+        }
         list_append(tree, t);
         state->nreg += 1 + regexp_nsub(lens->children[i]->ctype);
     }
@@ -661,48 +768,34 @@ static struct tree *get_concat(struct lens *lens, struct state *state) {
     return tree;
 }
 
-static struct skel *parse_concat(struct lens *lens, struct state *state,
-                                 struct dict **dict) {
-    ensure0(lens->tag == L_CONCAT, state->info);
-    struct skel *skel = make_skel(lens);
-    uint old_nreg = state->nreg;
-
-    state->nreg += 1;
-    for (int i=0; i < lens->nchildren; i++) {
-        struct skel *sk = NULL;
-        struct dict *di = NULL;
-        if (! REG_VALID(state)) {
-            get_error(state, lens->children[i],
-                      "Not enough components in concat");
-            free_skel(skel);
-            return NULL;
-        }
-
-        sk = parse_lens(lens->children[i], state, &di);
-        list_append(skel->skels, sk);
-        dict_append(dict, di);
-        state->nreg += 1 + regexp_nsub(lens->children[i]->ctype);
-    }
-    state->nreg = old_nreg;
-
-    return skel;
-}
-
-static struct tree *get_quant_star(struct lens *lens, struct state *state) {
+static struct tree *get_quant_star(struct lens *lens, struct state *state,
+                                   struct skel **skel, struct dict **dict) {
     ensure0(lens->tag == L_STAR, state->info);
     struct lens *child = lens->child;
     struct tree *tree = NULL, *tail = NULL;
+    struct skel *stail = NULL;
     struct re_registers *old_regs = state->regs;
     uint old_nreg = state->nreg;
     uint end = REG_END(state);
     uint start = REG_START(state);
     uint size = end - start;
 
+    get_skel(lens, state, skel);
     state->regs = NULL;
     while (size > 0 && match(state, child, child->ctype, end, start) > 0) {
         struct tree *t = NULL;
 
-        t = get_lens(lens->child, state);
+        if (skel == NULL) {
+            t = get_lens(lens->child, state, NULL, NULL);
+        } else {
+            struct skel *sk = NULL;
+            struct dict *di = NULL;
+
+            t = get_lens(lens->child, state, &sk, &di);
+            if (*skel != NULL)
+                list_tail_cons((*skel)->skels, stail, sk);
+            dict_append(dict, di);
+        }
         list_tail_cons(tree, tail, t);
 
         start += REG_SIZE(state);
@@ -719,41 +812,8 @@ static struct tree *get_quant_star(struct lens *lens, struct state *state) {
     return tree;
 }
 
-static struct skel *parse_quant_star(struct lens *lens, struct state *state,
-                                     struct dict **dict) {
-    ensure0(lens->tag == L_STAR, state->info);
-    struct lens *child = lens->child;
-    struct skel *skel = make_skel(lens), *tail = NULL;
-    struct re_registers *old_regs = state->regs;
-    uint old_nreg = state->nreg;
-    uint end = REG_END(state);
-    uint start = REG_START(state);
-    uint size = end - start;
-
-    *dict = NULL;
-    state->regs = NULL;
-    while (size > 0 && match(state, child, child->ctype, end, start) > 0) {
-        struct skel *sk;
-        struct dict *di = NULL;
-
-        sk = parse_lens(lens->child, state, &di);
-        list_tail_cons(skel->skels, tail, sk);
-        dict_append(dict, di);
-
-        start += REG_SIZE(state);
-        size -= REG_SIZE(state);
-        free_regs(state);
-    }
-    free_regs(state);
-    state->regs = old_regs;
-    state->nreg = old_nreg;
-    if (size != 0) {
-        get_error(state, lens, "%s", short_iteration);
-    }
-    return skel;
-}
-
-static struct tree *get_quant_maybe(struct lens *lens, struct state *state) {
+static struct tree *get_quant_maybe(struct lens *lens, struct state *state,
+                                    struct skel **skel, struct dict **dict) {
     ensure0(lens->tag == L_MAYBE, state->info);
     struct tree *tree = NULL;
 
@@ -763,34 +823,24 @@ static struct tree *get_quant_maybe(struct lens *lens, struct state *state) {
      */
     state->nreg += 1;
     if (REG_MATCHED(state)) {
-        tree = get_lens(lens->child, state);
+        tree = get_lens(lens->child, state, skel, dict);
+    } else {
+        get_skel(lens, state, skel);
     }
     state->nreg -= 1;
     return tree;
 }
 
-static struct skel *parse_quant_maybe(struct lens *lens, struct state *state,
-                                      struct dict **dict) {
-    ensure0(lens->tag == L_MAYBE, state->info);
-
-    struct skel *skel = NULL;
-
-    state->nreg += 1;
-    if (REG_MATCHED(state)) {
-        skel = parse_lens(lens->child, state, dict);
-    }
-    state->nreg -= 1;
-    if (skel == NULL)
-        skel = make_skel(lens);
-    return skel;
-}
-
-static struct tree *get_subtree(struct lens *lens, struct state *state) {
+static struct tree *get_subtree(struct lens *lens, struct state *state,
+                                struct skel **skel, struct dict **dict) {
     char *key = state->key;
     char *value = state->value;
     struct span *span = state->span;
 
     struct tree *tree = NULL, *children;
+    struct skel *sk = NULL;
+    struct dict *di = NULL;
+    struct skel_origin origin = { .lens = lens };
 
     state->key = NULL;
     state->value = NULL;
@@ -799,11 +849,32 @@ static struct tree *get_subtree(struct lens *lens, struct state *state) {
         ERR_NOMEM(state->span == NULL, state->info);
     }
 
-    children = get_lens(lens->child, state);
+    if (skel == NULL) {
+        children = get_lens(lens->child, state, NULL, NULL);
+    } else {
+        origin.start = REG_START(state);
+        origin.end = REG_END(state);
+        children = get_lens(lens->child, state, &sk, &di);
+    }
+
+    if (state->arena != NULL) {
+        tree = make_tree_arena(state->arena, state->key, state->value,
+                               children);
+        ERR_NOMEM(tree == NULL, state->info);
+        tree->span = state->span;
+    }
+
+    if (skel != NULL) {
+        char *k = dict_key(state, state->key);
 
-    tree = make_tree(state->key, state->value, NULL, children);
-    ERR_NOMEM(tree == NULL, state->info);
-    tree->span = state->span;
+        ERR_NOMEM(k == NULL && state->key != NULL, state->info);
+        origin.tree = tree;
+        *dict = make_dict(k, sk, di, &origin);
+        sk = NULL;
+        di = NULL;
+        ERR_NOMEM(*dict == NULL, state->info);
+        get_skel(lens, state, skel);
+    }
 
     if (state->span != NULL) {
         update_span(span, state->span->span_start, state->span->span_end);
@@ -817,19 +888,6 @@ static struct tree *get_subtree(struct lens *lens, struct state *state) {
     return NULL;
 }
 
-static struct skel *parse_subtree(struct lens *lens, struct state *state,
-                                  struct dict **dict) {
-    char *key = state->key;
-    struct skel *skel;
-    struct dict *di = NULL;
-
-    state->key = NULL;
-    skel = parse_lens(lens->child, state, &di);
-    *dict = make_dict(state->key, skel, di);
-    state->key = key;
-    return make_skel(lens);
-}
-
 /* Check if left and right strings matches according to the square lens
  * definition.
  *
@@ -858,7 +916,8 @@ static int square_match(struct lens *lens, char *left, char *right) {
  * This function applies only for non-recursive lens, handling of recursive
  * square is done in visit_exit().
  */
-static struct tree *get_square(struct lens *lens, struct state *state) {
+static struct tree *get_square(struct lens *lens, struct state *state,
+                               struct skel **skel, struct dict **dict) {
     ensure0(lens->tag == L_SQUARE, state->info);
 
     struct lens *concat = lens->child;
@@ -873,7 +932,18 @@ static struct tree *get_square(struct lens *lens, struct state *state) {
     r = match(state, lens->child, lens->child->ctype, end, start);
     ERR_NOMEM(r < 0, state->info);
 
-    tree = get_lens(lens->child, state);
+    if (skel == NULL) {
+        tree = get_lens(lens->child, state, NULL, NULL);
+    } else {
+        struct skel *sk = NULL;
+
+        tree = get_lens(lens->child, state, &sk, dict);
+        get_skel(lens, state, skel);
+        if (*skel != NULL)
+            (*skel)->skels = sk;
+        else
+            free_skel(sk);
+    }
 
     /* retrieve left component */
     state->nreg = 1;
@@ -911,32 +981,6 @@ static struct tree *get_square(struct lens *lens, struct state *state) {
     goto done;
 }
 
-static struct skel *parse_square(struct lens *lens, struct state *state,
-                                 struct dict **dict) {
-    ensure0(lens->tag == L_SQUARE, state->info);
-    struct re_registers *old_regs = state->regs;
-    uint old_nreg = state->nreg;
-    uint end = REG_END(state);
-    uint start = REG_START(state);
-    struct skel *skel = NULL, *sk = NULL;
-    int r;
-
-    r = match(state, lens->child, lens->child->ctype, end, start);
-    ERR_NOMEM(r < 0, state->info);
-
-    skel = parse_lens(lens->child, state, dict);
-    if (skel == NULL)
-        return NULL;
-    sk = make_skel(lens);
-    sk->skels = skel;
-
- error:
-    free_regs(state);
-    state->regs = old_regs;
-    state->nreg = old_nreg;
-    return sk;
-}
-
 /*
  * Helpers for recursive lenses
  */
@@ -1012,23 +1056,20 @@ static void dbg_visit(struct lens *lens, char action, size_t start, size_t end,
     free(lns);
 }
 
-static void get_terminal(struct frame *top, struct lens *lens,
-                         struct state *state) {
-    top->tree = get_lens(lens, state);
+static void get_terminal(struct rec_state *rec_state, struct frame *top,
+                         struct lens *lens) {
+    struct state *state = rec_state->state;
+
+    if (rec_state->mode & M_PARSE)
+        top->tree = get_lens(lens, state, &top->skel, &top->dict);
+    else
+        top->tree = get_lens(lens, state, NULL, NULL);
     top->key = state->key;
     top->value = state->value;
     state->key = NULL;
     state->value = NULL;
 }
 
-static void parse_terminal(struct frame *top, struct lens *lens,
-                           struct state *state) {
-    top->dict = NULL;
-    top->skel = parse_lens(lens, state, &top->dict);
-    top->key = state->key;
-    state->key = NULL;
-}
-
 static void visit_terminal(struct lens *lens, size_t start, size_t end,
                            void *data) {
     struct rec_state *rec_state = data;
@@ -1044,10 +1085,7 @@ static void visit_terminal(struct lens *lens, size_t start, size_t end,
         dbg_visit(lens, 'T', start, end, rec_state->fused, rec_state->lvl);
     match(state, lens, lens->ctype, end, start);
     struct frame *top = push_frame(rec_state, lens);
-    if (rec_state->mode == M_GET)
-        get_terminal(top, lens, state);
-    else
-        parse_terminal(top, lens, state);
+    get_terminal(rec_state, top, lens);
     child = ast_append(rec_state, lens, start, end);
     ERR_NOMEM(child == NULL, state->info);
  error:
@@ -1092,12 +1130,19 @@ static void visit_enter(struct lens *lens,
     return;
 }
 
-static void get_combine(struct rec_state *rec_state,
-                        struct lens *lens, uint n) {
+static void combine(struct rec_state *rec_state,
+                    struct lens *lens, uint n) {
     struct tree *tree = NULL, *tail = NULL;
+    struct skel *skel = NULL, *stail = NULL;
+    struct dict *dict = NULL;
     char *key = NULL, *value = NULL;
     struct frame *top = NULL;
 
+    if (rec_state->mode & M_PARSE) {
+        skel = make_skel(lens);
+        ERR_NOMEM(skel == NULL, rec_state->state->info);
+    }
+
     if (n > 0)
         top = top_frame(rec_state);
 
@@ -1107,6 +1152,14 @@ static void get_combine(struct rec_state *rec_state,
         if (tail != NULL)
             while (tail->next != NULL) tail = tail->next;
 
+        if (skel != NULL) {
+            list_tail_cons(skel->skels, stail, top->skel);
+            /* top->skel might have more than one node, update stail */
+            if (stail != NULL)
+                while (stail->next != NULL) stail = stail->next;
+            dict_append(&dict, top->dict);
+        }
+
         if (top->key != NULL) {
             ensure(key == NULL, rec_state->state->info);
             key = top->key;
@@ -1118,44 +1171,16 @@ static void get_combine(struct rec_state *rec_state,
     }
     top = push_frame(rec_state, lens);
     top->tree = tree;
-    top->key = key;
-    top->value = value;
- error:
-    return;
-}
-
-static void parse_combine(struct rec_state *rec_state,
-                          struct lens *lens, uint n) {
-    struct skel *skel = make_skel(lens), *tail = NULL;
-    struct dict *dict = NULL;
-    char *key = NULL;
-    struct frame *top = NULL;
-
-    if (n > 0)
-        top = top_frame(rec_state);
-
-    for (int i=0; i < n; i++, top = pop_frame(rec_state)) {
-        list_tail_cons(skel->skels, tail, top->skel);
-        /* top->skel might have more than one node, update skel */
-        if (tail != NULL)
-            while (tail->next != NULL) tail = tail->next;
-        dict_append(&dict, top->dict);
-        if (top->key != NULL) {
-            ensure(key == NULL, rec_state->state->info);
-            key = top->key;
-        }
-    }
-    top = push_frame(rec_state, lens);
     top->skel = skel;
     top->dict = dict;
     top->key = key;
+    top->value = value;
  error:
     return;
 }
 
 static void visit_exit(struct lens *lens,
-                       ATTRIBUTE_UNUSED size_t start,
-                       ATTRIBUTE_UNUSED size_t end,
+                       size_t start, size_t end,
                        void *data) {
     struct rec_state *rec_state = data;
     struct state *state = rec_state->state;
@@ -1167,99 +1192,93 @@ static void visit_exit(struct lens *lens,
     if (debugging("cf.get"))
         dbg_visit(lens, '}', start, end, rec_state->fused, rec_state->lvl);
 
-    ERR_BAIL(lens->info);
+    ERR_BAIL(state->info);
 
     if (lens->tag == L_SUBTREE) {
         struct frame *top = top_frame(rec_state);
-        if (rec_state->mode == M_GET) {
-            struct tree *tree;
+        struct tree *tree = NULL;
+        struct skel *skel = NULL;
+        struct dict *dict = NULL;
+
+        if (rec_state->mode & M_GET) {
             // FIXME: tree may leak if pop_frame ensure0 fail
-            tree = make_tree(top->key, top->value, NULL, top->tree);
+            tree = make_tree_arena(state->arena, top->key, top->value,
+                                   top->tree);
+            ERR_NOMEM(tree == NULL, state->info);
             tree->span = state->span;
-            ERR_NOMEM(tree == NULL, lens->info);
-            top = pop_frame(rec_state);
-            ensure(lens == top->lens, state->info);
-            state->key = top->key;
-            state->value = top->value;
-            state->span = top->span;
-            pop_frame(rec_state);
-            top = push_frame(rec_state, lens);
-            top->tree = tree;
-        } else {
-            struct skel *skel;
-            struct dict *dict;
+        }
+        if (rec_state->mode & M_PARSE) {
+            struct skel_origin origin = {
+                .lens = lens,
+                .tree = tree,
+                .start = rec_state->start + start,
+                .end = rec_state->start + end
+            };
+            char *key = dict_key(state, top->key);
+
+            ERR_NOMEM(key == NULL && top->key != NULL, state->info);
             skel = make_skel(lens);
-            ERR_NOMEM(skel == NULL, lens->info);
-            dict = make_dict(top->key, top->skel, top->dict);
-            ERR_NOMEM(dict == NULL, lens->info);
-            top = pop_frame(rec_state);
-            ensure(lens == top->lens, state->info);
-            state->key = top->key;
-            pop_frame(rec_state);
-            top = push_frame(rec_state, lens);
-            top->skel = skel;
-            top->dict = dict;
+            ERR_NOMEM(skel == NULL, state->info);
+            dict = make_dict(key, top->skel, top->dict, &origin);
+            ERR_NOMEM(dict == NULL, state->info);
         }
+        top = pop_frame(rec_state);
+        ensure(lens == top->lens, state->info);
+        state->key = top->key;
+        state->value = top->value;
+        state->span = top->span;
+        pop_frame(rec_state);
+        top = push_frame(rec_state, lens);
+        top->tree = tree;
+        top->skel = skel;
+        top->dict = dict;
     } else if (lens->tag == L_CONCAT) {
         ensure(rec_state->fused >= lens->nchildren, state->info);
         for (int i = 0; i < lens->nchildren; i++) {
             struct frame *fr = nth_frame(rec_state, i);
             BUG_ON(lens->children[i] != fr->lens,
-                    lens->info,
+                    state->info,
              "Unexpected lens in concat %zd..%zd\n  Expected: %s\n  Actual: %s",
                     start, end,
                     format_lens(lens->children[i]),
                     format_lens(fr->lens));
         }
-        if (rec_state->mode == M_GET)
-            get_combine(rec_state, lens, lens->nchildren);
-        else
-            parse_combine(rec_state, lens, lens->nchildren);
+        combine(rec_state, lens, lens->nchildren);
     } else if (lens->tag == L_STAR) {
         uint n = 0;
         while (n < rec_state->fused &&
                nth_frame(rec_state, n)->lens == lens->child)
             n++;
-        if (rec_state->mode == M_GET)
-            get_combine(rec_state, lens, n);
-        else
-            parse_combine(rec_state, lens, n);
+        combine(rec_state, lens, n);
     } else if (lens->tag == L_MAYBE) {
         uint n = 1;
         if (rec_state->fused > 0
             && top_frame(rec_state)->lens == lens->child) {
             n = 2;
         }
-        if (rec_state->mode == M_GET)
-            get_combine(rec_state, lens, n);
-        else
-            parse_combine(rec_state, lens, n);
+        combine(rec_state, lens, n);
     } else if (lens->tag == L_SQUARE) {
-        if (rec_state->mode == M_GET) {
-            struct ast *square, *concat, *right, *left;
-            char *rsqr, *lsqr;
-            int ret;
-
-            square = rec_state->ast;
-            concat = child_first(square);
-            right = child_first(concat);
-            left = child_last(concat);
-            lsqr = token_range(state->text, left->start, left->end);
-            rsqr = token_range(state->text, right->start, right->end);
-            ret = square_match(lens, lsqr, rsqr);
-            if (! ret) {
-                get_error(state, lens, "%s \"%s\" %s \"%s\"",
-                        "Parse error: mismatched in square lens, expecting", lsqr,
-                        "but got", rsqr);
-            }
-            FREE(lsqr);
-            FREE(rsqr);
-            if (! ret)
-                goto error;
-            get_combine(rec_state, lens, 1);
-        } else {
-            parse_combine(rec_state, lens, 1);
+        struct ast *square, *concat, *right, *left;
+        char *rsqr, *lsqr;
+        int ret;
+
+        square = rec_state->ast;
+        concat = child_first(square);
+        right = child_first(concat);
+        left = child_last(concat);
+        lsqr = token_range(state->text, left->start, left->end);
+        rsqr = token_range(state->text, right->start, right->end);
+        ret = square_match(lens, lsqr, rsqr);
+        if (! ret) {
+            get_error(state, lens, "%s \"%s\" %s \"%s\"",
+                    "Parse error: mismatched in square lens, expecting", lsqr,
+                    "but got", rsqr);
         }
+        FREE(lsqr);
+        FREE(rsqr);
+        if (! ret)
+            goto error;
+        combine(rec_state, lens, 1);
     } else {
         top_frame(rec_state)->lens = lens;
     }
@@ -1295,10 +1314,11 @@ static struct frame *rec_process(enum mode_t mode, struct lens *lens,
     MEMZERO(&rec_state, 1);
     MEMZERO(&visitor, 1);
 
-    if (lens->jmt == NULL) {
-        lens->jmt = jmt_build(lens);
-        ERR_BAIL(lens->info);
-    }
+    LOCK_LENSES();
+    if (lens->jmt == NULL)
+        lens->jmt = jmt_build(lens, state->info);
+    UNLOCK_LENSES();
+    ERR_BAIL(state->info);
 
     state->regs = NULL;
     state->nreg = 0;
@@ -1311,15 +1331,16 @@ static struct frame *rec_process(enum mode_t mode, struct lens *lens,
     rec_state.ast = make_ast(lens);
     ERR_NOMEM(rec_state.ast == NULL, state->info);
 
-    visitor.parse = jmt_parse(lens->jmt, state->text + start, end - start);
-    ERR_BAIL(lens->info);
+    visitor.parse = jmt_parse(lens->jmt, state->info,
+                              state->text + start, end - start);
+    ERR_BAIL(state->info);
     visitor.terminal = visit_terminal;
     visitor.enter = visit_enter;
     visitor.exit = visit_exit;
     visitor.error = visit_error;
     visitor.data = &rec_state;
     r = jmt_visit(&visitor, &len);
-    ERR_BAIL(lens->info);
+    ERR_BAIL(state->info);
     if (r != 1) {
         get_error(state, lens, "Syntax error");
         state->error->pos = start + len;
@@ -1348,26 +1369,37 @@ static struct frame *rec_process(enum mode_t mode, struct lens *lens,
 
     for(i = 0; i < rec_state.fused; i++) {
         f = nth_frame(&rec_state, i);
-        FREE(f->key);
-        if (mode == M_GET) {
-            FREE(f->value);
-            free_tree(f->tree);
-        } else if (mode == M_PARSE) {
-            free_skel(f->skel);
-            free_dict(f->dict);
-        }
+        free_tree(f->tree);
+        free_skel(f->skel);
+        free_dict(f->dict);
+        /* Keys and values for M_GET are in the arena */
+        if (! (mode & M_GET))
+            FREE(f->key);
     }
     FREE(rec_state.frames);
     goto done;
 }
 
-static struct tree *get_rec(struct lens *lens, struct state *state) {
+/* Process a recursive lens; like get_lens, make the skeleton and
+ * dictionary, too, if SKEL is not NULL, and no tree without an arena */
+static struct tree *get_rec(struct lens *lens, struct state *state,
+                            struct skel **skel, struct dict **dict) {
     struct frame *fr;
     struct tree *tree = NULL;
+    enum mode_t mode = 0;
+
+    if (state->arena != NULL)
+        mode |= M_GET;
+    if (skel != NULL)
+        mode |= M_PARSE;
 
-    fr = rec_process(M_GET, lens, state);
+    fr = rec_process(mode, lens, state);
     if (fr != NULL) {
         tree = fr->tree;
+        if (skel != NULL) {
+            *skel = fr->skel;
+            *dict = fr->dict;
+        }
         state->key = fr->key;
         state->value = fr->value;
         FREE(fr);
@@ -1375,63 +1407,49 @@ static struct tree *get_rec(struct lens *lens, struct state *state) {
     return tree;
 }
 
-static struct skel *parse_rec(struct lens *lens, struct state *state,
-                              struct dict **dict) {
-    struct skel *skel = NULL;
-    struct frame *fr;
-
-    fr = rec_process(M_PARSE, lens, state);
-    if (fr != NULL) {
-        skel = fr->skel;
-        *dict = fr->dict;
-        state->key = fr->key;
-        FREE(fr);
-    }
-    return skel;
-}
-
-static struct tree *get_lens(struct lens *lens, struct state *state) {
+static struct tree *get_lens(struct lens *lens, struct state *state,
+                             struct skel **skel, struct dict **dict) {
     struct tree *tree = NULL;
 
     switch(lens->tag) {
     case L_DEL:
-        tree = get_del(lens, state);
+        tree = get_del(lens, state, skel);
         break;
     case L_STORE:
-        tree = get_store(lens, state);
+        tree = get_store(lens, state, skel);
         break;
     case L_VALUE:
-        tree = get_value(lens, state);
+        tree = get_value(lens, state, skel);
         break;
     case L_KEY:
-        tree = get_key(lens, state);
+        tree = get_key(lens, state, skel);
         break;
     case L_LABEL:
-        tree = get_label(lens, state);
+        tree = get_label(lens, state, skel);
         break;
     case L_SEQ:
-        tree = get_seq(lens, state);
+        tree = get_seq(lens, state, skel);
         break;
     case L_COUNTER:
-        tree = get_counter(lens, state);
+        tree = get_counter(lens, state, skel);
         break;
     case L_CONCAT:
-        tree = get_concat(lens, state);
+        tree = get_concat(lens, state, skel, dict);
         break;
     case L_UNION:
-        tree = get_union(lens, state);
+        tree = get_union(lens, state, skel, dict);
         break;
     case L_SUBTREE:
-        tree = get_subtree(lens, state);
+        tree = get_subtree(lens, state, skel, dict);
         break;
     case L_STAR:
-        tree = get_quant_star(lens, state);
+        tree = get_quant_star(lens, state, skel, dict);
         break;
     case L_MAYBE:
-        tree = get_quant_maybe(lens, state);
+        tree = get_quant_maybe(lens, state, skel, dict);
         break;
     case L_SQUARE:
-        tree = get_square(lens, state);
+        tree = get_square(lens, state, skel, dict);
         break;
     default:
         BUG_ON(true, state->info, "illegal lens tag %d", lens->tag);
@@ -1469,13 +1487,31 @@ static int init_regs(struct state *state, struct lens *lens, uint size) {
     return 0;
 }
 
-struct tree *lns_get(struct info *info, struct lens *lens, const char *text,
-                     struct lns_error **err) {
+/* Keys, values and the skeleton are C strings, and would be cut short at
+ * a NUL byte in the input; refuse such input rather than lose text */
+static int check_nul(struct state *state, struct lens *lens) {
+    const char *nul = memchr(state->text, '\0', state->size);
+
+    if (nul == NULL)
+        return 0;
+    get_error(state, lens, "input contains a NUL byte");
+    if (state->error != NULL)
+        state->error->pos = nul - state->text;
+    return -1;
+}
+
+struct tree *lns_get_skel(struct info *info, struct lens *lens,
+                          const char *text, size_t size, struct skel **skel,
+                          struct dict **dict, struct lns_error **err) {
     struct state state;
     struct tree *tree = NULL;
-    uint size = strlen(text);
     int partial, r;
 
+    if (skel != NULL) {
+        *skel = NULL;
+        *dict = NULL;
+    }
+
     MEMZERO(&state, 1);
     r = ALLOC(state.info);
     ERR_NOMEM(r < 0, info);
@@ -1484,6 +1520,14 @@ struct tree *lns_get(struct info *info, struct lens *lens, const char *text,
     state.info->ref = UINT_MAX;
 
     state.text = text;
+    state.size = size;
+    if (check_nul(&state, lens) < 0)
+        goto error;
+
+    /* The tree will need about as much memory as the text for its labels
+     * and values, and as much again for its nodes */
+    state.arena = make_arena(2 * size);
+    ERR_NOMEM(state.arena == NULL, info);
 
     /* We are probably being overly cautious here: if the lens can't process
      * all of TEXT, we should really fail somewhere in one of the sublenses.
@@ -1494,19 +1538,17 @@ struct tree *lns_get(struct info *info, struct lens *lens, const char *text,
     partial = init_regs(&state, lens, size);
     if (partial >= 0) {
         if (lens->recursive)
-            tree = get_rec(lens, &state);
+            tree = get_rec(lens, &state, skel, dict);
         else
-            tree = get_lens(lens, &state);
+            tree = get_lens(lens, &state, skel, dict);
     }
 
     free_seqs(state.seqs);
     if (state.key != NULL) {
         get_error(&state, lens, "get left unused key %s", state.key);
-        free(state.key);
     }
     if (state.value != NULL) {
         get_error(&state, lens, "get left unused value %s", state.value);
-        free(state.value);
     }
     if (partial && state.error == NULL) {
         get_error(&state, lens, "Get did not match entire input");
@@ -1516,6 +1558,12 @@ struct tree *lns_get(struct info *info, struct lens *lens, const char *text,
     free_regs(&state);
     FREE(state.info);
 
+    if (skel != NULL && state.error != NULL) {
+        free_skel(*skel);
+        free_dict(*dict);
+        *skel = NULL;
+        *dict = NULL;
+    }
     if (err != NULL) {
         *err = state.error;
     } else {
@@ -1525,84 +1573,46 @@ struct tree *lns_get(struct info *info, struct lens *lens, const char *text,
         }
         free_lns_error(state.error);
     }
+    /* The nodes of TREE keep the arena alive */
+    unref(state.arena, arena);
     return tree;
 }
 
-static struct skel *parse_lens(struct lens *lens, struct state *state,
-                               struct dict **dict) {
-    struct skel *skel = NULL;
-
-    switch(lens->tag) {
-    case L_DEL:
-        skel = parse_del(lens, state);
-        break;
-    case L_STORE:
-        skel = parse_store(lens, state);
-        break;
-    case L_VALUE:
-        skel = parse_value(lens, state);
-        break;
-    case L_KEY:
-        skel = parse_key(lens, state);
-        break;
-    case L_LABEL:
-        skel = parse_label(lens, state);
-        break;
-    case L_SEQ:
-        skel = parse_seq(lens, state);
-        break;
-    case L_COUNTER:
-        skel = parse_counter(lens, state);
-        break;
-    case L_CONCAT:
-        skel = parse_concat(lens, state, dict);
-        break;
-    case L_UNION:
-        skel = parse_union(lens, state, dict);
-        break;
-    case L_SUBTREE:
-        skel = parse_subtree(lens, state, dict);
-        break;
-    case L_STAR:
-        skel = parse_quant_star(lens, state, dict);
-        break;
-    case L_MAYBE:
-        skel = parse_quant_maybe(lens, state, dict);
-        break;
-    case L_SQUARE:
-        skel = parse_square(lens, state, dict);
-        break;
-    default:
-        BUG_ON(true, state->info, "illegal lens tag %d", lens->tag);
-        break;
-    }
- error:
-    return skel;
+struct tree *lns_get(struct info *info, struct lens *lens, const char *text,
+                     size_t size, struct lns_error **err) {
+    return lns_get_skel(info, lens, text, size, NULL, NULL, err);
 }
 
-struct skel *lns_parse(struct lens *lens, const char *text, struct dict **dict,
-                       struct lns_error **err) {
+struct skel *lns_parse(struct lens *lens, const char *text, size_t size,
+                       struct dict **dict, struct lns_error **err) {
     struct state state;
     struct skel *skel = NULL;
-    uint size = strlen(text);
+    struct error error;
     int partial, r;
 
     MEMZERO(&state, 1);
+    MEMZERO(&error, 1);
     r = ALLOC(state.info);
     ERR_NOMEM(r< 0, lens->info);
     state.info->ref = UINT_MAX;
-    state.info->error = lens->info->error;
+    /* LENS->INFO->ERROR belongs to the handle that compiled LENS, which
+     * might not be the one we are parsing for; parse errors are collected
+     * separately and passed on at the end */
+    state.info->error = &error;
     state.text = text;
+    state.size = size;
 
-    state.text = text;
+    *dict = NULL;
+    if (check_nul(&state, lens) < 0)
+        goto error;
 
     partial = init_regs(&state, lens, size);
     if (! partial) {
-        *dict = NULL;
+        /* Without an arena, get_* only make the skeleton */
         if (lens->recursive)
-            skel = parse_rec(lens, &state, dict);
+            get_rec(lens, &state, &skel, dict);
         else
-            skel = parse_lens(lens, &state, dict);
+            get_lens(lens, &state, &skel, dict);
 
         free_seqs(state.seqs);
         if (state.error != NULL) {
@@ -1625,6 +1635,13 @@ struct skel *lns_parse(struct lens *lens, const char *text, struct dict **dict,
     }
 
  error:
+    if (error.code != AUG_NOERROR) {
+        if (error.details != NULL)
+            report_error(lens->info->error, error.code, "%s", error.details);
+        else
+            report_error(lens->info->error, error.code, NULL);
+    }
+    free(error.details);
     free_regs(&state);
     FREE(state.info);
     if (err != NULL) {
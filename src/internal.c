@@ -26,6 +26,13 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include <locale.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if HAVE_SYS_MMAN_H && HAVE_MMAP
+#include <sys/mman.h>
+#define USE_MMAP 1
+#endif
 
 #include "internal.h"
 #include "memory.h"
@@ -157,6 +164,117 @@ char* xread_file(const char *path) {
     return result;
 }
 
+/* Map the contents of the regular file FD of size LEN into memory. The
+ * last page of the mapping needs to have room for a newline and the
+ * terminating NUL after the contents. Return NULL if the file can not be
+ * mapped */
+static char *map_file(int fd, size_t len) {
+#if USE_MMAP
+    long pagesize = sysconf(_SC_PAGESIZE);
+    char *text;
+
+    if (pagesize <= 0 || len % pagesize == 0
+        || len % pagesize > pagesize - 2)
+        return NULL;
+    /* Mapped privately and writable so that we can append a newline
+     * without changing the file; only the last page gets copied when we
+     * do that */
+    text = mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+    return text == MAP_FAILED ? NULL : text;
+#else
+    return NULL;
+#endif
+}
+
+int xfmap_file(FILE *fp, struct file_text *ft) {
+    struct stat st;
+
+    MEMZERO(ft, 1);
+    if (fp == NULL)
+        return -1;
+
+    if (fstat(fileno(fp), &st) == 0 && S_ISREG(st.st_mode)
+        && st.st_size <= MAX_READ_LEN) {
+        ft->text = map_file(fileno(fp), st.st_size);
+        if (ft->text != NULL) {
+            ft->len = st.st_size;
+            ft->map_len = st.st_size;
+            /* The rest of the last page follows the file if it grows,
+             * until we write to it and get our own copy of the page */
+            ft->text[ft->len] = '\0';
+        }
+    }
+
+    if (ft->text == NULL) {
+        /* Keep the length fread_file_lim read, rather than stopping at the
+         * first NUL byte in the file */
+        ft->text = fread_file_lim(fp, MAX_READ_LEN, &ft->len);
+        if (ft->text == NULL)
+            return -1;
+        if (ft->len > MAX_READ_LEN) {
+            xunmap_file(ft);
+            return -1;
+        }
+    }
+
+    /* Lenses generally break if the text does not end with a newline */
+    if (ft->len == 0 || ft->text[ft->len - 1] != '\n') {
+        if (ft->map_len == 0 && REALLOC_N(ft->text, ft->len + 2) < 0) {
+            xunmap_file(ft);
+            return -1;
+        }
+        ft->text[ft->len] = '\n';
+        ft->text[ft->len + 1] = '\0';
+        ft->len += 1;
+        ft->newline = true;
+    }
+    return 0;
+}
+
+int xmap_file(const char *path, struct file_text *ft) {
+    FILE *fp;
+    int result;
+
+    fp = fopen(path, "r");
+    if (fp == NULL) {
+        MEMZERO(ft, 1);
+        return -1;
+    }
+
+    result = xfmap_file(fp, ft);
+    fclose(fp);
+
+    return result;
+}
+
+int xcopy_mapped_file(struct file_text *ft) {
+    char *text;
+
+    if (ft->map_len == 0)
+        return 0;
+    if (ALLOC_N(text, ft->len + 1) < 0)
+        return -1;
+    memcpy(text, ft->text, ft->len);
+#if USE_MMAP
+    munmap(ft->text, ft->map_len);
+#endif
+    ft->text = text;
+    ft->map_len = 0;
+    return 0;
+}
+
+void xunmap_file(struct file_text *ft) {
+    if (ft->text != NULL) {
+#if USE_MMAP
+        if (ft->map_len > 0)
+            munmap(ft->text, ft->map_len);
+        else
+#endif
+            free(ft->text);
+    }
+    MEMZERO(ft, 1);
+}
+
 /*
  * Escape/unescape of string literals
  */
@@ -331,41 +449,45 @@ int __aug_close_memstream(struct memstream *ms) {
     return 0;
 }
 
-char *path_expand(struct tree *tree, const char *ppath) {
-    struct tree *siblings = tree->parent->children;
+/* Set *LABEL to the label of TREE as it appears in a path and *IND to the
+ * position of TREE among its siblings with the same label, or to 0 if it
+ * is the only one with that label. If the label needs escaping, *LABEL is
+ * the same as *ESCAPED, which the caller must free */
+static int path_component(struct tree *tree, const char **label,
+                          char **escaped, int *ind) {
+    int cnt = 0, r;
+
+    *escaped = NULL;
+    *ind = tree_sibling_index(tree, &cnt);
+    if (cnt <= 1)
+        *ind = 0;
+
+    if (tree->label == NULL)
+        *label = "(none)";
+    else
+        *label = tree->label;
+
+    r = pathx_escape_name(*label, escaped);
+    if (r < 0)
+        return -1;
+    if (*escaped != NULL)
+        *label = *escaped;
+    return 0;
+}
 
+char *path_expand(struct tree *tree, const char *ppath) {
     char *path;
     const char *label;
     char *escaped = NULL;
-
-    int cnt = 0, ind = 0, r;
-
-    list_for_each(t, siblings) {
-        if (streqv(t->label, tree->label)) {
-            cnt += 1;
-            if (t == tree)
-                ind = cnt;
-        }
-    }
+    int ind, r;
 
     if (ppath == NULL)
         ppath = "";
 
-    if (tree == NULL)
-        label = "(no_tree)";
-    else if (tree->label == NULL)
-        label = "(none)";
-    else
-        label = tree->label;
-
-    r = pathx_escape_name(label, &escaped);
-    if (r < 0)
+    if (path_component(tree, &label, &escaped, &ind) < 0)
         return NULL;
 
-    if (escaped != NULL)
-        label = escaped;
-
-    if (cnt > 1) {
+    if (ind > 0) {
         r = asprintf(&path, "%s/%s[%d]", ppath, label, ind);
     } else {
         r = asprintf(&path, "%s/%s", ppath, label);
@@ -378,24 +500,45 @@ char *path_expand(struct tree *tree, const char *ppath) {
     return path;
 }
 
+/* Build the whole path in one go; we only look at the siblings of each
+ * ancestor once, and never copy a partial path */
 char *path_of_tree(struct tree *tree) {
+    struct path_seg {
+        const char *label;
+        char       *escaped;
+        int         ind;
+    } *segs = NULL;
     int depth, i;
-    struct tree *t, **anc;
-    char *path = NULL;
+    struct tree *t;
+    char *path = NULL, *p;
+    size_t len = 1;
 
     for (t = tree, depth = 1; ! ROOT_P(t); depth++, t = t->parent);
-    if (ALLOC_N(anc, depth) < 0)
+    if (ALLOC_N(segs, depth) < 0)
         return NULL;
 
-    for (t = tree, i = depth - 1; i >= 0; i--, t = t->parent)
-        anc[i] = t;
+    for (t = tree, i = depth - 1; i >= 0; i--, t = t->parent) {
+        struct path_seg *seg = segs + i;
+        if (path_component(t, &seg->label, &seg->escaped, &seg->ind) < 0)
+            goto done;
+        len += 1 + strlen(seg->label);
+        if (seg->ind > 0)
+            len += snprintf(NULL, 0, "[%d]", seg->ind);
+    }
 
+    if (ALLOC_N(path, len) < 0)
+        goto done;
+    p = path;
     for (i = 0; i < depth; i++) {
-        char *p = path_expand(anc[i], path);
-        free(path);
-        path = p;
+        if (segs[i].ind > 0)
+            p += sprintf(p, "/%s[%d]", segs[i].label, segs[i].ind);
+        else
+            p += sprintf(p, "/%s", segs[i].label);
     }
-    FREE(anc);
+ done:
+    for (i = 0; i < depth; i++)
+        free(segs[i].escaped);
+    FREE(segs);
     return path;
 }
 
@@ -32,6 +32,7 @@
 #include <strings.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <errno.h>
 #include <assert.h>
@@ -85,6 +86,12 @@
 #define AUGEAS_COPY_IF_RENAME_FAILS \
     AUGEAS_META_SAVE_MODE "/copy_if_rename_fails"
 
+/* Define: AUGEAS_INCREMENTAL_SAVE_OPTION
+ * Enable or disable keeping the text of loaded files, so that saving them
+ * only needs to put the parts of their tree that changed */
+#define AUGEAS_INCREMENTAL_SAVE_OPTION \
+    AUGEAS_META_SAVE_MODE "/incremental"
+
 /* Define: AUGEAS_CONTEXT
  * Context prepended to all non-absolute paths */
 #define AUGEAS_CONTEXT AUGEAS_META_TREE "/context"
@@ -102,11 +109,24 @@
  * Enable or disable node indexes */
 #define AUGEAS_SPAN_OPTION AUGEAS_META_TREE "/span"
 
+/* Define: AUGEAS_THREADS_OPTION
+ * The number of threads aug_load uses to parse files */
+#define AUGEAS_THREADS_OPTION AUGEAS_META_TREE "/threads"
+
+/* Define: AUGEAS_WATCH_OPTION
+ * Enable or disable watching loaded files for changes */
+#define AUGEAS_WATCH_OPTION AUGEAS_META_TREE "/watch"
+
 /* Define: AUGEAS_LENS_ENV
  * Name of env var that contains list of paths to search for additional
    spec files */
 #define AUGEAS_LENS_ENV "AUGEAS_LENS_LIB"
 
+/* Define: AUGEAS_LENS_CACHE_ENV
+ * Name of env var that contains the directory in which compiled modules
+ * are cached */
+#define AUGEAS_LENS_CACHE_ENV "AUGEAS_LENS_CACHE"
+
 /* Define: MAX_ENV_SIZE
  * Fairly arbitrary bound on the length of the path we
  *  accept from AUGEAS_SPEC_ENV */
@@ -290,6 +310,43 @@ char* xread_file(const char *path);
 /* Like xread_file, but caller supplies a file pointer */
 char* xfread_file(FILE *fp);
 
+/* The contents of a file, as made available by xmap_file */
+struct file_text {
+    char   *text;       /* Terminated by a NUL */
+    size_t  len;        /* Length of TEXT */
+    size_t  map_len;    /* Length of the mapping at TEXT, or 0 if TEXT
+                         * was allocated with malloc */
+    bool    newline;    /* The last character of TEXT is a newline that
+                         * is not in the file */
+};
+
+/* Function: xmap_file
+ * Make the contents of file PATH available as one long string in FT->TEXT,
+ * which always ends with a newline; one is appended if the file does not
+ * end with it. Regular files are mapped into memory rather than copied if
+ * possible, and other files are read.
+ *
+ * The contents of a mapped file change if the file is changed in place,
+ * and reading them raises SIGBUS once it is truncated; a file that is
+ * replaced by renaming another one over it does not affect FT->TEXT. Text
+ * that is kept around should be copied with xcopy_mapped_file.
+ *
+ * Return 0 on success and -1 if any error occurs. FT->TEXT must be
+ * released with xunmap_file.
+ */
+int xmap_file(const char *path, struct file_text *ft);
+
+/* Like xmap_file, but caller supplies a file pointer */
+int xfmap_file(FILE *fp, struct file_text *ft);
+
+/* If FT->TEXT is mapped, replace it with a copy in memory, so that it
+ * does not depend on the file any more. Return 0 on success and -1 if we
+ * run out of memory, in which case FT is unchanged */
+int xcopy_mapped_file(struct file_text *ft);
+
+/* Release the text that xmap_file made available in FT */
+void xunmap_file(struct file_text *ft);
+
 /* Get the error message for ERRNUM in a threadsafe way. Based on libvirt's
  * virStrError
  */
@@ -328,7 +385,19 @@ struct augeas {
     size_t            nmodpath;
     char             *modpathz;   /* The search path for modules as a
                                      glibc argz vector */
+    char             *lens_cache; /* Directory for cached modules or NULL */
+    struct watch     *watch;      /* Changes to loaded files or NULL */
+    struct load_queue *load_queue; /* Files waiting to be parsed or NULL */
+    struct hash_t    *parsed_files; /* Files kept for AUG_INCREMENTAL_SAVE,
+                                       by path, or NULL */
+    bool              shared_modules; /* Lenses are also used by other
+                                         handles, possibly in other
+                                         threads */
     struct pathx_symtab *symtab;
+    struct pathx_cache  *pathx_cache; /* Parsed path expressions */
+    unsigned long       pathx_hits;   /* The counters last stored in */
+    unsigned long       pathx_misses; /* /augeas/pathx/cache */
+    uint                symtab_version; /* Changes with SYMTAB */
     struct error        *error;
     uint                api_entries;  /* Number of entries through a public
                                        * API, 0 when called from outside */
@@ -369,15 +438,40 @@ void api_exit(const struct augeas *aug);
  * marked dirty, too. Instead of setting this flag directly, the function
  * TREE_MARK_DIRTY in augeas.c should be used (and only functions in that
  * file should have a need to mark nodes as dirty)
+ *
+ * The nodes that lns_get makes for a file are allocated from an ARENA,
+ * and so are their labels and values, as indicated by the ARENA_LABEL and
+ * ARENA_VALUE flags. Each of these nodes holds a reference to the arena.
+ * Labels and values from the arena must never be freed, or be used for
+ * any other node; they are simply dropped when a node gets a new label or
+ * value.
+ *
+ * Nodes with many children get an INDEX of their children by label the
+ * first time a child is looked up by its label. Once a node has an index,
+ * children must only be added and removed with the tree_* functions in
+ * augeas.c, which keep the index up to date. The index also keeps the
+ * ORDINAL of each child, its position among the children with the same
+ * label, so that paths for the children can be built without counting
+ * their siblings.
  */
+struct arena;
+struct tree_index;
+
 struct tree {
-    struct tree *next;
-    struct tree *parent;     /* Points to self for root */
-    char        *label;      /* Last component of PATH */
-    struct tree *children;   /* List of children through NEXT */
-    char        *value;
-    int          dirty;
-    struct span *span;
+    struct tree  *next;
+    struct tree  *parent;     /* Points to self for root */
+    char         *label;      /* Last component of PATH */
+    struct tree  *children;   /* List of children through NEXT */
+    char         *value;
+    struct arena *arena;      /* Arena the node was allocated from */
+    struct tree_index *index; /* Children by label, or NULL */
+    unsigned int  dirty : 1;
+    unsigned int  arena_label : 1;
+    unsigned int  arena_value : 1;
+    unsigned int  has_labels_below : 1; /* LABELS_BELOW is up to date */
+    unsigned int  ordinal;    /* Only valid if the parent has an index */
+    struct span  *span;
+    uint64_t      labels_below; /* Summary of the labels of descendants */
 };
 
 /* The opaque structure used to represent path expressions. API's
@@ -394,6 +488,13 @@ struct pathx;
 struct tree *make_tree(char *label, char *value,
                        struct tree *parent, struct tree *children);
 
+/* Function: make_tree_arena
+ * Like MAKE_TREE, but allocate the node from ARENA. LABEL and VALUE must
+ * have been allocated from ARENA, too. The new node has no parent.
+ */
+struct tree *make_tree_arena(struct arena *arena, char *label, char *value,
+                             struct tree *children);
+
 /* Mark a tree as a standalone tree; this creates a fake parent for ROOT,
  * so that even ROOT has a parent. A new node with only child ROOT is
  * returned on success, and NULL on failure.
@@ -416,6 +517,34 @@ char *path_of_tree(struct tree *tree);
 void tree_clean(struct tree *tree);
 /* Return first child with label LABEL or NULL */
 struct tree *tree_child(struct tree *tree, const char *label);
+/* Return the first child of TREE with label LABEL, where NULL and the
+ * empty string are the same label, and set *COUNT to the number of
+ * children with that label. Return NULL if there is no such child */
+struct tree *tree_child_labelled(struct tree *tree, const char *label,
+                                 size_t *count);
+/* Set *CHILDREN to the children of TREE with label LABEL and value VALUE,
+ * in order, and return how many there are; NULL and the empty string are
+ * the same label and the same value. *CHILDREN belongs to TREE and can
+ * only be used until the children of TREE change. Return -1 if TREE has
+ * too few children to be worth indexing, or we run out of memory */
+int tree_child_valued(struct tree *tree, const char *label,
+                      const char *value, struct tree *const **children);
+/* Return the position of TREE among the children of its parent with the
+ * same label, counting from 1, and set *COUNT to the number of those
+ * children */
+int tree_sibling_index(struct tree *tree, int *count);
+/* Remove TREE from the children of its parent, without freeing it */
+void tree_detach(struct tree *tree);
+/* Return false if no descendant of TREE has label LABEL, where NULL and
+ * the empty string are the same label. Return true if one might; the
+ * answer comes from a summary of the labels below TREE that is made when
+ * it is first needed, and so is sometimes true when there is no such
+ * descendant */
+bool tree_maybe_below(struct tree *tree, const char *label);
+/* Forget the label summaries of TREE and its ancestors; needed when the
+ * children of TREE are changed by other means than make_tree,
+ * tree_detach and the other tree functions here */
+void tree_labels_changed(struct tree *tree);
 /* Return first existing child with label LABEL or create one. Return NULL
  * when allocation fails */
 struct tree *tree_child_cr(struct tree *tree, const char *label);
@@ -553,6 +682,43 @@ int pathx_parse(const struct tree *origin,
                 struct pathx_symtab *symtab,
                 struct tree *root_ctx,
                 struct pathx **px);
+
+/* A cache of parsed path expressions, indexed by their text */
+struct pathx_cache;
+
+struct pathx_cache *make_pathx_cache(void);
+void free_pathx_cache(struct pathx_cache *cache);
+/* Drop all entries from CACHE; needed whenever the symtab that the
+ * expressions in it were typechecked against changes */
+void pathx_cache_clear(struct pathx_cache *cache);
+void pathx_cache_stats(const struct pathx_cache *cache,
+                       unsigned long *hits, unsigned long *misses);
+
+/* Like PATHX_PARSE, but reuse a path expression from CACHE if we parsed
+ * PATH before. The caller must free the result with FREE_PATHX as usual,
+ * which only hands it back to CACHE. CACHE can be NULL */
+int pathx_cache_parse(struct pathx_cache *cache,
+                      const struct tree *origin,
+                      struct error *err,
+                      const char *path,
+                      bool need_nodeset,
+                      struct pathx_symtab *symtab,
+                      struct tree *root_ctx,
+                      struct pathx **px);
+/* Get PX ready to be evaluated again, against the tree ORIGIN and with
+ * the given ERR, SYMTAB and ROOT_CTX, as if it had been parsed with
+ * them */
+void pathx_reuse(struct pathx *px, const struct tree *origin,
+                 struct error *err, struct pathx_symtab *symtab,
+                 struct tree *root_ctx);
+/* Typecheck PX again, against the symtab passed to PATHX_REUSE; needed
+ * when the variables it uses might have changed their type */
+int pathx_typecheck(struct pathx *px, bool need_nodeset);
+/* Return the highest N of the parameters $N used in PX */
+int pathx_nparams(struct pathx *px);
+/* Bind the parameter $N in PX to the string VALUE. Returns 0 on success,
+ * and -1 when out of memory */
+int pathx_bind(struct pathx *px, int n, const char *value);
 /* Return the error struct that was passed into pathx_parse */
 struct error *err_of_pathx(struct pathx *px);
 struct tree *pathx_first(struct pathx *path);
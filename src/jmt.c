@@ -189,7 +189,7 @@ struct jmt_lens {
 
 /* A Jim/Mandelbaum transducer */
 struct jmt {
-    struct error *error;
+    struct error *error;       /* Only used while building the JMT */
     struct array lenses;       /* Array of struct jmt_lens */
     struct state *start;
     ind_t  lens;               /* The start symbol of the grammar */
@@ -514,20 +514,20 @@ static void ncallee(struct jmt_parse *parse, ind_t j, ATTRIBUTE_UNUSED ind_t ite
     }
 }
 
-static struct jmt_parse *parse_init(struct jmt *jmt,
+static struct jmt_parse *parse_init(struct jmt *jmt, struct info *info,
                                     const char *text, size_t text_len) {
     int r;
     struct jmt_parse *parse;
 
     r = ALLOC(parse);
-    ERR_NOMEM(r < 0, jmt);
+    ERR_NOMEM(r < 0, info);
 
     parse->jmt = jmt;
-    parse->error = jmt->error;
+    parse->error = info->error;
     parse->text = text;
     parse->nsets = text_len + 1;
     r = ALLOC_N(parse->sets, parse->nsets);
-    ERR_NOMEM(r < 0, jmt);
+    ERR_NOMEM(r < 0, info);
     return parse;
  error:
     if (parse != NULL)
@@ -655,12 +655,13 @@ static void parse_dot(struct jmt_parse *parse, const char *fname) {
 }
 
 struct jmt_parse *
-jmt_parse(struct jmt *jmt, const char *text, size_t text_len)
+jmt_parse(struct jmt *jmt, struct info *info,
+          const char *text, size_t text_len)
 {
     struct jmt_parse *parse = NULL;
 
-    parse = parse_init(jmt, text, text_len);
-    ERR_BAIL(jmt);
+    parse = parse_init(jmt, info, text, text_len);
+    ERR_BAIL(info);
 
     /* INIT */
     parse_add_item(parse, 0, jmt->start, 0, R_ROOT, EPS, EPS, EPS, EPS,
@@ -1855,14 +1856,14 @@ static void determinize(struct jmt *jmt) {
     goto done;
 }
 
-struct jmt *jmt_build(struct lens *lens) {
+struct jmt *jmt_build(struct lens *lens, struct info *info) {
     struct jmt *jmt = NULL;
     int r;
 
     r = ALLOC(jmt);
-    ERR_NOMEM(r < 0, lens->info);
+    ERR_NOMEM(r < 0, info);
 
-    jmt->error = lens->info->error;
+    jmt->error = info->error;
     array_init(&jmt->lenses, sizeof(struct jmt_lens));
 
     index_lenses(jmt, lens);
@@ -1884,6 +1885,7 @@ struct jmt *jmt_build(struct lens *lens) {
     if (debugging("cf.jmt.build"))
         jmt_dot(jmt, "jmt_30_dfa.dot");
 
+    jmt->error = NULL;
     return jmt;
  error:
     jmt_free(jmt);
@@ -33,6 +33,7 @@ struct jmt_parse;
 typedef uint32_t ind_t;
 
 struct lens;
+struct info;
 
 typedef void (*jmt_traverser)(struct lens *l, size_t start, size_t end,
                               void *data);
@@ -49,9 +50,13 @@ struct jmt_visitor {
     void             *data;
 };
 
-struct jmt *jmt_build(struct lens *l);
+/* Build the JMT for the recursive lens L. Errors are reported through
+ * INFO, which does not need to outlive the call */
+struct jmt *jmt_build(struct lens *l, struct info *info);
 
-struct jmt_parse *jmt_parse(struct jmt *jmt, const char *text, size_t text_len);
+/* Parse TEXT with JMT; errors are reported through INFO */
+struct jmt_parse *jmt_parse(struct jmt *jmt, struct info *info,
+                            const char *text, size_t text_len);
 
 void jmt_free_parse(struct jmt_parse *);
 
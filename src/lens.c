@@ -140,8 +140,26 @@ static struct value *str_to_fa(struct info *info, const char *pattern,
     goto done;
 }
 
+/* Like STR_TO_FA, but *FA is shared with other regexps and must not be
+ * freed by the caller
+ */
 static struct value *regexp_to_fa(struct regexp *regexp, struct fa **fa) {
-    return str_to_fa(regexp->info, regexp->pattern->str, fa, regexp->nocase);
+    struct info *info = regexp->info;
+    struct value *exn;
+
+    if (regexp_fa(regexp, fa) == REG_NOERROR)
+        return NULL;
+    /* Compile again to turn the error into an exception */
+    exn = str_to_fa(info, regexp->pattern->str, fa, regexp->nocase);
+    if (exn == NULL) {
+        /* The regexp is fine, and REGEXP_FA ran out of memory; the
+         * automaton STR_TO_FA made is not shared */
+        fa_free(*fa);
+        *fa = NULL;
+        ERR_REPORT(info, AUG_ENOMEM, NULL);
+        exn = info->error->exn;
+    }
+    return exn;
 }
 
 static struct lens *make_lens(enum lens_tag tag, struct info *info) {
@@ -585,9 +603,8 @@ struct value *lns_make_prim(enum lens_tag tag, struct info *info,
             goto error;
         }
         fa_free(fa_isect);
-        fa_free(fa_key);
         fa_free(fa_slash);
-        fa_isect = fa_key = fa_slash = NULL;
+        fa_isect = fa_slash = NULL;
     } else if (tag == L_LABEL) {
         if (strchr(string->str, SEP) != NULL) {
             exn = make_exn_value(info,
@@ -657,7 +674,6 @@ struct value *lns_make_prim(enum lens_tag tag, struct info *info,
     return make_lens_value(lens);
  error:
     fa_free(fa_isect);
-    fa_free(fa_key);
     fa_free(fa_slash);
     return exn;
 }
@@ -708,8 +724,6 @@ static struct value *disjoint_check(struct info *info, bool is_get,
 
  done:
     fa_free(fa);
-    fa_free(fa1);
-    fa_free(fa2);
 
     return exn;
 }
@@ -820,8 +834,6 @@ ambig_concat_check(struct info *info, const char *msg,
 
     result = ambig_check(info, fa1, fa2, typ, l1, l2, msg, false);
  done:
-    fa_free(fa1);
-    fa_free(fa2);
     return result;
 }
 
@@ -909,8 +921,6 @@ static struct value *typecheck_square(struct info *info, struct lens *l1,
     }
 
  done:
-    fa_free(fa1);
-    fa_free(fa2);
     return exn;
 }
 
@@ -933,7 +943,6 @@ ambig_iter_check(struct info *info, const char *msg,
     result = ambig_check(info, fa, fas, typ, l, l, msg, true);
 
  done:
-    fa_free(fa);
     fa_free(fas);
     return result;
 }
@@ -2283,7 +2292,7 @@ struct value *lns_check_rec(struct info *info,
     top->rec_internal = 0;
     rec->alias = top;
 
-    top->jmt = jmt_build(top);
+    top->jmt = jmt_build(top, info);
     ERR_BAIL(info);
 
     return result;
@@ -175,15 +175,30 @@ struct lns_error {
     char         *message;
 };
 
-struct dict *make_dict(char *key, struct skel *skel, struct dict *subdict);
+/* Where the skel in a dict entry came from: the text between START and
+ * END was parsed with the subtree lens LENS. For dicts made by
+ * lns_get_skel, TREE is the node that was made from the same text; it is
+ * NULL for dicts made by lns_parse */
+struct skel_origin {
+    struct lens *lens;
+    struct tree *tree;
+    uint         start;
+    uint         end;
+};
+
+struct dict *make_dict(char *key, struct skel *skel, struct dict *subdict,
+                       const struct skel_origin *origin);
 void dict_lookup(const char *key, struct dict *dict,
-                 struct skel **skel, struct dict **subdict);
+                 struct skel **skel, struct dict **subdict,
+                 const struct skel_origin **origin);
 int dict_append(struct dict **dict, struct dict *d2);
 void free_skel(struct skel *skel);
 void free_dict(struct dict *dict);
 void free_lns_error(struct lns_error *err);
 
 /* Parse text TEXT with LENS. INFO indicats where TEXT was read from.
+ * SIZE is the length of TEXT, which does not need to be NUL terminated;
+ * input that contains a NUL byte is rejected with an error.
  *
  * If ERR is non-NULL, *ERR is set to NULL on success, and to an error
  * message on failure; the constructed tree is always returned. If ERR is
@@ -193,11 +208,28 @@ void free_lns_error(struct lns_error *err);
  * parse_flags
  */
 struct tree *lns_get(struct info *info, struct lens *lens, const char *text,
-                     struct lns_error **err);
-struct skel *lns_parse(struct lens *lens, const char *text,
+                     size_t size, struct lns_error **err);
+/* Like lns_get, but also make the skeleton and dictionary that lns_parse
+ * would make from TEXT in the same pass, with each entry in *DICT
+ * recording the node of the tree that was made from its text. *SKEL and
+ * *DICT are NULL if there is an error */
+struct tree *lns_get_skel(struct info *info, struct lens *lens,
+                          const char *text, size_t size, struct skel **skel,
+                          struct dict **dict, struct lns_error **err);
+struct skel *lns_parse(struct lens *lens, const char *text, size_t size,
                        struct dict **dict, struct lns_error **err);
+/* Write TREE to OUT, using the SIZE bytes of TEXT to preserve the
+ * formatting of the original file */
 void lns_put(FILE *out, struct lens *lens, struct tree *tree,
-             const char *text, struct lns_error **err);
+             const char *text, size_t size, struct lns_error **err);
+/* Like lns_put, but with the skeleton SKEL and dictionary DICT that
+ * lns_get_skel produced from TEXT earlier. Subtrees whose node has not
+ * changed since lns_get_skel made it are copied from TEXT
+ * as they are, without putting them again. DICT is used up, and can not
+ * be used for another lns_put_skel */
+void lns_put_skel(FILE *out, struct lens *lens, struct tree *tree,
+                  const char *text, struct skel *skel, struct dict *dict,
+                  struct lns_error **err);
 
 /* Free up temporary data structures, most importantly compiled
    regular expressions */
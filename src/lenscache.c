@@ -0,0 +1,1103 @@
+/*
+ * lenscache.c: on-disk cache of compiled modules
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#include <config.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#include "internal.h"
+#include "memory.h"
+#include "syntax.h"
+#include "transform.h"
+#include "errcode.h"
+#include "hash.h"
+#include "lenscache.h"
+
+/* Layout of a cache file; all numbers are in host byte order, which is
+ * checked with CACHE_BOM. Strings are written as their length followed by
+ * their bytes, with a length of NIL for NULL. References to objects are
+ * indices into the tables of strings, infos, regexps and lenses, or NIL
+ *
+ *   magic, version, bom, PACKAGE_VERSION, typecheck
+ *   ndeps, (path, mtime, size, hash) * ndeps
+ *   module name, name of autoload binding, complete
+ *   nstrings, strings
+ *   ninfos, infos
+ *   nregexps, regexps
+ *   nlenses, lenses
+ *   nbindings, bindings
+ *   checksum of everything before it
+ */
+static const char cache_magic[8] = "AUGLNSC";
+#define CACHE_VERSION 1
+#define CACHE_BOM 0x01020304
+#define CACHE_EXT "c"
+
+#define NIL UINT32_MAX
+
+/* Upper bound on the size of any string or table we are willing to read */
+#define CACHE_MAX_LEN (1 << 24)
+
+/* FNV-1a, used both for hashing module files and checksumming the cache */
+#define FNV_INIT  UINT64_C(0xcbf29ce484222325)
+#define FNV_PRIME UINT64_C(0x100000001b3)
+
+static uint64_t fnv_hash(uint64_t h, const void *buf, size_t len) {
+    const unsigned char *p = buf;
+
+    for (size_t i=0; i < len; i++) {
+        h ^= p[i];
+        h *= FNV_PRIME;
+    }
+    return h;
+}
+
+/* Key of a module file: its mtime, size and a hash of its contents */
+struct file_key {
+    int64_t  mtime;
+    uint64_t size;
+    uint64_t hash;
+};
+
+static int file_key(const char *path, struct file_key *key, bool hash) {
+    struct stat st;
+    FILE *fp;
+    char buf[BUFSIZ];
+    size_t n;
+
+    if (stat(path, &st) < 0 || !S_ISREG(st.st_mode))
+        return -1;
+    key->mtime = st.st_mtime;
+    key->size = st.st_size;
+    key->hash = FNV_INIT;
+    if (! hash)
+        return 0;
+
+    fp = fopen(path, "r");
+    if (fp == NULL)
+        return -1;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+        key->hash = fnv_hash(key->hash, buf, n);
+    if (ferror(fp)) {
+        fclose(fp);
+        return -1;
+    }
+    fclose(fp);
+    return 0;
+}
+
+/* A dependency is current if its size did not change, and either its
+ * mtime or the hash of its contents are the same as recorded */
+static bool file_current(const char *path, const struct file_key *key) {
+    struct file_key cur;
+
+    if (file_key(path, &cur, false) < 0)
+        return false;
+    if (cur.size != key->size)
+        return false;
+    if (cur.mtime == key->mtime)
+        return true;
+    if (file_key(path, &cur, true) < 0)
+        return false;
+    return cur.hash == key->hash;
+}
+
+static char *cache_filename(struct augeas *aug, const char *filename) {
+    const char *base = strrchr(filename, SEP);
+    char *result = NULL;
+
+    base = (base == NULL) ? filename : base + 1;
+    if (pathjoin(&result, 2, aug->lens_cache, base) < 0)
+        return NULL;
+    if (REALLOC_N(result, strlen(result) + strlen(CACHE_EXT) + 1) < 0) {
+        free(result);
+        return NULL;
+    }
+    strcat(result, CACHE_EXT);
+    return result;
+}
+
+static bool binding_cacheable(struct binding *b) {
+    if (b->type->tag == T_ARROW || b->value == NULL)
+        return false;
+    switch(b->value->tag) {
+    case V_STRING:
+    case V_REGEXP:
+    case V_LENS:
+    case V_FILTER:
+    case V_TRANSFORM:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/*
+ * Tables mapping objects to their position in the cache file
+ */
+struct objtab {
+    hash_t  *index;        /* object -> position + 1 */
+    size_t   size;
+    void   **objs;
+};
+
+static int ptr_cmp(const void *p1, const void *p2) {
+    return p1 != p2;
+}
+
+static hash_val_t ptr_hash(const void *p) {
+    return (hash_val_t) (((uintptr_t) p >> 3) * UINT64_C(0x9e3779b97f4a7c15));
+}
+
+/* Add OBJ to TAB. Return 1 if OBJ was added, 0 if it was already in TAB,
+ * and -1 on allocation failure */
+static int objtab_add(struct objtab *tab, void *obj) {
+    if (tab->index == NULL) {
+        tab->index = hash_create(HASHCOUNT_T_MAX, ptr_cmp, ptr_hash);
+        if (tab->index == NULL)
+            return -1;
+    }
+    if (hash_lookup(tab->index, obj) != NULL)
+        return 0;
+    if (REALLOC_N(tab->objs, tab->size + 1) < 0)
+        return -1;
+    tab->objs[tab->size] = obj;
+    tab->size += 1;
+    if (hash_alloc_insert(tab->index, obj,
+                          (void *) (uintptr_t) tab->size) < 0)
+        return -1;
+    return 1;
+}
+
+static uint32_t objtab_pos(struct objtab *tab, const void *obj) {
+    hnode_t *node;
+
+    if (obj == NULL)
+        return NIL;
+    node = hash_lookup(tab->index, obj);
+    assert(node != NULL);
+    return (uint32_t) ((uintptr_t) hnode_get(node) - 1);
+}
+
+static void objtab_free(struct objtab *tab) {
+    if (tab->index != NULL) {
+        hash_free_nodes(tab->index);
+        hash_destroy(tab->index);
+    }
+    free(tab->objs);
+}
+
+/*
+ * Writing the cache
+ */
+struct writer {
+    FILE          *fp;
+    uint64_t       sum;
+    bool           error;
+    struct objtab  strings;
+    struct objtab  infos;
+    struct objtab  regexps;
+    struct objtab  lenses;
+};
+
+static void put_bytes(struct writer *w, const void *buf, size_t len) {
+    if (w->error)
+        return;
+    if (fwrite(buf, 1, len, w->fp) != len)
+        w->error = true;
+    w->sum = fnv_hash(w->sum, buf, len);
+}
+
+static void put_u32(struct writer *w, uint32_t v) {
+    put_bytes(w, &v, sizeof(v));
+}
+
+static void put_u64(struct writer *w, uint64_t v) {
+    put_bytes(w, &v, sizeof(v));
+}
+
+static void put_str(struct writer *w, const char *s) {
+    if (s == NULL) {
+        put_u32(w, NIL);
+    } else {
+        uint32_t len = strlen(s);
+        put_u32(w, len);
+        put_bytes(w, s, len);
+    }
+}
+
+static int collect_string(struct writer *w, struct string *s) {
+    if (s == NULL)
+        return 0;
+    return objtab_add(&w->strings, s) < 0 ? -1 : 0;
+}
+
+static int collect_info(struct writer *w, struct info *info) {
+    int r;
+
+    if (info == NULL)
+        return 0;
+    r = objtab_add(&w->infos, info);
+    if (r <= 0)
+        return r;
+    return collect_string(w, info->filename);
+}
+
+static int collect_regexp(struct writer *w, struct regexp *re) {
+    int r;
+
+    if (re == NULL)
+        return 0;
+    r = objtab_add(&w->regexps, re);
+    if (r <= 0)
+        return r;
+    if (collect_info(w, re->info) < 0)
+        return -1;
+    return collect_string(w, re->pattern);
+}
+
+static int collect_lens(struct writer *w, struct lens *lens) {
+    int r;
+
+    if (lens == NULL)
+        return 0;
+    r = objtab_add(&w->lenses, lens);
+    if (r <= 0)
+        return r;
+
+    if (collect_info(w, lens->info) < 0
+        || collect_regexp(w, lens->ctype) < 0
+        || collect_regexp(w, lens->atype) < 0
+        || collect_regexp(w, lens->ktype) < 0
+        || collect_regexp(w, lens->vtype) < 0)
+        return -1;
+
+    switch (lens->tag) {
+    case L_DEL:
+        if (collect_string(w, lens->string) < 0)
+            return -1;
+        /* fall through */
+    case L_STORE:
+    case L_KEY:
+        return collect_regexp(w, lens->regexp);
+    case L_LABEL:
+    case L_SEQ:
+    case L_COUNTER:
+    case L_VALUE:
+        return collect_string(w, lens->string);
+    case L_SUBTREE:
+    case L_STAR:
+    case L_MAYBE:
+    case L_SQUARE:
+        return collect_lens(w, lens->child);
+    case L_CONCAT:
+    case L_UNION:
+        for (int i=0; i < lens->nchildren; i++)
+            if (collect_lens(w, lens->children[i]) < 0)
+                return -1;
+        return 0;
+    case L_REC:
+        if (collect_lens(w, lens->body) < 0)
+            return -1;
+        return collect_lens(w, lens->alias);
+    default:
+        return -1;
+    }
+}
+
+static int collect_filter(struct writer *w, struct filter *filter) {
+    list_for_each(f, filter) {
+        if (collect_string(w, f->glob) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+static int collect_binding(struct writer *w, struct binding *b) {
+    struct value *v = b->value;
+
+    if (collect_info(w, v->info) < 0)
+        return -1;
+    switch(v->tag) {
+    case V_STRING:
+        return collect_string(w, v->string);
+    case V_REGEXP:
+        return collect_regexp(w, v->regexp);
+    case V_LENS:
+        return collect_lens(w, v->lens);
+    case V_FILTER:
+        return collect_filter(w, v->filter);
+    case V_TRANSFORM:
+        if (collect_lens(w, v->transform->lens) < 0)
+            return -1;
+        return collect_filter(w, v->transform->filter);
+    default:
+        return -1;
+    }
+}
+
+#define put_ref(w, tab, obj) put_u32(w, objtab_pos(&(w)->tab, obj))
+
+static void put_info(struct writer *w, struct info *info) {
+    put_ref(w, strings, info->filename);
+    put_u32(w, info->first_line);
+    put_u32(w, info->first_column);
+    put_u32(w, info->last_line);
+    put_u32(w, info->last_column);
+}
+
+static void put_regexp(struct writer *w, struct regexp *re) {
+    put_ref(w, infos, re->info);
+    put_ref(w, strings, re->pattern);
+    put_u32(w, re->nocase);
+}
+
+static void put_lens(struct writer *w, struct lens *lens) {
+    uint32_t flags = lens->value
+        | lens->key << 1
+        | lens->recursive << 2
+        | lens->consumes_value << 3
+        | lens->rec_internal << 4
+        | lens->ctype_nullable << 5;
+
+    put_u32(w, lens->tag);
+    put_u32(w, flags);
+    put_ref(w, infos, lens->info);
+    put_ref(w, regexps, lens->ctype);
+    put_ref(w, regexps, lens->atype);
+    put_ref(w, regexps, lens->ktype);
+    put_ref(w, regexps, lens->vtype);
+
+    switch (lens->tag) {
+    case L_DEL:
+        put_ref(w, regexps, lens->regexp);
+        put_ref(w, strings, lens->string);
+        break;
+    case L_STORE:
+    case L_KEY:
+        put_ref(w, regexps, lens->regexp);
+        break;
+    case L_LABEL:
+    case L_SEQ:
+    case L_COUNTER:
+    case L_VALUE:
+        put_ref(w, strings, lens->string);
+        break;
+    case L_SUBTREE:
+    case L_STAR:
+    case L_MAYBE:
+    case L_SQUARE:
+        put_ref(w, lenses, lens->child);
+        break;
+    case L_CONCAT:
+    case L_UNION:
+        put_u32(w, lens->nchildren);
+        for (int i=0; i < lens->nchildren; i++)
+            put_ref(w, lenses, lens->children[i]);
+        break;
+    case L_REC:
+        put_ref(w, lenses, lens->body);
+        put_ref(w, lenses, lens->alias);
+        break;
+    default:
+        w->error = true;
+        break;
+    }
+}
+
+static void put_filter(struct writer *w, struct filter *filter) {
+    uint32_t n = 0;
+
+    list_for_each(f, filter)
+        n += 1;
+    put_u32(w, n);
+    list_for_each(f, filter) {
+        put_ref(w, strings, f->glob);
+        put_u32(w, f->include);
+    }
+}
+
+static void put_binding(struct writer *w, struct binding *b) {
+    struct value *v = b->value;
+
+    put_str(w, b->ident->str);
+    put_u32(w, b->type->tag);
+    put_u32(w, v->tag);
+    put_ref(w, infos, v->info);
+    switch(v->tag) {
+    case V_STRING:
+        put_ref(w, strings, v->string);
+        break;
+    case V_REGEXP:
+        put_ref(w, regexps, v->regexp);
+        break;
+    case V_LENS:
+        put_ref(w, lenses, v->lens);
+        break;
+    case V_FILTER:
+        put_filter(w, v->filter);
+        break;
+    case V_TRANSFORM:
+        put_ref(w, lenses, v->transform->lens);
+        put_filter(w, v->transform->filter);
+        break;
+    default:
+        w->error = true;
+        break;
+    }
+}
+
+/* Collect the names of all module files that contributed to the objects
+ * in W into DEPS; FILENAME is always the first entry */
+static int collect_deps(struct writer *w, const char *filename,
+                        const char ***deps, size_t *ndeps) {
+    size_t ext_len = strlen(AUG_EXT);
+
+    if (ALLOC_N(*deps, w->strings.size + 1) < 0)
+        return -1;
+    (*deps)[0] = filename;
+    *ndeps = 1;
+
+    for (int i=0; i < w->infos.size; i++) {
+        struct info *info = w->infos.objs[i];
+        const char *fname;
+        size_t len;
+        bool seen = false;
+
+        if (info->filename == NULL)
+            continue;
+        fname = info->filename->str;
+        len = strlen(fname);
+        if (len < ext_len || STRNEQ(fname + len - ext_len, AUG_EXT))
+            continue;
+        for (int j=0; j < *ndeps && !seen; j++)
+            seen = STREQ((*deps)[j], fname);
+        if (! seen) {
+            (*deps)[*ndeps] = fname;
+            *ndeps += 1;
+        }
+    }
+    return 0;
+}
+
+void lens_cache_store(struct augeas *aug, const char *filename,
+                      struct module *module) {
+    struct writer w;
+    const char **deps = NULL;
+    size_t ndeps = 0;
+    const char *autoload = NULL;
+    char *cname = NULL, *tmpname = NULL;
+    uint32_t nbindings = 0;
+    bool complete = true;
+    int fd = -1, r;
+
+    if (aug->lens_cache == NULL)
+        return;
+
+    MEMZERO(&w, 1);
+    w.sum = FNV_INIT;
+
+    list_for_each(b, module->bindings) {
+        if (! binding_cacheable(b)) {
+            complete = false;
+            continue;
+        }
+        if (module->autoload != NULL && b->value->tag == V_TRANSFORM
+            && b->value->transform == module->autoload)
+            autoload = b->ident->str;
+        if (collect_binding(&w, b) < 0)
+            goto done;
+        nbindings += 1;
+    }
+    if (module->autoload != NULL && autoload == NULL)
+        goto done;
+
+    if (collect_deps(&w, filename, &deps, &ndeps) < 0)
+        goto done;
+
+    cname = cache_filename(aug, filename);
+    if (cname == NULL)
+        goto done;
+    r = xasprintf(&tmpname, "%s.XXXXXX", cname);
+    if (r < 0) {
+        tmpname = NULL;
+        goto done;
+    }
+    fd = mkstemp(tmpname);
+    if (fd < 0)
+        goto done;
+    w.fp = fdopen(fd, "w");
+    if (w.fp == NULL)
+        goto done;
+    fd = -1;
+
+    put_bytes(&w, cache_magic, sizeof(cache_magic));
+    put_u32(&w, CACHE_VERSION);
+    put_u32(&w, CACHE_BOM);
+    put_str(&w, PACKAGE_VERSION);
+    put_u32(&w, (aug->flags & AUG_TYPE_CHECK) ? 1 : 0);
+
+    put_u32(&w, ndeps);
+    for (int i=0; i < ndeps; i++) {
+        struct file_key key;
+        if (file_key(deps[i], &key, true) < 0)
+            goto done;
+        put_str(&w, deps[i]);
+        put_u64(&w, key.mtime);
+        put_u64(&w, key.size);
+        put_u64(&w, key.hash);
+    }
+
+    put_str(&w, module->name);
+    put_str(&w, autoload);
+    put_u32(&w, complete);
+
+    put_u32(&w, w.strings.size);
+    for (int i=0; i < w.strings.size; i++)
+        put_str(&w, ((struct string *) w.strings.objs[i])->str);
+    put_u32(&w, w.infos.size);
+    for (int i=0; i < w.infos.size; i++)
+        put_info(&w, w.infos.objs[i]);
+    put_u32(&w, w.regexps.size);
+    for (int i=0; i < w.regexps.size; i++)
+        put_regexp(&w, w.regexps.objs[i]);
+    put_u32(&w, w.lenses.size);
+    for (int i=0; i < w.lenses.size; i++)
+        put_lens(&w, w.lenses.objs[i]);
+
+    put_u32(&w, nbindings);
+    list_for_each(b, module->bindings) {
+        if (binding_cacheable(b))
+            put_binding(&w, b);
+    }
+    put_u64(&w, w.sum);
+
+    r = fclose(w.fp);
+    w.fp = NULL;
+    if (r != 0 || w.error)
+        goto done;
+
+    if (rename(tmpname, cname) == 0)
+        FREE(tmpname);
+ done:
+    if (w.fp != NULL)
+        fclose(w.fp);
+    if (fd >= 0)
+        close(fd);
+    if (tmpname != NULL)
+        unlink(tmpname);
+    free(tmpname);
+    free(cname);
+    free(deps);
+    objtab_free(&w.strings);
+    objtab_free(&w.infos);
+    objtab_free(&w.regexps);
+    objtab_free(&w.lenses);
+}
+
+/*
+ * Reading the cache
+ */
+struct reader {
+    FILE           *fp;
+    uint64_t        sum;
+    bool            error;
+    struct error   *err;
+    uint32_t        nstrings;
+    struct string **strings;
+    uint32_t        ninfos;
+    struct info   **infos;
+    uint32_t        nregexps;
+    struct regexp **regexps;
+    uint32_t        nlenses;
+    struct lens   **lenses;
+};
+
+static void get_bytes(struct reader *r, void *buf, size_t len) {
+    if (r->error || fread(buf, 1, len, r->fp) != len) {
+        r->error = true;
+        memset(buf, 0, len);
+        return;
+    }
+    r->sum = fnv_hash(r->sum, buf, len);
+}
+
+static uint32_t get_u32(struct reader *r) {
+    uint32_t v;
+    get_bytes(r, &v, sizeof(v));
+    return v;
+}
+
+static uint64_t get_u64(struct reader *r) {
+    uint64_t v;
+    get_bytes(r, &v, sizeof(v));
+    return v;
+}
+
+static char *get_str(struct reader *r) {
+    uint32_t len = get_u32(r);
+    char *s = NULL;
+
+    if (r->error || len == NIL)
+        return NULL;
+    if (len > CACHE_MAX_LEN || ALLOC_N(s, len + 1) < 0) {
+        r->error = true;
+        return NULL;
+    }
+    get_bytes(r, s, len);
+    if (r->error || memchr(s, '\0', len) != NULL) {
+        r->error = true;
+        FREE(s);
+    }
+    return s;
+}
+
+/* Read a table size; the table itself is allocated by the caller */
+static uint32_t get_count(struct reader *r) {
+    uint32_t n = get_u32(r);
+    if (n > CACHE_MAX_LEN) {
+        r->error = true;
+        return 0;
+    }
+    return n;
+}
+
+/* Read the index of an object in a table with N entries. NIL is only
+ * allowed if NULLABLE */
+static uint32_t get_index(struct reader *r, uint32_t n, bool nullable) {
+    uint32_t i = get_u32(r);
+
+    if (r->error)
+        return NIL;
+    if ((i == NIL && !nullable) || (i != NIL && i >= n)) {
+        r->error = true;
+        return NIL;
+    }
+    return i;
+}
+
+/* Read references to objects; the reference count of the object is
+ * incremented for the reference */
+static struct string *get_string_ref(struct reader *r, bool nullable) {
+    uint32_t i = get_index(r, r->nstrings, nullable);
+    return (i == NIL) ? NULL : ref(r->strings[i]);
+}
+
+static struct info *get_info_ref(struct reader *r) {
+    uint32_t i = get_index(r, r->ninfos, true);
+    return (i == NIL) ? NULL : ref(r->infos[i]);
+}
+
+static struct regexp *get_regexp_ref(struct reader *r, bool nullable) {
+    uint32_t i = get_index(r, r->nregexps, nullable);
+    return (i == NIL) ? NULL : ref(r->regexps[i]);
+}
+
+static struct lens *get_lens_ref(struct reader *r, bool nullable) {
+    uint32_t i = get_index(r, r->nlenses, nullable);
+    return (i == NIL) ? NULL : ref(r->lenses[i]);
+}
+
+/* Like get_lens_ref, but for references that are not counted */
+static struct lens *get_lens_weak(struct reader *r) {
+    uint32_t i = get_index(r, r->nlenses, true);
+    return (i == NIL) ? NULL : r->lenses[i];
+}
+
+static void read_strings(struct reader *r) {
+    r->nstrings = get_count(r);
+    if (ALLOC_N(r->strings, r->nstrings) < 0) {
+        r->error = true;
+        return;
+    }
+    for (int i=0; i < r->nstrings && !r->error; i++) {
+        char *s = get_str(r);
+        if (r->error)
+            break;
+        r->strings[i] = (s == NULL) ? NULL : make_string(s);
+        if (s == NULL || r->strings[i] == NULL) {
+            free(s);
+            r->error = true;
+        }
+    }
+}
+
+static void read_infos(struct reader *r) {
+    r->ninfos = get_count(r);
+    if (ALLOC_N(r->infos, r->ninfos) < 0) {
+        r->error = true;
+        return;
+    }
+    for (int i=0; i < r->ninfos && !r->error; i++) {
+        struct info *info;
+        if (make_ref(info) < 0) {
+            r->error = true;
+            break;
+        }
+        r->infos[i] = info;
+        info->error = r->err;
+        info->filename = get_string_ref(r, true);
+        info->first_line = get_u32(r);
+        info->first_column = get_u32(r);
+        info->last_line = get_u32(r);
+        info->last_column = get_u32(r);
+    }
+}
+
+static void read_regexps(struct reader *r) {
+    r->nregexps = get_count(r);
+    if (ALLOC_N(r->regexps, r->nregexps) < 0) {
+        r->error = true;
+        return;
+    }
+    for (int i=0; i < r->nregexps && !r->error; i++) {
+        struct regexp *re;
+        if (make_ref(re) < 0) {
+            r->error = true;
+            break;
+        }
+        r->regexps[i] = re;
+        re->info = get_info_ref(r);
+        re->pattern = get_string_ref(r, false);
+        re->nocase = get_u32(r) ? 1 : 0;
+    }
+}
+
+static void read_lens(struct reader *r, struct lens *lens) {
+    uint32_t tag = get_u32(r);
+    uint32_t flags = get_u32(r);
+
+    if (tag < L_DEL || tag > L_SQUARE) {
+        r->error = true;
+        return;
+    }
+    lens->tag = tag;
+    lens->value = flags & 1;
+    lens->key = (flags >> 1) & 1;
+    lens->recursive = (flags >> 2) & 1;
+    lens->consumes_value = (flags >> 3) & 1;
+    lens->rec_internal = (flags >> 4) & 1;
+    lens->ctype_nullable = (flags >> 5) & 1;
+    lens->info = get_info_ref(r);
+    lens->ctype = get_regexp_ref(r, true);
+    lens->atype = get_regexp_ref(r, true);
+    lens->ktype = get_regexp_ref(r, true);
+    lens->vtype = get_regexp_ref(r, true);
+
+    switch (lens->tag) {
+    case L_DEL:
+        lens->regexp = get_regexp_ref(r, false);
+        lens->string = get_string_ref(r, true);
+        break;
+    case L_STORE:
+    case L_KEY:
+        lens->regexp = get_regexp_ref(r, false);
+        break;
+    case L_LABEL:
+    case L_SEQ:
+    case L_COUNTER:
+    case L_VALUE:
+        lens->string = get_string_ref(r, true);
+        break;
+    case L_SUBTREE:
+    case L_STAR:
+    case L_MAYBE:
+    case L_SQUARE:
+        lens->child = get_lens_ref(r, false);
+        break;
+    case L_CONCAT:
+    case L_UNION: {
+        uint32_t n = get_count(r);
+        struct lens **children = NULL;
+        if (r->error || n == 0 || ALLOC_N(children, n) < 0) {
+            r->error = true;
+            break;
+        }
+        lens->children = children;
+        lens->nchildren = n;
+        for (int i=0; i < n && !r->error; i++)
+            lens->children[i] = get_lens_ref(r, false);
+        break;
+    }
+    case L_REC:
+        /* ALIAS is never reference counted, and BODY is only owned by the
+         * lens that is not rec_internal, see lns_check_rec */
+        if (lens->rec_internal)
+            lens->body = get_lens_weak(r);
+        else
+            lens->body = get_lens_ref(r, true);
+        lens->alias = get_lens_weak(r);
+        break;
+    default:
+        r->error = true;
+        break;
+    }
+}
+
+static void read_lenses(struct reader *r) {
+    r->nlenses = get_count(r);
+    if (ALLOC_N(r->lenses, r->nlenses) < 0) {
+        r->error = true;
+        return;
+    }
+    /* Lenses can refer to lenses later in the table; allocate all of
+     * them first. L_DEL is a placeholder that is safe to free */
+    for (int i=0; i < r->nlenses && !r->error; i++) {
+        if (make_ref(r->lenses[i]) < 0)
+            r->error = true;
+        else
+            r->lenses[i]->tag = L_DEL;
+    }
+    for (int i=0; i < r->nlenses && !r->error; i++)
+        read_lens(r, r->lenses[i]);
+}
+
+static struct filter *read_filter(struct reader *r) {
+    uint32_t n = get_count(r);
+    struct filter *result = NULL, *last = NULL;
+
+    for (int i=0; i < n && !r->error; i++) {
+        struct string *glob = get_string_ref(r, false);
+        unsigned int include = get_u32(r) ? 1 : 0;
+        struct filter *f = r->error ? NULL : make_filter(glob, include);
+        if (f == NULL) {
+            unref(glob, string);
+            r->error = true;
+            break;
+        }
+        if (last == NULL)
+            result = f;
+        else
+            last->next = f;
+        last = f;
+    }
+    return result;
+}
+
+static struct binding *read_binding(struct reader *r) {
+    struct binding *b = NULL;
+    struct value *v = NULL;
+    char *ident = get_str(r);
+    uint32_t ttag = get_u32(r);
+    uint32_t vtag = get_u32(r);
+
+    if (r->error || ident == NULL || ttag >= T_UNIT || ttag == T_ARROW)
+        goto error;
+
+    v = make_value(vtag, get_info_ref(r));
+    if (v == NULL)
+        goto error;
+    switch(vtag) {
+    case V_STRING:
+        v->string = get_string_ref(r, false);
+        break;
+    case V_REGEXP:
+        v->regexp = get_regexp_ref(r, false);
+        break;
+    case V_LENS:
+        v->lens = get_lens_ref(r, false);
+        break;
+    case V_FILTER:
+        v->filter = read_filter(r);
+        break;
+    case V_TRANSFORM: {
+        struct lens *lens = get_lens_ref(r, false);
+        struct filter *filter = read_filter(r);
+        v->transform = r->error ? NULL : make_transform(lens, filter);
+        if (v->transform == NULL) {
+            unref(lens, lens);
+            unref(filter, filter);
+        }
+        break;
+    }
+    default:
+        /* Make sure free_value does not try to free anything */
+        v->tag = V_UNIT;
+        goto error;
+    }
+    if (r->error)
+        goto error;
+
+    if (make_ref(b) < 0)
+        goto error;
+    b->ident = make_string(ident);
+    if (b->ident == NULL)
+        goto error;
+    ident = NULL;
+    b->type = make_base_type(ttag);
+    b->value = v;
+    return b;
+ error:
+    r->error = true;
+    free(ident);
+    unref(v, value);
+    free(b);
+    return NULL;
+}
+
+/* Drop the references held by the object tables */
+static void reader_release(struct reader *r) {
+    for (int i=0; i < r->nlenses; i++)
+        unref(r->lenses[i], lens);
+    for (int i=0; i < r->nregexps; i++)
+        unref(r->regexps[i], regexp);
+    for (int i=0; i < r->ninfos; i++)
+        unref(r->infos[i], info);
+    for (int i=0; i < r->nstrings; i++)
+        unref(r->strings[i], string);
+    free(r->lenses);
+    free(r->regexps);
+    free(r->infos);
+    free(r->strings);
+}
+
+/* Check the header and dependencies of the cache file; return true if the
+ * cache entry can be used for FILENAME */
+static bool read_header(struct augeas *aug, struct reader *r,
+                        const char *filename) {
+    char magic[sizeof(cache_magic)];
+    char *version = NULL;
+    uint32_t ndeps;
+    bool current = true;
+
+    get_bytes(r, magic, sizeof(magic));
+    if (r->error || memcmp(magic, cache_magic, sizeof(magic)) != 0)
+        return false;
+    if (get_u32(r) != CACHE_VERSION || get_u32(r) != CACHE_BOM)
+        return false;
+    version = get_str(r);
+    current = version != NULL && STREQ(version, PACKAGE_VERSION);
+    free(version);
+    /* An entry compiled without typechecking is not good enough when
+     * we are asked to typecheck */
+    if (get_u32(r) == 0 && (aug->flags & AUG_TYPE_CHECK))
+        current = false;
+
+    ndeps = get_count(r);
+    for (int i=0; i < ndeps && current && !r->error; i++) {
+        char *path = get_str(r);
+        struct file_key key;
+
+        key.mtime = get_u64(r);
+        key.size = get_u64(r);
+        key.hash = get_u64(r);
+        current = path != NULL && !r->error
+            && (i > 0 || STREQ(path, filename))
+            && file_current(path, &key);
+        free(path);
+    }
+    return current && !r->error;
+}
+
+int lens_cache_load(struct augeas *aug, const char *filename,
+                    struct module **module) {
+    struct reader r;
+    struct module *modl = NULL;
+    struct binding *last = NULL;
+    char *cname = NULL, *name = NULL, *autoload = NULL;
+    uint32_t nbindings;
+    uint64_t sum;
+    bool complete;
+    int result = 0;
+
+    *module = NULL;
+    if (aug->lens_cache == NULL)
+        return 0;
+
+    MEMZERO(&r, 1);
+    r.sum = FNV_INIT;
+    r.err = aug->error;
+
+    cname = cache_filename(aug, filename);
+    ERR_NOMEM(cname == NULL, aug);
+
+    r.fp = fopen(cname, "r");
+    if (r.fp == NULL)
+        goto done;
+
+    if (! read_header(aug, &r, filename))
+        goto done;
+
+    name = get_str(&r);
+    autoload = get_str(&r);
+    complete = get_u32(&r) != 0;
+    if (r.error || name == NULL)
+        goto done;
+
+    read_strings(&r);
+    read_infos(&r);
+    read_regexps(&r);
+    read_lenses(&r);
+    if (r.error)
+        goto done;
+
+    modl = module_create(name);
+    ERR_NOMEM(modl == NULL || modl->name == NULL, aug);
+    modl->cached = !complete;
+
+    nbindings = get_count(&r);
+    for (int i=0; i < nbindings && !r.error; i++) {
+        struct binding *b = read_binding(&r);
+        if (b == NULL)
+            break;
+        if (last == NULL)
+            modl->bindings = b;
+        else
+            last->next = b;
+        last = b;
+        if (autoload != NULL && b->value->tag == V_TRANSFORM
+            && STREQ(b->ident->str, autoload))
+            modl->autoload = ref(b->value->transform);
+    }
+    if (r.error || (autoload != NULL && modl->autoload == NULL))
+        goto done;
+
+    sum = r.sum;
+    if (get_u64(&r) != sum || r.error || fgetc(r.fp) != EOF)
+        goto done;
+
+    *module = modl;
+    modl = NULL;
+    result = 1;
+ done:
+    if (r.fp != NULL)
+        fclose(r.fp);
+    reader_release(&r);
+    unref(modl, module);
+    free(name);
+    free(autoload);
+    free(cname);
+    return result;
+ error:
+    result = -1;
+    goto done;
+}
+
+/*
+ * Local variables:
+ *  indent-tabs-mode: nil
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  tab-width: 4
+ * End:
+ */
@@ -0,0 +1,63 @@
+/*
+ * lenscache.h: on-disk cache of compiled modules
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#ifndef LENSCACHE_H_
+#define LENSCACHE_H_
+
+/*
+ * The lens cache stores the result of compiling a module, i.e. its
+ * bindings of strings, regexps, lenses, filters and transforms together
+ * with their types, in a binary file in the directory AUG->LENS_CACHE.
+ * Functions can not be stored; a module restored from the cache that had
+ * function bindings is marked as CACHED, and is compiled from source
+ * when one of its functions is needed.
+ *
+ * Each cache entry records the path, mtime, size and a hash of every
+ * module file that contributed to it. An entry is only used if all of
+ * these files are unchanged; a changed mtime alone is not enough to
+ * invalidate an entry if the contents of the file hash to the same
+ * value.
+ */
+
+/* Try to restore the module compiled from FILENAME from the cache. On a
+ * cache hit, set *MODULE to the restored module and return 1. Return 0
+ * if there is no usable cache entry, and -1 if an error was reported
+ * in AUG.
+ */
+int lens_cache_load(struct augeas *aug, const char *filename,
+                    struct module **module);
+
+/* Write MODULE, compiled from FILENAME, to the cache. Failures to write
+ * the cache are not considered errors, and silently ignored.
+ */
+void lens_cache_store(struct augeas *aug, const char *filename,
+                      struct module *module);
+
+#endif
+
+
+/*
+ * Local variables:
+ *  indent-tabs-mode: nil
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  tab-width: 4
+ * End:
+ */
@@ -30,6 +30,7 @@
 #include "ref.h"
 #include "regexp.h"
 #include "errcode.h"
+#include "hash.h"
 
 static const char *const errcodes[] = {
     "no error",
@@ -94,6 +95,10 @@ enum binary_op {
 struct pred {
     int               nexpr;
     struct expr     **exprs;
+    /* The first NINDEP exprs do not depend on the position of the context
+     * node in its nodeset, and can be evaluated as soon as a step
+     * produces a node */
+    int               nindep;
 };
 
 enum axis {
@@ -151,6 +156,7 @@ static struct tree *step_root(struct step *step, struct tree *ctx,
 static struct tree *step_first(struct step *step, struct tree *ctx);
 static struct tree *step_next(struct step *step, struct tree *ctx,
                               struct tree *node);
+static bool step_matches(struct step *step, struct tree *tree);
 
 struct pathx_symtab {
     struct pathx_symtab *next;
@@ -163,6 +169,51 @@ struct pathx {
     struct nodeset *nodeset;
     int             node;
     struct tree    *origin;
+    /* The remaining fields are only used while the path expression is
+     * kept in a struct pathx_cache */
+    struct pathx_cache *cache;
+    char           *txt;        /* Our own copy of the expression */
+    hnode_t         hnode;
+    struct pathx   *prev;       /* Neighbors in the LRU list */
+    struct pathx   *next;
+    bool            busy;       /* Handed out, and not freed yet */
+};
+
+/* The number of path expressions a struct pathx_cache keeps */
+#define PATHX_CACHE_SIZE 1024
+
+/* The highest parameter $N that a path expression can use */
+#define PATHX_MAX_PARAM 1024
+
+/* The number of regexps a struct pathx_cache keeps; when it has that
+ * many, we drop them all and start over */
+#define PATHX_REGEXP_CACHE_SIZE 64
+
+/* A regexp made by regexp() or glob() from a string or nodeset that was
+ * only known while evaluating. It is kept under the pattern PAT, which is
+ * LEN bytes long, and the arguments it was made with. For nodesets, PAT
+ * has the values of the nodes, each followed by a NUL byte */
+struct pathx_regexp {
+    hnode_t        hnode;
+    char          *pat;
+    size_t         len;
+    bool           nodeset;
+    int            glob;
+    int            nocase;
+    struct regexp *regexp;
+};
+
+/* Parsed and typechecked path expressions, indexed by their text. The
+ * expressions are also on a list with the most recently used one first,
+ * so that we can drop the least recently used one when the cache is
+ * full */
+struct pathx_cache {
+    hash_t        *entries;
+    struct pathx  *first;
+    struct pathx  *last;
+    unsigned long  hits;
+    unsigned long  misses;
+    hash_t        *regexps;   /* struct pathx_regexp, keyed by themselves */
 };
 
 #define L_BRACK '['
@@ -172,10 +223,15 @@ struct locpath {
     struct step *steps;
 };
 
+/* Nodesets with more than this many nodes keep a hash of their nodes, so
+ * that ns_add can find duplicates without looking at every node */
+#define NS_HASH_MIN 32
+
 struct nodeset {
     struct tree **nodes;
     size_t        used;
     size_t        size;
+    hash_t       *hash;   /* The nodes as keys, or NULL */
 };
 
 typedef uint32_t value_ind_t;
@@ -246,6 +302,9 @@ struct state {
     struct value  *value_pool;
     value_ind_t    value_pool_used;
     value_ind_t    value_pool_size;
+    /* The number of values made while parsing, i.e. the literals in the
+       expression; pathx_reuse drops all the others */
+    value_ind_t    value_pool_parsed;
     /* Stack of values (as indices into value_pool), with bottom of
        stack in values[0] */
     value_ind_t   *values;
@@ -261,6 +320,14 @@ struct state {
     struct locpath_trace *locpath_trace;
     /* Symbol table for variable lookups */
     struct pathx_symtab *symtab;
+    /* The strings bound to the parameters $1, $2, ... with pathx_bind,
+     * as indices into VALUE_POOL, or 0 if a parameter is not bound. They
+     * live with the literals, so that evaluating a parameter does not
+     * need to copy its value */
+    value_ind_t   *params;
+    int            nparams;  /* The highest parameter in TXT */
+    /* Where regexp() and glob() keep the regexps they make, or NULL */
+    struct pathx_cache *rx_cache;
     /* Error structure, used to communicate errors to struct augeas;
      * we never own this structure, and therefore never free it */
     struct error        *error;
@@ -433,8 +500,17 @@ static void free_expr(struct expr *expr) {
     free(expr);
 }
 
+static void ns_drop_hash(struct nodeset *ns) {
+    if (ns->hash != NULL) {
+        hash_free_nodes(ns->hash);
+        hash_destroy(ns->hash);
+        ns->hash = NULL;
+    }
+}
+
 static void free_nodeset(struct nodeset *ns) {
     if (ns != NULL) {
+        ns_drop_hash(ns);
         free(ns->nodes);
         free(ns);
     }
@@ -475,13 +551,37 @@ static void free_state(struct state *state) {
         release_value(state->value_pool + i);
     free(state->value_pool);
     free(state->values);
+    free(state->params);
     free(state);
 }
 
+/* Forget everything from evaluating PATHX, so that it can be evaluated
+ * again */
+static void reset_pathx(struct pathx *pathx) {
+    struct state *state = pathx->state;
+
+    for (value_ind_t i = state->value_pool_parsed;
+         i < state->value_pool_used; i++)
+        release_value(state->value_pool + i);
+    state->value_pool_used = state->value_pool_parsed;
+    state->values_used = 0;
+    state->errcode = PATHX_NOERROR;
+    FREE(state->errmsg);
+    pathx->nodeset = NULL;
+    pathx->node = 0;
+}
+
 void free_pathx(struct pathx *pathx) {
     if (pathx == NULL)
         return;
+    if (pathx->cache != NULL) {
+        /* The cache still owns PATHX */
+        reset_pathx(pathx);
+        pathx->busy = false;
+        return;
+    }
     free_state(pathx->state);
+    free(pathx->txt);
     free(pathx);
 }
 
@@ -495,18 +595,59 @@ static struct nodeset *make_nodeset(struct state *state) {
     return result;
 }
 
+/* Nodes are aligned and allocated close together, so that their addresses
+ * differ mostly in the middle bits; spread those out */
+static hash_val_t ns_node_hash(const void *node) {
+    return (hash_val_t) (((uint64_t) (uintptr_t) node
+                          * UINT64_C(0x9e3779b97f4a7c15)) >> 32);
+}
+
+static int ns_node_cmp(const void *node1, const void *node2) {
+    return node1 != node2;
+}
+
+static int ns_make_hash(struct nodeset *ns) {
+    ns->hash = hash_create(HASHCOUNT_T_MAX, ns_node_cmp, ns_node_hash);
+    if (ns->hash == NULL)
+        return -1;
+    for (int i=0; i < ns->used; i++) {
+        if (hash_alloc_insert(ns->hash, ns->nodes[i], NULL) < 0) {
+            ns_drop_hash(ns);
+            return -1;
+        }
+    }
+    return 0;
+}
+
 static void ns_add(struct nodeset *ns, struct tree *node,
                    struct state *state) {
-    for (int i=0; i < ns->used; i++)
-        if (ns->nodes[i] == node)
+    if (ns->hash == NULL && ns->used >= NS_HASH_MIN) {
+        if (ns_make_hash(ns) < 0) {
+            STATE_ENOMEM;
             return;
+        }
+    }
+    if (ns->hash != NULL) {
+        if (hash_lookup(ns->hash, node) != NULL)
+            return;
+    } else {
+        for (int i=0; i < ns->used; i++)
+            if (ns->nodes[i] == node)
+                return;
+    }
     if (ns->used >= ns->size) {
         size_t size = 2 * ns->size;
         if (size < 10) size = 10;
-        if (REALLOC_N(ns->nodes, size) < 0)
+        if (REALLOC_N(ns->nodes, size) < 0) {
             STATE_ENOMEM;
+            return;
+        }
         ns->size = size;
     }
+    if (ns->hash != NULL && hash_alloc_insert(ns->hash, node, NULL) < 0) {
+        STATE_ENOMEM;
+        return;
+    }
     ns->nodes[ns->used] = node;
     ns->used += 1;
 }
@@ -760,8 +901,43 @@ nodeset_as_regexp(struct info *info, struct nodeset *ns, int glob, int nocase) {
     return result;
 }
 
+static struct regexp *cache_find_regexp(struct pathx_cache *cache,
+                                        const struct pathx_regexp *key);
+static void cache_add_regexp(struct pathx_cache *cache,
+                             const struct pathx_regexp *key,
+                             struct regexp *rx);
+
+/* Set KEY to the pattern under which we cache the regexp made from V */
+static int regexp_cache_key(struct value *v, int glob, int nocase,
+                            struct pathx_regexp *key) {
+    MEMZERO(key, 1);
+    key->glob = glob;
+    key->nocase = nocase;
+    if (v->tag == T_STRING) {
+        key->pat = v->string;
+        key->len = strlen(v->string);
+        return 0;
+    }
+
+    key->nodeset = true;
+    for (int i=0; i < v->nodeset->used; i++) {
+        if (v->nodeset->nodes[i]->value != NULL)
+            key->len += strlen(v->nodeset->nodes[i]->value) + 1;
+    }
+    if (ALLOC_N(key->pat, key->len + 1) < 0)
+        return -1;
+    char *p = key->pat;
+    for (int i=0; i < v->nodeset->used; i++) {
+        const char *value = v->nodeset->nodes[i]->value;
+        if (value != NULL)
+            p = stpcpy(p, value) + 1;
+    }
+    return 0;
+}
+
 static void func_regexp_or_glob(struct state *state, int glob, int nocase) {
     value_ind_t vind = make_value(T_REGEXP, state);
+    struct pathx_regexp key;
     int r;
 
     RET_ON_ERROR;
@@ -769,6 +945,22 @@ static void func_regexp_or_glob(struct state *state, int glob, int nocase) {
     struct value *v = pop_value(state);
     struct regexp *rx = NULL;
 
+    MEMZERO(&key, 1);
+    if (state->rx_cache != NULL) {
+        if (regexp_cache_key(v, glob, nocase, &key) < 0) {
+            STATE_ENOMEM;
+            return;
+        }
+        rx = cache_find_regexp(state->rx_cache, &key);
+        if (rx != NULL) {
+            if (key.nodeset)
+                free(key.pat);
+            state->value_pool[vind].regexp = ref(rx);
+            push_value(vind, state);
+            return;
+        }
+    }
+
     if (v->tag == T_STRING) {
         if (glob)
             rx = make_regexp_from_glob(state->error->info, v->string);
@@ -782,7 +974,7 @@ static void func_regexp_or_glob(struct state *state, int glob, int nocase) {
 
     if (rx == NULL) {
         STATE_ENOMEM;
-        return;
+        goto done;
     }
 
     state->value_pool[vind].regexp = rx;
@@ -792,9 +984,14 @@ static void func_regexp_or_glob(struct state *state, int glob, int nocase) {
         regexp_check(rx, &msg);
         state->errmsg = strdup(msg);
         STATE_ERROR(state, PATHX_EREGEXP);
-        return;
+        goto done;
     }
+    if (state->rx_cache != NULL)
+        cache_add_regexp(state->rx_cache, &key, rx);
     push_value(vind, state);
+ done:
+    if (key.nodeset)
+        free(key.pat);
 }
 
 static void func_regexp(struct state *state, int nargs) {
@@ -1146,17 +1343,22 @@ static bool eval_pred(struct expr *expr, struct state *state) {
     }
 }
 
-static void ns_remove(struct nodeset *ns, int ind) {
-    memmove(ns->nodes + ind, ns->nodes + ind+1,
-            sizeof(ns->nodes[0]) * (ns->used - (ind+1)));
-    ns->used -= 1;
+/* Keep only the first USED nodes of NS */
+static void ns_truncate(struct nodeset *ns, size_t used) {
+    if (used < ns->used) {
+        /* Should anything be added to NS again, ns_add rebuilds the
+         * hash */
+        ns_drop_hash(ns);
+        ns->used = used;
+    }
 }
 
 /*
- * Remove all nodes from NS for which one of PRED is false
+ * Remove all nodes from NS for which one of the predicates in PREDICATES
+ * from FIRST on is false
  */
-static void ns_filter(struct nodeset *ns, struct pred *predicates,
-                      struct state *state) {
+static void ns_filter_from(struct nodeset *ns, struct pred *predicates,
+                           int first, struct state *state) {
     if (predicates == NULL)
         return;
 
@@ -1164,19 +1366,26 @@ static void ns_filter(struct nodeset *ns, struct pred *predicates,
     uint old_ctx_len = state->ctx_len;
     uint old_ctx_pos = state->ctx_pos;
 
-    for (int p=0; p < predicates->nexpr; p++) {
-        state->ctx_len = ns->used;
-        state->ctx_pos = 1;
-        for (int i=0; i < ns->used; state->ctx_pos++) {
-            state->ctx = ns->nodes[i];
-            bool match = eval_pred(predicates->exprs[p], state);
-            RET_ON_ERROR;
-            if (match) {
-                i+=1;
-            } else {
-                ns_remove(ns, i);
+    for (int p=first; p < predicates->nexpr && ns->used > 0; p++) {
+        struct expr *pred = predicates->exprs[p];
+        size_t kept = 0;
+
+        if (pred->tag == E_APP && pred->func->impl == func_last) {
+            /* [last()] only keeps the last node */
+            ns->nodes[0] = ns->nodes[ns->used - 1];
+            kept = 1;
+        } else {
+            state->ctx_len = ns->used;
+            state->ctx_pos = 1;
+            for (int i=0; i < ns->used; i++, state->ctx_pos++) {
+                state->ctx = ns->nodes[i];
+                bool match = eval_pred(pred, state);
+                RET_ON_ERROR;
+                if (match)
+                    ns->nodes[kept++] = ns->nodes[i];
             }
         }
+        ns_truncate(ns, kept);
     }
 
     state->ctx = old_ctx;
@@ -1184,14 +1393,162 @@ static void ns_filter(struct nodeset *ns, struct pred *predicates,
     state->ctx_len = old_ctx_len;
 }
 
+/*
+ * Remove all nodes from NS for which one of PRED is false
+ */
+static void ns_filter(struct nodeset *ns, struct pred *predicates,
+                      struct state *state) {
+    ns_filter_from(ns, predicates, 0, state);
+}
+
+/* If PRED compares the value of the context node, or of its children
+ * with some label, with a string that does not depend on the context
+ * node, as in '. = S' or 'label = S', return the step for '.' or 'label'
+ * and set *STR to S. Otherwise, return NULL */
+static struct step *pred_value_eq(struct expr *pred, struct expr **str) {
+    struct expr *path;
+    struct step *step;
+
+    if (pred->tag != E_BINARY || pred->op != OP_EQ)
+        return NULL;
+    path = pred->left;
+    *str = pred->right;
+    if (path->tag != E_FILTER || path->primary != NULL)
+        return NULL;
+    if ((*str)->tag != E_VALUE && (*str)->tag != E_VAR)
+        return NULL;
+    step = path->locpath->steps;
+    if (step == NULL || step->next != NULL || step->predicates != NULL)
+        return NULL;
+    if ((step->axis == SELF && step->name == NULL)
+        || (step->axis == CHILD && step->name != NULL))
+        return step;
+    return NULL;
+}
+
+/* Evaluate STR and set *S to its value. Return false if it is not a
+ * string */
+static bool eval_string(struct expr *str, const char **s,
+                        struct state *state) {
+    struct value *v;
+
+    eval_expr(str, state);
+    RET0_ON_ERROR;
+    v = pop_value(state);
+    if (v->tag != T_STRING)
+        return false;
+    *s = v->string;
+    return true;
+}
+
+/* Evaluate PRED for NODE like eval_pred, but look at the values of NODE
+ * or its children directly when pred_value_eq recognizes PRED */
+static bool eval_pred_node(struct expr *pred, struct tree *node,
+                           struct state *state) {
+    struct tree *const *children;
+    struct expr *str;
+    struct step *step;
+    const char *s;
+    size_t count;
+    int n;
+
+    step = pred_value_eq(pred, &str);
+    if (step == NULL || node == node->parent
+        || !eval_string(str, &s, state)) {
+        RET0_ON_ERROR;
+        state->ctx = node;
+        return eval_pred(pred, state);
+    }
+
+    if (step->axis == SELF)
+        return streqx(node->value, s);
+
+    n = tree_child_valued(node, step->name, s, &children);
+    if (n >= 0)
+        return n > 0;
+    for (struct tree *c = tree_child_labelled(node, step->name, &count);
+         count > 0; c = c->next) {
+        if (step_matches(step, c)) {
+            if (streqx(c->value, s))
+                return true;
+            count -= 1;
+        }
+    }
+    return false;
+}
+
+/* Add NODE to NS if the predicates in PREDICATES from FIRST up to NINDEP
+ * are true for it */
+static void ns_add_matching(struct nodeset *ns, struct tree *node,
+                            struct pred *predicates, int first,
+                            struct state *state) {
+    if (predicates != NULL && predicates->nindep > first) {
+        struct tree *old_ctx = state->ctx;
+
+        for (int p=first; p < predicates->nindep; p++) {
+            bool match = eval_pred_node(predicates->exprs[p], node, state);
+            if (HAS_ERROR(state) || !match) {
+                state->ctx = old_ctx;
+                return;
+            }
+        }
+        state->ctx = old_ctx;
+    }
+    ns_add(ns, node, state);
+}
+
+/* The number of nodes a step with PREDICATES needs to produce at most: if
+ * the predicates that can not be evaluated right away start with a
+ * constant position [N], no node after the Nth one can be in the result.
+ * Return 0 if the step needs to produce all its nodes */
+static size_t pred_limit(struct pred *predicates, struct state *state) {
+    struct expr *pred;
+
+    if (predicates == NULL || predicates->nindep >= predicates->nexpr)
+        return 0;
+    pred = predicates->exprs[predicates->nindep];
+    if (pred->tag != E_VALUE)
+        return 0;
+    struct value *v = state->value_pool + pred->value_ind;
+    if (v->tag != T_NUMBER || v->number < 1)
+        return 0;
+    return v->number;
+}
+
+static bool ns_full(struct nodeset *ns, size_t limit, struct state *state) {
+    return HAS_ERROR(state) || (limit > 0 && ns->used >= limit);
+}
+
 /* Return an array of nodesets, one for each step in the locpath.
  *
  * On return, (*NS)[0] will contain state->ctx, and (*NS)[*MAXNS] will
  * contain the nodes that matched the entire locpath
  */
+/* Add CTX and its descendants to NS, except for the nodes that can not
+ * have a child with label LABEL since there is no such label below them */
+static void ns_add_below(struct nodeset *ns, struct tree *ctx,
+                         const char *label, struct state *state) {
+    struct tree *node = ctx;
+
+    while (node != NULL && !HAS_ERROR(state)) {
+        if (node->children != NULL && tree_maybe_below(node, label)) {
+            ns_add(ns, node, state);
+            node = node->children;
+            continue;
+        }
+        while (node->next == NULL && node != ctx)
+            node = node->parent;
+        if (node == ctx)
+            node = NULL;
+        else
+            node = node->next;
+    }
+}
+
 static void ns_from_locpath(struct locpath *lp, uint *maxns,
                             struct nodeset ***ns,
                             const struct nodeset *root,
+                            bool trace,
                             struct state *state) {
     struct tree *old_ctx = state->ctx;
 
@@ -1229,13 +1586,76 @@ static void ns_from_locpath(struct locpath *lp, uint *maxns,
     list_for_each(step, lp->steps) {
         struct nodeset *work = (*ns)[cur_ns];
         struct nodeset *next = (*ns)[cur_ns + 1];
-        for (int i=0; i < work->used; i++) {
+        struct pred *preds = step->predicates;
+        size_t limit = pred_limit(preds, state);
+        struct step *eq = NULL;
+        const char *value = NULL;
+        const char *below = NULL;
+
+        /* For '//label', we only need the nodes that might have a child
+         * 'label'. Unless we are asked to TRACE the nodesets of all steps,
+         * we leave out the subtrees without that label */
+        if (! trace && step->axis == DESCENDANT_OR_SELF && step->name == NULL
+            && preds == NULL && step->next != NULL
+            && step->next->axis == CHILD && step->next->name != NULL)
+            below = step->next->name;
+
+        /* For 'label[. = S]', we can look the children with value S up
+         * in the index of their parent */
+        if (step->axis == CHILD && step->name != NULL
+            && preds != NULL && preds->nindep > 0) {
+            struct expr *str;
+            eq = pred_value_eq(preds->exprs[0], &str);
+            if (eq != NULL
+                && (eq->axis != SELF || !eval_string(str, &value, state)))
+                eq = NULL;
+            if (HAS_ERROR(state))
+                goto error;
+        }
+
+        /* Predicates that do not depend on the position of a node are
+         * applied as the nodes are produced, and we stop producing nodes
+         * as soon as we have all that the remaining ones can keep */
+        for (int i=0; i < work->used && !ns_full(next, limit, state); i++) {
+            if (below != NULL) {
+                ns_add_below(next, work->nodes[i], below, state);
+                continue;
+            }
+            if (step->axis == CHILD && step->name != NULL) {
+                struct tree *const *children;
+                int n = -1;
+
+                if (eq != NULL)
+                    n = tree_child_valued(work->nodes[i], step->name, value,
+                                          &children);
+                if (n >= 0) {
+                    for (int j=0; j < n && !ns_full(next, limit, state); j++)
+                        ns_add_matching(next, children[j], preds, 1, state);
+                    continue;
+                }
+
+                /* Go straight to the children with the right label */
+                size_t count;
+                struct tree *node =
+                    tree_child_labelled(work->nodes[i], step->name, &count);
+                for (; count > 0 && !ns_full(next, limit, state);
+                     node = node->next) {
+                    if (step_matches(step, node)) {
+                        ns_add_matching(next, node, preds, 0, state);
+                        count -= 1;
+                    }
+                }
+                continue;
+            }
             for (struct tree *node = step_first(step, work->nodes[i]);
-                 node != NULL;
+                 node != NULL && !ns_full(next, limit, state);
                  node = step_next(step, work->nodes[i], node))
-                ns_add(next, node, state);
+                ns_add_matching(next, node, preds, 0, state);
         }
-        ns_filter(next, step->predicates, state);
+        if (HAS_ERROR(state))
+            goto error;
+        if (preds != NULL)
+            ns_filter_from(next, preds, preds->nindep, state);
         if (HAS_ERROR(state))
             goto error;
         cur_ns += 1;
@@ -1261,7 +1681,7 @@ static void eval_filter(struct expr *expr, struct state *state) {
 
     state->locpath_trace = NULL;
     if (expr->primary == NULL) {
-        ns_from_locpath(lp, &maxns, &ns, NULL, state);
+        ns_from_locpath(lp, &maxns, &ns, NULL, lpt != NULL, state);
     } else {
         eval_expr(expr->primary, state);
         RET_ON_ERROR;
@@ -1271,7 +1691,8 @@ static void eval_filter(struct expr *expr, struct state *state) {
         ns_filter(primary->nodeset, expr->predicates, state);
         /* Evaluating predicates might have reallocated the value_pool */
         primary = state->value_pool + primary_ind;
-        ns_from_locpath(lp, &maxns, &ns, primary->nodeset, state);
+        ns_from_locpath(lp, &maxns, &ns, primary->nodeset, lpt != NULL,
+                        state);
     }
     RET_ON_ERROR;
 
@@ -1303,6 +1724,17 @@ static struct value *lookup_var(const char *ident, struct state *state) {
 }
 
 static void eval_var(struct expr *expr, struct state *state) {
+    if (isdigit(expr->ident[0])) {
+        int n = atoi(expr->ident);
+        assert(n >= 1 && n <= state->nparams);
+        if (state->params == NULL || state->params[n] == 0) {
+            STATE_ERROR(state, PATHX_ENOVAR);
+            return;
+        }
+        push_value(state->params[n], state);
+        return;
+    }
+
     struct value *v = lookup_var(expr->ident, state);
     value_ind_t vind = clone_value(v, state);
     RET_ON_ERROR;
@@ -1338,6 +1770,33 @@ static void eval_expr(struct expr *expr, struct state *state) {
 
 static void check_expr(struct expr *expr, struct state *state);
 
+/* Whether EXPR calls position() or last() for the context node it is
+ * evaluated for */
+static bool uses_position(struct expr *expr) {
+    switch (expr->tag) {
+    case E_FILTER:
+        /* The predicates of the filter and its locpath have their own
+         * context */
+        return expr->primary != NULL && uses_position(expr->primary);
+    case E_BINARY:
+        return uses_position(expr->left) || uses_position(expr->right);
+    case E_APP:
+        if (expr->func->impl == func_last
+            || expr->func->impl == func_position)
+            return true;
+        for (int i=0; i < expr->func->arity; i++)
+            if (uses_position(expr->args[i]))
+                return true;
+        return false;
+    case E_VALUE:
+    case E_VAR:
+        return false;
+    default:
+        assert(0);
+        return true;
+    }
+}
+
 /* Typecheck a list of predicates. A predicate is a function of
  * one of the following types:
  *
@@ -1358,6 +1817,13 @@ static void check_preds(struct pred *pred, struct state *state) {
             return;
         }
     }
+    /* A number as a predicate is compared with the position. Variables
+     * can change their type when we are checked again, so count anew */
+    pred->nindep = 0;
+    while (pred->nindep < pred->nexpr
+           && pred->exprs[pred->nindep]->type != T_NUMBER
+           && ! uses_position(pred->exprs[pred->nindep]))
+        pred->nindep += 1;
 }
 
 static void check_filter(struct expr *expr, struct state *state) {
@@ -1380,6 +1846,36 @@ static void check_filter(struct expr *expr, struct state *state) {
     expr->type = T_NODESET;
 }
 
+/* If all the arguments of the call of regexp() or glob() in EXPR are
+ * literals, make the regexp now, and turn EXPR into a literal, so that
+ * the regexp is not compiled again every time EXPR is evaluated */
+static void fold_regexp(struct expr *expr, struct state *state) {
+    value_ind_t vind;
+
+    for (int i=0; i < expr->func->arity; i++) {
+        if (expr->args[i]->tag != E_VALUE)
+            return;
+    }
+
+    for (int i=0; i < expr->func->arity; i++) {
+        push_value(expr->args[i]->value_ind, state);
+        RET_ON_ERROR;
+    }
+    expr->func->impl(state, expr->func->arity);
+    RET_ON_ERROR;
+    vind = pop_value_ind(state);
+    RET_ON_ERROR;
+
+    for (int i=0; i < expr->func->arity; i++)
+        free_expr(expr->args[i]);
+    free(expr->args);
+    expr->tag = E_VALUE;
+    expr->value_ind = vind;
+    /* We typecheck before we evaluate anything, so the regexp can stay
+     * with the literals when the expression is reused */
+    state->value_pool_parsed = state->value_pool_used;
+}
+
 static void check_app(struct expr *expr, struct state *state) {
     assert(expr->tag == E_APP);
 
@@ -1410,6 +1906,8 @@ static void check_app(struct expr *expr, struct state *state) {
     if (f < ARRAY_CARDINALITY(builtin_funcs)) {
         expr->func = builtin_funcs + f;
         expr->type = expr->func->type;
+        if (expr->type == T_REGEXP)
+            fold_regexp(expr, state);
     } else {
         STATE_ERROR(state, PATHX_ETYPE);
     }
@@ -1498,6 +1996,15 @@ static void check_binary(struct expr *expr, struct state *state) {
 }
 
 static void check_var(struct expr *expr, struct state *state) {
+    if (isdigit(expr->ident[0])) {
+        /* Parameters only get their value when we evaluate */
+        int n = atoi(expr->ident);
+        if (n > state->nparams)
+            state->nparams = n;
+        expr->type = T_STRING;
+        return;
+    }
+
     struct value *v = lookup_var(expr->ident, state);
     if (v == NULL) {
         STATE_ERROR(state, PATHX_ENOVAR);
@@ -2054,21 +2561,33 @@ static void parse_function_call(struct state *state) {
 }
 
 /*
- * VariableReference ::= '$' /[a-zA-Z_][a-zA-Z0-9_]* /
+ * VariableReference ::= '$' /[a-zA-Z_][a-zA-Z0-9_]* / | '$' /[1-9][0-9]* /
  *
- * The '$' is consumed by parse_primary_expr
+ * The '$' is consumed by parse_primary_expr. Parameters can go up to
+ * PATHX_MAX_PARAM
  */
 static void parse_var(struct state *state) {
     const char *id = state->pos;
     struct expr *expr = NULL;
 
-    if (!isalpha(*id) && *id != '_') {
-        STATE_ERROR(state, PATHX_ENAME);
-        return;
+    if (isdigit(*id) && *id != '0') {
+        /* A parameter $1, $2, ... */
+        char *end;
+        long n = strtol(id, &end, 10);
+        if (n > PATHX_MAX_PARAM) {
+            STATE_ERROR(state, PATHX_ENAME);
+            return;
+        }
+        id = end;
+    } else {
+        if (!isalpha(*id) && *id != '_') {
+            STATE_ERROR(state, PATHX_ENAME);
+            return;
+        }
+        id++;
+        while (isalpha(*id) || isdigit(*id) || *id == '_')
+            id += 1;
     }
-    id++;
-    while (isalpha(*id) || isdigit(*id) || *id == '_')
-        id += 1;
 
     if (ALLOC(expr) < 0)
         goto err_nomem;
@@ -2388,6 +2907,15 @@ static void store_error(struct pathx *pathx) {
     err->minor_details = pathx_msg;
 }
 
+static void typecheck(struct state *state, bool need_nodeset) {
+    check_expr(state->exprs[0], state);
+    if (HAS_ERROR(state))
+        return;
+
+    if (need_nodeset && state->exprs[0]->type != T_NODESET)
+        STATE_ERROR(state, PATHX_ETYPE);
+}
+
 int pathx_parse(const struct tree *tree,
                 struct error *err,
                 const char *txt,
@@ -2441,16 +2969,9 @@ int pathx_parse(const struct tree *tree,
         STATE_ERROR(state, PATHX_EINTERNAL);
         goto done;
     }
+    state->value_pool_parsed = state->value_pool_used;
 
-    /* Typecheck */
-    check_expr(state->exprs[0], state);
-    if (HAS_ERROR(state))
-        goto done;
-
-    if (need_nodeset && state->exprs[0]->type != T_NODESET) {
-        STATE_ERROR(state, PATHX_ETYPE);
-        goto done;
-    }
+    typecheck(state, need_nodeset);
 
  done:
     store_error(*pathx);
@@ -2463,6 +2984,265 @@ int pathx_parse(const struct tree *tree,
     return PATHX_ENOMEM;
 }
 
+void pathx_reuse(struct pathx *pathx, const struct tree *tree,
+                 struct error *err, struct pathx_symtab *symtab,
+                 struct tree *root_ctx) {
+    reset_pathx(pathx);
+    pathx->origin = (struct tree *) tree;
+    pathx->state->symtab = symtab;
+    pathx->state->root_ctx = root_ctx;
+    pathx->state->error = err;
+}
+
+int pathx_typecheck(struct pathx *pathx, bool need_nodeset) {
+    typecheck(pathx->state, need_nodeset);
+    store_error(pathx);
+    return pathx->state->errcode;
+}
+
+int pathx_nparams(struct pathx *pathx) {
+    return pathx->state->nparams;
+}
+
+int pathx_bind(struct pathx *pathx, int n, const char *value) {
+    struct state *state = pathx->state;
+    char *v = NULL;
+
+    assert(n >= 1 && n <= state->nparams);
+    if (state->params == NULL) {
+        if (ALLOC_N(state->params, state->nparams + 1) < 0)
+            return -1;
+    }
+
+    v = strdup(value);
+    if (v == NULL)
+        return -1;
+
+    if (state->params[n] == 0) {
+        /* Add a value right after the literals */
+        reset_pathx(pathx);
+        value_ind_t vind = make_value(T_STRING, state);
+        if (HAS_ERROR(state)) {
+            free(v);
+            return -1;
+        }
+        state->value_pool_parsed = state->value_pool_used;
+        state->params[n] = vind;
+    } else {
+        free(state->value_pool[state->params[n]].string);
+    }
+    state->value_pool[state->params[n]].string = v;
+    return 0;
+}
+
+/*
+ * The cache of parsed path expressions
+ */
+struct pathx_cache *make_pathx_cache(void) {
+    struct pathx_cache *cache;
+
+    if (ALLOC(cache) < 0)
+        return NULL;
+    cache->entries = hash_create(HASHCOUNT_T_MAX, NULL, NULL);
+    if (cache->entries == NULL) {
+        free(cache);
+        return NULL;
+    }
+    return cache;
+}
+
+static void cache_unlink(struct pathx_cache *cache, struct pathx *pathx) {
+    if (pathx->prev == NULL)
+        cache->first = pathx->next;
+    else
+        pathx->prev->next = pathx->next;
+    if (pathx->next == NULL)
+        cache->last = pathx->prev;
+    else
+        pathx->next->prev = pathx->prev;
+    pathx->prev = pathx->next = NULL;
+}
+
+static void cache_push(struct pathx_cache *cache, struct pathx *pathx) {
+    pathx->prev = NULL;
+    pathx->next = cache->first;
+    if (cache->first == NULL)
+        cache->last = pathx;
+    else
+        cache->first->prev = pathx;
+    cache->first = pathx;
+}
+
+/* Take PATHX out of CACHE. If it is still in use, it gets freed when its
+ * user calls FREE_PATHX */
+static void cache_remove(struct pathx_cache *cache, struct pathx *pathx) {
+    hash_delete(cache->entries, &pathx->hnode);
+    cache_unlink(cache, pathx);
+    pathx->cache = NULL;
+    if (! pathx->busy)
+        free_pathx(pathx);
+}
+
+void pathx_cache_clear(struct pathx_cache *cache) {
+    if (cache == NULL)
+        return;
+    while (cache->first != NULL)
+        cache_remove(cache, cache->first);
+}
+
+static hash_val_t regexp_key_hash(const void *key) {
+    const struct pathx_regexp *k = key;
+    hash_val_t hash = 5381;
+
+    for (size_t i=0; i < k->len; i++)
+        hash = hash * 33 + (unsigned char) k->pat[i];
+    return hash * 8 + k->nodeset * 4 + k->glob * 2 + k->nocase;
+}
+
+static int regexp_key_cmp(const void *key1, const void *key2) {
+    const struct pathx_regexp *k1 = key1, *k2 = key2;
+
+    if (k1->len != k2->len || k1->nodeset != k2->nodeset
+        || k1->glob != k2->glob || k1->nocase != k2->nocase)
+        return 1;
+    return memcmp(k1->pat, k2->pat, k1->len);
+}
+
+static void cache_clear_regexps(struct pathx_cache *cache) {
+    hscan_t scan;
+    hnode_t *node;
+
+    if (cache->regexps == NULL)
+        return;
+    hash_scan_begin(&scan, cache->regexps);
+    while ((node = hash_scan_next(&scan)) != NULL) {
+        struct pathx_regexp *entry = hnode_get(node);
+        hash_scan_delete(cache->regexps, node);
+        unref(entry->regexp, regexp);
+        free(entry->pat);
+        free(entry);
+    }
+}
+
+/* Return the regexp kept in CACHE under KEY, or NULL */
+static struct regexp *cache_find_regexp(struct pathx_cache *cache,
+                                        const struct pathx_regexp *key) {
+    hnode_t *node;
+
+    if (cache->regexps == NULL)
+        return NULL;
+    node = hash_lookup(cache->regexps, key);
+    if (node == NULL)
+        return NULL;
+    return ((struct pathx_regexp *) hnode_get(node))->regexp;
+}
+
+/* Keep RX in CACHE under KEY; if we can't, it simply isn't cached */
+static void cache_add_regexp(struct pathx_cache *cache,
+                             const struct pathx_regexp *key,
+                             struct regexp *rx) {
+    struct pathx_regexp *entry = NULL;
+
+    if (cache->regexps == NULL) {
+        cache->regexps = hash_create(HASHCOUNT_T_MAX, regexp_key_cmp,
+                                     regexp_key_hash);
+        if (cache->regexps == NULL)
+            return;
+    }
+    if (hash_count(cache->regexps) >= PATHX_REGEXP_CACHE_SIZE)
+        cache_clear_regexps(cache);
+
+    if (ALLOC(entry) < 0)
+        return;
+    *entry = *key;
+    if (ALLOC_N(entry->pat, key->len + 1) < 0) {
+        free(entry);
+        return;
+    }
+    memcpy(entry->pat, key->pat, key->len);
+    entry->regexp = ref(rx);
+    hnode_init(&entry->hnode, entry);
+    hash_insert(cache->regexps, &entry->hnode, entry);
+}
+
+void free_pathx_cache(struct pathx_cache *cache) {
+    if (cache == NULL)
+        return;
+    pathx_cache_clear(cache);
+    hash_destroy(cache->entries);
+    if (cache->regexps != NULL) {
+        cache_clear_regexps(cache);
+        hash_destroy(cache->regexps);
+    }
+    free(cache);
+}
+
+void pathx_cache_stats(const struct pathx_cache *cache,
+                       unsigned long *hits, unsigned long *misses) {
+    *hits = cache->hits;
+    *misses = cache->misses;
+}
+
+int pathx_cache_parse(struct pathx_cache *cache,
+                      const struct tree *tree,
+                      struct error *err,
+                      const char *txt,
+                      bool need_nodeset,
+                      struct pathx_symtab *symtab,
+                      struct tree *root_ctx,
+                      struct pathx **pathx) {
+    struct pathx *px;
+    hnode_t *node;
+    int r;
+
+    if (cache == NULL)
+        return pathx_parse(tree, err, txt, need_nodeset, symtab, root_ctx,
+                           pathx);
+
+    node = hash_lookup(cache->entries, txt);
+    if (node != NULL) {
+        px = hnode_get(node);
+        /* If the cached expression is in use, or has the wrong type, we
+         * parse it again, and let pathx_parse report any errors */
+        if (! px->busy &&
+            (! need_nodeset || px->state->exprs[0]->type == T_NODESET)) {
+            cache->hits += 1;
+            cache_unlink(cache, px);
+            cache_push(cache, px);
+            px->busy = true;
+            pathx_reuse(px, tree, err, symtab, root_ctx);
+            *pathx = px;
+            return PATHX_NOERROR;
+        }
+    }
+
+    cache->misses += 1;
+    r = pathx_parse(tree, err, txt, need_nodeset, symtab, root_ctx, pathx);
+    if (r != PATHX_NOERROR)
+        return r;
+    (*pathx)->state->rx_cache = cache;
+    if (node != NULL)
+        return r;
+
+    /* Keep the new expression; if we can't, it simply isn't cached */
+    px = *pathx;
+    px->txt = strdup(txt);
+    if (px->txt == NULL)
+        return r;
+    px->state->pos = px->txt + (px->state->pos - px->state->txt);
+    px->state->txt = px->txt;
+
+    if (hash_count(cache->entries) >= PATHX_CACHE_SIZE)
+        cache_remove(cache, cache->last);
+
+    hnode_init(&px->hnode, px);
+    hash_insert(cache->entries, &px->hnode, px->txt);
+    cache_push(cache, px);
+    px->cache = cache;
+    px->busy = true;
+    return r;
+}
+
 /*************************************************************************
  * Searching in the tree
  *************************************************************************/
@@ -2520,9 +3300,12 @@ static struct tree *step_first(struct step *step, struct tree *ctx) {
         node = ctx;
         break;
     case CHILD:
-    case DESCENDANT:
         node = ctx->children;
         break;
+    case DESCENDANT:
+        if (step->name == NULL || tree_maybe_below(ctx, step->name))
+            node = ctx->children;
+        break;
     case PARENT:
     case ANCESTOR:
         node = ctx->parent;
@@ -2560,7 +3343,10 @@ static struct tree *step_next(struct step *step, struct tree *ctx,
             break;
         case DESCENDANT:
         case DESCENDANT_OR_SELF:
-            if (node->children != NULL) {
+            /* Skip subtrees that do not have the label we want */
+            if (node->children != NULL
+                && (step->name == NULL
+                    || tree_maybe_below(node, step->name))) {
                 node = node->children;
             } else {
                 while (node->next == NULL && node != ctx)
@@ -2723,12 +3509,16 @@ int pathx_expand_tree(struct pathx *path, struct tree **tree) {
     list_for_each(s, step) {
         if (s->name == NULL || s->axis != CHILD)
             goto error;
-        struct tree *t = make_tree(strdup(s->name), NULL, parent, NULL);
+        char *label = strdup(s->name);
+        if (label == NULL)
+            goto error;
+        struct tree *t = tree_append(parent, label, NULL);
+        if (t == NULL) {
+            free(label);
+            goto error;
+        }
         if (first_child == NULL)
             first_child = t;
-        if (t == NULL || t->label == NULL)
-            goto error;
-        list_append(parent->children, t);
         parent = t;
     }
 
@@ -2740,7 +3530,7 @@ int pathx_expand_tree(struct pathx *path, struct tree **tree) {
 
  error:
     if (first_child != NULL) {
-        list_remove(first_child, first_child->parent->children);
+        tree_detach(first_child);
         free_tree(first_child);
     }
     *tree = NULL;
@@ -2932,15 +3722,15 @@ void pathx_symtab_remove_descendants(struct pathx_symtab *symtab,
         if (tab->value->tag != T_NODESET)
             continue;
         struct nodeset *ns = tab->value->nodeset;
-        for (int i=0; i < ns->used;) {
+        size_t kept = 0;
+        for (int i=0; i < ns->used; i++) {
             struct tree *t = ns->nodes[i];
             while (t != t->parent && t != tree)
                 t = t->parent;
-            if (t == tree)
-                ns_remove(ns, i);
-            else
-                i += 1;
+            if (t != tree)
+                ns->nodes[kept++] = ns->nodes[i];
         }
+        ns_truncate(ns, kept);
     }
 }
 
@@ -56,6 +56,7 @@ struct split {
 
 struct state {
     FILE             *out;
+    const char       *text;   /* The text the skels were parsed from */
     struct split     *split;
     const char       *key;
     const char       *value;
@@ -208,10 +209,12 @@ static struct split *split_concat(struct state *state, struct lens *lens) {
     struct re_registers regs;
     struct split *split = NULL, *tail = NULL;
     struct regexp *atype = lens->atype;
+    struct regexp **types = NULL;
+    int *bounds = NULL;
 
     /* Fast path for leaf nodes, which will always lead to an empty split */
     // FIXME: This doesn't match the empty encoding
-    if (outer->tree == NULL && strlen(outer->enc) == 0
+    if (outer->tree == NULL && outer->enc[0] == '\0'
         && regexp_is_empty_pattern(atype)) {
         for (int i=0; i < lens->nchildren; i++) {
             tail = split_append(&split, tail, NULL, NULL,
@@ -221,34 +224,55 @@ static struct split *split_concat(struct state *state, struct lens *lens) {
     }
 
     MEMZERO(&regs, 1);
-    count = regexp_match(atype, outer->enc, outer->end,
-                         outer->start, &regs);
-    if (count >= 0 && count != outer->end - outer->start)
-        count = -1;
+    if (ALLOC_N(types, lens->nchildren) < 0
+        || ALLOC_N(bounds, lens->nchildren + 1) < 0) {
+        put_error(state, lens, "Out of memory");
+        goto error;
+    }
+    for (int i=0; i < lens->nchildren; i++)
+        types[i] = lens->children[i]->atype;
+    count = regexp_split(lens->nchildren, types, outer->enc,
+                         outer->start, outer->end, bounds);
+    if (count == -2) {
+        /* Some atype has no DFA (yet); use the registers of a
+         * backtracking match instead */
+        count = regexp_match(atype, outer->enc, outer->end,
+                             outer->start, &regs);
+        if (count >= 0 && count != outer->end - outer->start)
+            count = -1;
+        if (count >= 0) {
+            int reg = 1;
+            for (int i=0; i < lens->nchildren; i++) {
+                assert(reg < regs.num_regs);
+                assert(regs.start[reg] != -1);
+                bounds[i] = regs.start[reg];
+                bounds[i+1] = regs.end[reg];
+                reg += 1 + regexp_nsub(lens->children[i]->atype);
+            }
+            assert(reg < regs.num_regs);
+        }
+    }
     if (count < 0) {
         regexp_match_error(state, lens, count, outer);
         goto error;
     }
 
     struct tree *cur = outer->tree;
-    int reg = 1;
     for (int i=0; i < lens->nchildren; i++) {
-        assert(reg < regs.num_regs);
-        assert(regs.start[reg] != -1);
         struct tree *follow = cur;
-        for (int j = regs.start[reg]; j < regs.end[reg]; j++) {
+        for (int j = bounds[i]; j < bounds[i+1]; j++) {
             if (outer->enc[j] == ENC_SLASH_CH)
                 follow = follow->next;
         }
         tail = split_append(&split, tail, cur, follow,
-                            outer->enc, regs.start[reg], regs.end[reg]);
+                            outer->enc, bounds[i], bounds[i+1]);
         cur = follow;
-        reg += 1 + regexp_nsub(lens->children[i]->atype);
     }
-    assert(reg < regs.num_regs);
  done:
     free(regs.start);
     free(regs.end);
+    free(types);
+    free(bounds);
     return split;
  error:
     free_split(split);
@@ -365,11 +389,12 @@ static int skel_instance_of(struct lens *lens, struct skel *skel) {
     switch (lens->tag) {
     case L_DEL: {
         int count;
+        size_t len;
         if (skel->tag != L_DEL)
             return 0;
-        count = regexp_match(lens->regexp, skel->text, strlen(skel->text),
-                           0, NULL);
-        return count == strlen(skel->text);
+        len = strlen(skel->text);
+        count = regexp_match(lens->regexp, skel->text, len, 0, NULL);
+        return count == len;
     }
     case L_STORE:
         return skel->tag == L_STORE;
@@ -442,6 +467,20 @@ static void put_subtree(struct lens *lens, struct state *state) {
 
     struct tree *tree = state->split->tree;
     struct split *split = NULL;
+    const struct skel_origin *origin;
+
+    dict_lookup(tree->label, state->dict, &state->skel, &state->dict,
+                &origin);
+
+    /* Nothing in TREE has changed since it was made from the text its
+     * skel was parsed from, and putting it would produce that text */
+    if (origin != NULL && origin->tree == tree && origin->lens == lens
+        && ! tree->dirty) {
+        fwrite(state->text + origin->start, 1, origin->end - origin->start,
+               state->out);
+        *state = oldstate;
+        return;
+    }
 
     state->key = tree->label;
     state->value = tree->value;
@@ -450,7 +489,6 @@ static void put_subtree(struct lens *lens, struct state *state) {
     split = make_split(tree->children);
     set_split(state, split);
 
-    dict_lookup(tree->label, state->dict, &state->skel, &state->dict);
     if (state->skel == NULL || ! skel_instance_of(lens->child, state->skel)) {
         create_lens(lens->child, state);
     } else {
@@ -579,18 +617,22 @@ static void put_quant_maybe(struct lens *lens, struct state *state) {
 }
 
 static void put_store(struct lens *lens, struct state *state) {
+    size_t len;
+
     if (state->value == NULL) {
         put_error(state, lens,
                   "Can not store a nonexistent (NULL) value");
-    } else if (regexp_match(lens->regexp, state->value, strlen(state->value),
-                            0, NULL) != strlen(state->value)) {
+        return;
+    }
+    len = strlen(state->value);
+    if (regexp_match(lens->regexp, state->value, len, 0, NULL) != len) {
         char *pat = regexp_escape(lens->regexp);
         put_error(state, lens,
                   "Value '%s' does not match regexp /%s/ in store lens",
                   state->value, pat);
         free(pat);
     } else {
-        fprintf(state->out, "%s", state->value);
+        fwrite(state->value, 1, len, state->out);
     }
 }
 
@@ -833,10 +875,10 @@ static void create_lens(struct lens *lens, struct state *state) {
     }
 }
 
-void lns_put(FILE *out, struct lens *lens, struct tree *tree,
-             const char *text, struct lns_error **err) {
+void lns_put_skel(FILE *out, struct lens *lens, struct tree *tree,
+                  const char *text, struct skel *skel, struct dict *dict,
+                  struct lns_error **err) {
     struct state state;
-    struct lns_error *err1;
 
     if (err != NULL)
         *err = NULL;
@@ -845,24 +887,16 @@ void lns_put(FILE *out, struct lens *lens, struct tree *tree,
 
     MEMZERO(&state, 1);
     state.path = strdup("");
-    state.skel = lns_parse(lens, text, &state.dict, &err1);
-
-    if (err1 != NULL) {
-        if (err != NULL)
-            *err = err1;
-        else
-            free_lns_error(err1);
-        return;
-    }
     state.out = out;
+    state.text = text;
+    state.skel = skel;
+    state.dict = dict;
     state.split = make_split(tree);
     state.key = tree->label;
     put_lens(lens, &state);
 
     free(state.path);
     free_split(state.split);
-    free_skel(state.skel);
-    free_dict(state.dict);
     if (err != NULL) {
         *err = state.error;
     } else {
@@ -870,6 +904,31 @@ void lns_put(FILE *out, struct lens *lens, struct tree *tree,
     }
 }
 
+void lns_put(FILE *out, struct lens *lens, struct tree *tree,
+             const char *text, size_t size, struct lns_error **err) {
+    struct skel *skel;
+    struct dict *dict = NULL;
+    struct lns_error *err1;
+
+    if (err != NULL)
+        *err = NULL;
+    if (tree == NULL)
+        return;
+
+    skel = lns_parse(lens, text, size, &dict, &err1);
+
+    if (err1 != NULL) {
+        if (err != NULL)
+            *err = err1;
+        else
+            free_lns_error(err1);
+        return;
+    }
+    lns_put_skel(out, lens, tree, text, skel, dict, err);
+    free_skel(skel);
+    free_dict(dict);
+}
+
 /*
  * Local variables:
  *  indent-tabs-mode: nil
@@ -35,8 +35,11 @@
  * owned by wherever the function stored it, and not the caller anymore; in
  * the second case, the caller and whereever the reference was stored both
  * own the reference.
+ *
+ * Reference counts are changed atomically, so that objects that are
+ * shared between threads, like the lenses of modules shared by several
+ * augeas handles, can be referenced and released from any of them.
  */
-// FIXME: This is not threadsafe; incr/decr ref needs to be protected
 
 #define REF_MAX UINT_MAX
 
@@ -49,13 +52,17 @@ int ref_make_ref(void *ptrptr, size_t size, size_t ref_ofs);
 
 #define make_ref_err(var) if (make_ref(var) < 0) goto error
 
-#define ref(s) (((s) == NULL || (s)->ref == REF_MAX) ? (s) : ((s)->ref++, (s)))
+#define ref_count(s) __atomic_load_n(&(s)->ref, __ATOMIC_RELAXED)
+
+#define ref(s)                                                          \
+    (((s) == NULL || ref_count(s) == REF_MAX) ? (s) :                   \
+     (__atomic_add_fetch(&(s)->ref, 1, __ATOMIC_RELAXED), (s)))
 
 #define unref(s, t)                                                     \
     do {                                                                \
-        if ((s) != NULL && (s)->ref != REF_MAX) {                       \
-            assert((s)->ref > 0);                                       \
-            if (--(s)->ref == 0) {                                      \
+        if ((s) != NULL && ref_count(s) != REF_MAX) {                   \
+            assert(ref_count(s) > 0);                                   \
+            if (__atomic_sub_fetch(&(s)->ref, 1, __ATOMIC_ACQ_REL) == 0) { \
                 /*memset(s, 255, sizeof(*s));*/                         \
                 free_##t(s);                                            \
             }                                                           \
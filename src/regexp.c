@@ -22,11 +22,16 @@
 
 #include <config.h>
 #include <regex.h>
+#if HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
 
 #include "internal.h"
 #include "syntax.h"
 #include "memory.h"
 #include "errcode.h"
+#include "hash.h"
+#include "fa.h"
 
 static const struct string empty_pattern_string = {
     .ref = REF_MAX, .str = (char *) "()"
@@ -34,6 +39,245 @@ static const struct string empty_pattern_string = {
 
 static const struct string *const empty_pattern = &empty_pattern_string;
 
+/*
+ * Interned compiled regexps
+ *
+ * Lenses build many regexps with the same pattern, e.g. through Rx.word or
+ * Sep.space. The compiled forms of a pattern, i.e. the buffer from
+ * RE_COMPILE_PATTERN, the automaton from FA_COMPILE and the DFAs built
+ * from it, are shared by all regexps with the same pattern and NOCASE
+ * flag, in all augeas handles in the process. Entries in the table
+ * COMPILED are reference counted by the regexps using them.
+ *
+ * Since handles, and the lenses of modules shared between handles, can be
+ * used from several threads at once, the table COMPILED and creating the
+ * compiled forms of a regexp are protected by REGEXP_LOCK. Matching fills
+ * in the transition table of a DFA and the registers of a pattern buffer;
+ * each thread therefore matches with a DFA and a pattern buffer of its
+ * own, and matching does not take the lock.
+ *
+ * Every thread that matches gets a small number, its slot, which it hands
+ * back when it exits. The forms of a thread are found by indexing
+ * C->LOCALS with its slot. They stay with the slot when the thread exits,
+ * and the next thread that gets the slot matches with them; the load
+ * pool starts new threads for every aug_load, which then do not have to
+ * build their DFAs again. There are never more slots than threads that
+ * matched at the same time.
+ */
+struct regexp_local {
+    struct re_pattern_buffer *re;      /* For matches with registers */
+    struct fa_dfa            *dfa;     /* For matches without registers */
+    unsigned int              uses;    /* Matches before DFA was built */
+    unsigned int              no_dfa : 1;  /* Building DFA failed */
+};
+
+/* The forms of each slot. The array is replaced by a bigger one when a
+ * thread with a higher slot comes along; the old one is kept in PREV since
+ * other threads may still be reading it */
+struct regexp_locals {
+    struct regexp_locals *prev;
+    unsigned int          n;
+    struct regexp_local **local;
+};
+
+struct compiled_regexp {
+    unsigned int              ref;
+    struct string            *pattern;
+    struct re_pattern_buffer *re;
+    struct fa                *fa;
+    struct regexp_locals     *locals;
+    unsigned int              nocase : 1;
+    unsigned int              re_taken : 1; /* RE belongs to one slot */
+};
+
+#if HAVE_PTHREAD_H
+static pthread_mutex_t regexp_lock = PTHREAD_MUTEX_INITIALIZER;
+# define LOCK_REGEXPS()   pthread_mutex_lock(&regexp_lock)
+# define UNLOCK_REGEXPS() pthread_mutex_unlock(&regexp_lock)
+#else
+# define LOCK_REGEXPS()
+# define UNLOCK_REGEXPS()
+#endif
+
+static hash_t *compiled = NULL;
+
+/* The number of slots handed out so far. Protected by REGEXP_LOCK */
+static unsigned int nslots = 0;
+
+#if HAVE_PTHREAD_H
+/* Which slots are in use by a thread. Protected by REGEXP_LOCK */
+static char *slot_used = NULL;
+
+/* Holds the slot of a thread plus one */
+static pthread_key_t slot_key;
+static pthread_once_t slot_key_once = PTHREAD_ONCE_INIT;
+static int slot_key_error = 0;
+
+/* Called when a thread that has matched exits: hand its slot, and with it
+ * its forms of all compiled regexps, to the next thread */
+static void release_slot(void *data) {
+    unsigned int slot = (uintptr_t) data - 1;
+
+    LOCK_REGEXPS();
+    if (slot < nslots)
+        slot_used[slot] = 0;
+    UNLOCK_REGEXPS();
+}
+
+static void make_slot_key(void) {
+    slot_key_error = pthread_key_create(&slot_key, release_slot);
+}
+#endif
+
+/* Return the slot of the calling thread, or -1 if we run out of memory */
+static int thread_slot(void) {
+#if HAVE_PTHREAD_H
+    void *data;
+    unsigned int slot;
+
+    if (pthread_once(&slot_key_once, make_slot_key) != 0
+        || slot_key_error != 0)
+        return -1;
+    data = pthread_getspecific(slot_key);
+    if (data != NULL)
+        return (uintptr_t) data - 1;
+
+    LOCK_REGEXPS();
+    for (slot = 0; slot < nslots && slot_used[slot]; slot++);
+    if (slot == nslots) {
+        if (REALLOC_N(slot_used, nslots + 1) < 0) {
+            UNLOCK_REGEXPS();
+            return -1;
+        }
+        nslots += 1;
+    }
+    slot_used[slot] = 1;
+    UNLOCK_REGEXPS();
+
+    if (pthread_setspecific(slot_key, (void *) (uintptr_t) (slot + 1)) != 0) {
+        release_slot((void *) (uintptr_t) (slot + 1));
+        return -1;
+    }
+    return slot;
+#else
+    nslots = 1;
+    return 0;
+#endif
+}
+
+static hash_val_t compiled_hash(const void *key) {
+    const struct compiled_regexp *c = key;
+    hash_val_t hash = c->nocase;
+
+    for (const char *s = c->pattern->str; *s != '\0'; s++)
+        hash = hash * 31 + (unsigned char) *s;
+    return hash;
+}
+
+static int compiled_cmp(const void *key1, const void *key2) {
+    const struct compiled_regexp *c1 = key1;
+    const struct compiled_regexp *c2 = key2;
+
+    if (c1->nocase != c2->nocase)
+        return 1;
+    return strcmp(c1->pattern->str, c2->pattern->str);
+}
+
+/* Called with REGEXP_LOCK held */
+static void free_compiled_regexp(struct compiled_regexp *c) {
+    hnode_t *node = hash_lookup(compiled, c);
+
+    hash_delete_free(compiled, node);
+    if (hash_isempty(compiled)) {
+        hash_destroy(compiled);
+        compiled = NULL;
+    }
+    unref(c->pattern, string);
+    for (unsigned int i=0; c->locals != NULL && i < c->locals->n; i++) {
+        struct regexp_local *l = c->locals->local[i];
+        if (l == NULL)
+            continue;
+        if (l->re != NULL && l->re != c->re) {
+            regfree(l->re);
+            free(l->re);
+        }
+        fa_dfa_free(l->dfa);
+        free(l);
+    }
+    while (c->locals != NULL) {
+        struct regexp_locals *ls = c->locals;
+        c->locals = ls->prev;
+        free(ls->local);
+        free(ls);
+    }
+    if (c->re != NULL) {
+        regfree(c->re);
+        free(c->re);
+    }
+    fa_free(c->fa);
+    free(c);
+}
+
+/* Drop the reference that R holds on its compiled forms */
+static void release_compiled(struct regexp *r) {
+    LOCK_REGEXPS();
+    unref(r->compiled, compiled_regexp);
+    UNLOCK_REGEXPS();
+}
+
+/* Return the compiled forms of R, interning them if needed. Return NULL
+ * if we run out of memory */
+static struct compiled_regexp *regexp_compiled(struct regexp *r) {
+    struct compiled_regexp key, *c = NULL;
+    hnode_t *node;
+
+    c = __atomic_load_n(&r->compiled, __ATOMIC_ACQUIRE);
+    if (c != NULL)
+        return c;
+
+    LOCK_REGEXPS();
+    if (r->compiled != NULL) {
+        c = r->compiled;
+        goto done;
+    }
+
+    if (compiled == NULL) {
+        compiled = hash_create(HASHCOUNT_T_MAX, compiled_cmp, compiled_hash);
+        if (compiled == NULL)
+            goto done;
+    }
+
+    MEMZERO(&key, 1);
+    key.pattern = r->pattern;
+    key.nocase = r->nocase;
+    node = hash_lookup(compiled, &key);
+    if (node != NULL) {
+        c = ref((struct compiled_regexp *) hnode_getkey(node));
+    } else {
+        if (make_ref(c) < 0)
+            goto error;
+        c->pattern = ref(r->pattern);
+        c->nocase = r->nocase;
+        if (hash_alloc_insert(compiled, c, NULL) < 0)
+            goto error;
+    }
+    __atomic_store_n(&r->compiled, c, __ATOMIC_RELEASE);
+ done:
+    UNLOCK_REGEXPS();
+    return c;
+ error:
+    if (c != NULL) {
+        unref(c->pattern, string);
+        free(c);
+        c = NULL;
+    }
+    if (hash_isempty(compiled)) {
+        hash_destroy(compiled);
+        compiled = NULL;
+    }
+    goto done;
+}
+
 char *regexp_escape(const struct regexp *r) {
     char *pat = NULL;
 
@@ -190,11 +434,8 @@ void free_regexp(struct regexp *regexp) {
         return;
     assert(regexp->ref == 0);
     unref(regexp->info, info);
+    release_compiled(regexp);
     unref(regexp->pattern, string);
-    if (regexp->re != NULL) {
-        regfree(regexp->re);
-        free(regexp->re);
-    }
     free(regexp);
 }
 
@@ -393,23 +634,41 @@ regexp_concat_n(struct info *info, int n, struct regexp **r) {
     return NULL;
 }
 
-static struct fa *regexp_to_fa(struct regexp *r) {
+int regexp_fa(struct regexp *r, struct fa **fa) {
+    struct compiled_regexp *c = regexp_compiled(r);
     const char *p = r->pattern->str;
     int ret;
+
+    *fa = NULL;
+    if (c == NULL)
+        return REG_ESPACE;
+
+    LOCK_REGEXPS();
+    ret = REG_NOERROR;
+    if (c->fa == NULL) {
+        ret = fa_compile(p, strlen(p), &c->fa);
+        if (ret == REG_NOERROR && r->nocase && fa_nocase(c->fa) < 0)
+            ret = REG_ESPACE;
+        if (ret != REG_NOERROR) {
+            fa_free(c->fa);
+            c->fa = NULL;
+        }
+    }
+    *fa = c->fa;
+    UNLOCK_REGEXPS();
+    return ret;
+}
+
+static struct fa *regexp_to_fa(struct regexp *r) {
+    int ret;
     struct fa *fa = NULL;
 
-    ret = fa_compile(p, strlen(p), &fa);
+    ret = regexp_fa(r, &fa);
     ERR_NOMEM(ret == REG_ESPACE, r->info);
     BUG_ON(ret != REG_NOERROR, r->info, NULL);
-
-    if (r->nocase) {
-        ret = fa_nocase(fa);
-        ERR_NOMEM(ret < 0, r->info);
-    }
     return fa;
 
  error:
-    fa_free(fa);
     return NULL;
 }
 
@@ -448,8 +707,6 @@ regexp_minus(struct info *info, struct regexp *r1, struct regexp *r2) {
 
  done:
     fa_free(fa);
-    fa_free(fa1);
-    fa_free(fa2);
     free(s);
     return result;
  error:
@@ -506,7 +763,11 @@ struct regexp *regexp_make_empty(struct info *info) {
     return regexp;
 }
 
-static int regexp_compile_internal(struct regexp *r, const char **c) {
+/* Compile R with RE_COMPILE_PATTERN into a new buffer *RE. Return NULL on
+ * success, and an error message otherwise. Called with REGEXP_LOCK held,
+ * since this changes RE_SYNTAX_OPTIONS */
+static const char *compile_pattern(struct regexp *r,
+                                   struct re_pattern_buffer **rep) {
     /* See the GNU regex manual or regex.h in gnulib for
      * an explanation of these flags. They are set so that the regex
      * matcher interprets regular expressions the same way that libfa
@@ -518,22 +779,64 @@ static int regexp_compile_internal(struct regexp *r, const char **c) {
         |RE_NO_BK_VBAR|RE_NO_EMPTY_RANGES
         |RE_NO_POSIX_BACKTRACKING|RE_CONTEXT_INVALID_DUP|RE_NO_GNU_OPS;
     reg_syntax_t old_syntax = re_syntax_options;
+    struct re_pattern_buffer *re = NULL;
+    const char *msg;
 
-    *c = NULL;
-
-    if (r->re == NULL)
-        CALLOC(r->re, 1);
+    if (ALLOC(re) < 0)
+        return "Memory exhausted";
 
     re_syntax_options = syntax;
     if (r->nocase)
         re_syntax_options |= RE_ICASE;
-    *c = re_compile_pattern(r->pattern->str, strlen(r->pattern->str), r->re);
+    msg = re_compile_pattern(r->pattern->str, strlen(r->pattern->str), re);
     re_syntax_options = old_syntax;
 
-    r->re->regs_allocated = REGS_REALLOCATE;
-    if (*c != NULL)
+    re->regs_allocated = REGS_REALLOCATE;
+    if (msg != NULL) {
+        regfree(re);
+        free(re);
+        return msg;
+    }
+    *rep = re;
+    return NULL;
+}
+
+/* Compile R with RE_COMPILE_PATTERN into C->RE. Return NULL on success,
+ * and an error message otherwise. Called with REGEXP_LOCK held */
+static const char *compile_re(struct regexp *r, struct compiled_regexp *c) {
+    struct re_pattern_buffer *re = NULL;
+    const char *msg = compile_pattern(r, &re);
+
+    /* REGEXP_NSUB looks at C->RE without taking the lock */
+    if (msg == NULL)
+        __atomic_store_n(&c->re, re, __ATOMIC_RELEASE);
+    return msg;
+}
+
+static int regexp_compile_internal(struct regexp *r, const char **c) {
+    struct compiled_regexp *comp = regexp_compiled(r);
+
+    *c = NULL;
+
+    if (comp == NULL) {
+        *c = "Memory exhausted";
         return -1;
-    return 0;
+    }
+
+    LOCK_REGEXPS();
+    if (comp->re == NULL)
+        *c = compile_re(r, comp);
+    UNLOCK_REGEXPS();
+    return (*c == NULL) ? 0 : -1;
+}
+
+/* Return the buffer from RE_COMPILE_PATTERN for R, or NULL if R can not be
+ * compiled. Called with REGEXP_LOCK held */
+static struct re_pattern_buffer *regexp_re(struct regexp *r,
+                                           struct compiled_regexp *c) {
+    if (c->re == NULL && compile_re(r, c) != NULL)
+        return NULL;
+    return c->re;
 }
 
 int regexp_compile(struct regexp *r) {
@@ -546,32 +849,238 @@ int regexp_check(struct regexp *r, const char **msg) {
     return regexp_compile_internal(r, msg);
 }
 
+/* The number of states of a DFA that are kept between matches */
+#define REGEXP_DFA_MAX_STATES 2048
+
+/* Building a DFA costs a lot more than compiling with RE_COMPILE, and is
+ * only worth it for regexps that are matched many times; we only build it
+ * once a thread has used a regexp this many times */
+#define REGEXP_DFA_MIN_USES 16
+
+/* Return the forms of C for the calling thread, adding them if needed.
+ * Return NULL if we run out of memory */
+static struct regexp_local *regexp_local(struct compiled_regexp *c) {
+    struct regexp_locals *ls, *nls = NULL;
+    struct regexp_local *l = NULL;
+    int slot = thread_slot();
+
+    if (slot < 0)
+        return NULL;
+    ls = __atomic_load_n(&c->locals, __ATOMIC_ACQUIRE);
+    if (ls != NULL && (unsigned int) slot < ls->n && ls->local[slot] != NULL)
+        return ls->local[slot];
+
+    if (ALLOC(l) < 0)
+        return NULL;
+    LOCK_REGEXPS();
+    ls = c->locals;
+    if (ls == NULL || (unsigned int) slot >= ls->n) {
+        if (ALLOC(nls) < 0 || ALLOC_N(nls->local, nslots) < 0) {
+            UNLOCK_REGEXPS();
+            free(nls);
+            free(l);
+            return NULL;
+        }
+        nls->n = nslots;
+        nls->prev = ls;
+        if (ls != NULL)
+            memcpy(nls->local, ls->local, ls->n * sizeof(*ls->local));
+        __atomic_store_n(&c->locals, nls, __ATOMIC_RELEASE);
+        ls = nls;
+    }
+    ls->local[slot] = l;
+    UNLOCK_REGEXPS();
+    return l;
+}
+
+/* Return the buffer from RE_COMPILE_PATTERN for matching R in the calling
+ * thread, or NULL if R can not be compiled. The first slot that asks gets
+ * C->RE, the others compile a buffer of their own */
+static struct re_pattern_buffer *local_re(struct regexp *r,
+                                          struct compiled_regexp *c,
+                                          struct regexp_local *l) {
+    if (l->re != NULL)
+        return l->re;
+
+    LOCK_REGEXPS();
+    if (regexp_re(r, c) != NULL) {
+        if (! c->re_taken) {
+            l->re = c->re;
+            c->re_taken = 1;
+        } else {
+            compile_pattern(r, &l->re);
+        }
+    }
+    UNLOCK_REGEXPS();
+    return l->re;
+}
+
+/* Return the DFA for matching R in the calling thread, or NULL if R
+ * should be matched with GNU regex. The DFA is built from an automaton of
+ * its own, since the shared one in R->COMPILED->FA may be in use by the
+ * module compiler in another thread */
+static struct fa_dfa *regexp_dfa(struct regexp *r) {
+    struct compiled_regexp *c = regexp_compiled(r);
+    struct regexp_local *d;
+    struct fa *fa = NULL;
+    const char *p = r->pattern->str;
+
+    if (c == NULL || (d = regexp_local(c)) == NULL)
+        return NULL;
+
+    if (d->dfa == NULL && ! d->no_dfa) {
+        if (d->uses < REGEXP_DFA_MIN_USES) {
+            d->uses += 1;
+            return NULL;
+        }
+        if (fa_compile(p, strlen(p), &fa) == REG_NOERROR
+            && (! r->nocase || fa_nocase(fa) == 0))
+            d->dfa = fa_make_dfa(fa, REGEXP_DFA_MAX_STATES);
+        d->no_dfa = (d->dfa == NULL);
+        fa_free(fa);
+    }
+    return d->dfa;
+}
+
 int regexp_match(struct regexp *r,
                  const char *string, const int size,
                  const int start, struct re_registers *regs) {
-    if (r->re == NULL) {
-        if (regexp_compile(r) == -1)
-            return -3;
+    struct compiled_regexp *c;
+    struct regexp_local *l;
+    struct re_pattern_buffer *re;
+    struct fa_dfa *dfa;
+
+    if (regs == NULL && start <= size && (dfa = regexp_dfa(r)) != NULL) {
+        int m = fa_dfa_match(dfa, string + start, size - start);
+        if (m != -2)
+            return m;
+    }
+    if ((c = regexp_compiled(r)) == NULL || (l = regexp_local(c)) == NULL)
+        return -3;
+    re = local_re(r, c, l);
+    if (re == NULL)
+        return -3;
+    return re_match(re, string, size, start, regs);
+}
+
+/* Bookkeeping for regexp_split; the rows of ENDS and FAILED each have LEN
+ * + 1 entries, one row per regexp */
+struct split_state {
+    int             n;
+    struct fa_dfa **dfas;
+    const char     *text;
+    int             len;
+    char           *ends;
+    char           *failed;
+    int            *split;
+};
+
+/* Split TEXT[POS..LEN] among the regexps I..N-1 */
+static int split_from(struct split_state *st, int i, int pos) {
+    char *failed = st->failed + i * (st->len + 1) + pos;
+    int rest = st->len - pos;
+
+    if (*failed)
+        return -1;
+
+    if (i == st->n - 1) {
+        int k = fa_dfa_match(st->dfas[i], st->text + pos, rest);
+        if (k == -2)
+            return -2;
+        if (k == rest)
+            return 0;
+    } else {
+        char *ends = st->ends + i * (st->len + 1);
+        int k = fa_dfa_prefixes(st->dfas[i], st->text + pos, rest, ends);
+        if (k == -2)
+            return -2;
+        for (; k >= 0; k--) {
+            if (ends[k]) {
+                int r = split_from(st, i + 1, pos + k);
+                if (r == 0)
+                    st->split[i + 1] = pos + k;
+                if (r != -1)
+                    return r;
+            }
+        }
     }
-    return re_match(r->re, string, size, start, regs);
+    *failed = 1;
+    return -1;
 }
 
+int regexp_split(int n, struct regexp **r, const char *text,
+                 int start, int end, int *split) {
+    struct split_state st;
+    int result = -2;
+
+    MEMZERO(&st, 1);
+    st.n = n;
+    st.text = text + start;
+    st.len = end - start;
+    st.split = split;
+
+    if (ALLOC_N(st.dfas, n) < 0)
+        goto done;
+    for (int i=0; i < n; i++) {
+        if ((st.dfas[i] = regexp_dfa(r[i])) == NULL)
+            goto done;
+    }
+    if (ALLOC_N(st.ends, n * (st.len + 1)) < 0
+        || ALLOC_N(st.failed, n * (st.len + 1)) < 0)
+        goto done;
+
+    result = split_from(&st, 0, 0);
+    if (result == 0) {
+        split[0] = 0;
+        split[n] = st.len;
+        for (int i=0; i <= n; i++)
+            split[i] += start;
+    }
+ done:
+    free(st.dfas);
+    free(st.ends);
+    free(st.failed);
+    return result;
+}
+
+/* This is mostly called once per regexp when lenses are constructed, where
+ * building a DFA would cost more than it saves */
 int regexp_matches_empty(struct regexp *r) {
-    return regexp_match(r, "", 0, 0, NULL) == 0;
+    struct compiled_regexp *c = regexp_compiled(r);
+    struct re_pattern_buffer *re;
+    struct regexp_local *l;
+    int m;
+
+    if (c == NULL || (l = regexp_local(c)) == NULL)
+        return 0;
+    if (l->dfa != NULL) {
+        m = fa_dfa_match(l->dfa, "", 0);
+        if (m != -2)
+            return m == 0;
+    }
+    re = local_re(r, c, l);
+    return re != NULL && re_match(re, "", 0, 0, NULL) == 0;
 }
 
 int regexp_nsub(struct regexp *r) {
-    if (r->re == NULL)
-        if (regexp_compile(r) == -1)
-            return -1;
-    return r->re->re_nsub;
+    struct compiled_regexp *c = regexp_compiled(r);
+    struct re_pattern_buffer *re;
+
+    if (c == NULL)
+        return -1;
+    re = __atomic_load_n(&c->re, __ATOMIC_ACQUIRE);
+    if (re == NULL) {
+        LOCK_REGEXPS();
+        re = regexp_re(r, c);
+        UNLOCK_REGEXPS();
+    }
+    return (re == NULL) ? -1 : (int) re->re_nsub;
 }
 
 void regexp_release(struct regexp *regexp) {
-    if (regexp != NULL && regexp->re != NULL) {
-        regfree(regexp->re);
-        FREE(regexp->re);
-    }
+    if (regexp == NULL)
+        return;
+    release_compiled(regexp);
 }
 
 /*
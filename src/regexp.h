@@ -26,11 +26,15 @@
 #include <stdio.h>
 #include <regex.h>
 
+struct fa;
+struct compiled_regexp;
+
 struct regexp {
     unsigned int              ref;
     struct info              *info;
     struct string            *pattern;
-    struct re_pattern_buffer *re;
+    /* Shared with all regexps with the same pattern and NOCASE */
+    struct compiled_regexp   *compiled;
     unsigned int              nocase : 1;
 };
 
@@ -62,8 +66,12 @@ struct regexp *make_regexp_from_glob(struct info *info, const char *glob);
 /* Do not call directly, use UNREF instead */
 void free_regexp(struct regexp *regexp);
 
-/* Compile R->PATTERN into R->RE; return -1 and print an error
- * if compilation fails. Return 0 otherwise
+/* Compile R->PATTERN with RE_COMPILE_PATTERN; return -1 and print an
+ * error if compilation fails. Return 0 otherwise
+ *
+ * Compiled regexps are interned: regexps with the same pattern and NOCASE
+ * flag share their compiled forms, even across augeas handles, and each
+ * pattern is only compiled once.
  */
 int regexp_compile(struct regexp *r);
 
@@ -73,15 +81,41 @@ int regexp_compile(struct regexp *r);
  */
 int regexp_check(struct regexp *r, const char **msg);
 
-/* Call RE_MATCH on R->RE and return its result; if R hasn't been compiled
+/* Call RE_MATCH on R and return its result; if R hasn't been compiled
  * yet, compile it. Return -3 if compilation fails
+ *
+ * If REGS is NULL and R has been matched often enough, the match is done
+ * with a DFA built from R instead, which takes time linear in SIZE -
+ * START.
  */
 int regexp_match(struct regexp *r, const char *string, const int size,
                  const int start, struct re_registers *regs);
 
+/* Split the text from START to END in STRING into N pieces, so that the
+ * i-th piece is matched by R[i]. If there is more than one way to do that,
+ * earlier pieces are made as long as possible. This uses the same DFAs as
+ * REGEXP_MATCH without registers, and avoids backtracking.
+ *
+ * On success, store the start of the i-th piece in SPLIT[i] and END in
+ * SPLIT[N], and return 0. Return -1 if the text can not be split that
+ * way, and -2 if one of R can not be matched with a DFA; callers should
+ * then use REGEXP_MATCH with registers.
+ */
+int regexp_split(int n, struct regexp **r, const char *string,
+                 int start, int end, int *split);
+
 /* Return 1 if R matches the empty string, 0 otherwise */
 int regexp_matches_empty(struct regexp *r);
 
+/* Set *FA to the automaton for R, building it if needed. The automaton is
+ * shared with other regexps; the caller must not free it, or change the
+ * language it accepts. Since libfa reorganizes the automata it works on,
+ * it must only be used while modules are compiled, which never happens in
+ * two threads at once. Return REG_NOERROR on success, and the error from
+ * FA_COMPILE otherwise.
+ */
+int regexp_fa(struct regexp *r, struct fa **fa);
+
 /* Return the number of subexpressions (parentheses) inside R. May cause
  * compilation of R; return -1 if compilation fails.
  */
@@ -114,7 +148,8 @@ regexp_maybe(struct info *info, struct regexp *r);
 struct regexp *regexp_make_empty(struct info *);
 
 /* Free up temporary data structures, most importantly compiled
-   regular expressions */
+   regular expressions. Compiled forms that are still used by other
+   regexps are kept. REGEXP must not be in use by another thread */
 void regexp_release(struct regexp *regexp);
 
 /* Produce a printable representation of R */
@@ -31,18 +31,32 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#if HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
 
 #include "memory.h"
 #include "syntax.h"
 #include "augeas.h"
 #include "transform.h"
 #include "errcode.h"
-
-/* Extension of source files */
-#define AUG_EXT ".aug"
+#include "lenscache.h"
 
 #define LNS_TYPE_CHECK(ctx) ((ctx)->aug->flags & AUG_TYPE_CHECK)
 
+/* Handles in different threads can compile modules at the same time, but
+ * the automata of compiled regexps are shared by all handles (see
+ * regexp.c), and libfa changes them while lenses are typechecked. We
+ * therefore only ever compile modules in one thread at a time */
+#if HAVE_PTHREAD_H
+static pthread_mutex_t compile_lock = PTHREAD_MUTEX_INITIALIZER;
+# define LOCK_COMPILE()   pthread_mutex_lock(&compile_lock)
+# define UNLOCK_COMPILE() pthread_mutex_unlock(&compile_lock)
+#else
+# define LOCK_COMPILE()
+# define UNLOCK_COMPILE()
+#endif
+
 static const char *const builtin_module = "Builtin";
 
 static const struct type string_type    = { .ref = UINT_MAX, .tag = T_STRING };
@@ -233,6 +247,7 @@ void free_module(struct module *module) {
     unref(module->next, module);
     unref(module->bindings, binding);
     unref(module->autoload, transform);
+    unref(module->error, error);
     free(module);
 }
 
@@ -452,6 +467,8 @@ void exn_printf_line(struct value *exn, const char *format, ...) {
  * Modules
  */
 static int load_module(struct augeas *aug, const char *name);
+static struct module *reload_module(struct augeas *aug,
+                                    struct module *module);
 static char *module_basename(const char *modname);
 
 struct module *module_create(const char *name) {
@@ -503,6 +520,14 @@ static int lookup_internal(struct augeas *aug, const char *ctx_modname,
     list_for_each(module, aug->modules) {
         if (STRCASEEQ(module->name, modname)) {
             *bnd = bnd_lookup(module->bindings, name + strlen(modname) + 1);
+            if (*bnd == NULL && (module->cached || module->lazy)) {
+                /* Either the module is lazy, or we need a function,
+                 * which the cache does not have */
+                if (reload_module(aug, module) != NULL)
+                    goto qual_lookup;
+                free(modname);
+                return -1;
+            }
             free(modname);
             return 0;
         }
@@ -522,8 +547,12 @@ static int lookup_internal(struct augeas *aug, const char *ctx_modname,
 
 struct lens *lens_lookup(struct augeas *aug, const char *qname) {
     struct binding *bnd = NULL;
+    int r;
 
-    if (lookup_internal(aug, NULL, qname, &bnd) < 0)
+    LOCK_COMPILE();
+    r = lookup_internal(aug, NULL, qname, &bnd);
+    UNLOCK_COMPILE();
+    if (r < 0)
         return NULL;
     if (bnd == NULL || bnd->value->tag != V_LENS)
         return NULL;
@@ -1962,7 +1991,7 @@ static char *module_filename(struct augeas *aug, const char *modname) {
     return filename;
 }
 
-int load_module_file(struct augeas *aug, const char *filename) {
+static int compile_module_file(struct augeas *aug, const char *filename) {
     struct term *term = NULL;
     int result = -1;
 
@@ -1989,8 +2018,19 @@ int load_module_file(struct augeas *aug, const char *filename) {
     return result;
 }
 
+int load_module_file(struct augeas *aug, const char *filename) {
+    int r;
+
+    LOCK_COMPILE();
+    r = compile_module_file(aug, filename);
+    UNLOCK_COMPILE();
+    return r;
+}
+
 static int load_module(struct augeas *aug, const char *name) {
     char *filename = NULL;
+    struct module *module = NULL;
+    int r;
 
     if (module_find(aug->modules, name) != NULL)
         return 0;
@@ -1998,9 +2038,23 @@ static int load_module(struct augeas *aug, const char *name) {
     if ((filename = module_filename(aug, name)) == NULL)
         return -1;
 
-    if (load_module_file(aug, filename) == -1)
+    r = lens_cache_load(aug, filename, &module);
+    if (r < 0)
         goto error;
 
+    if (r > 0) {
+        if (aug->flags & AUG_TRACE_MODULE_LOADING)
+            printf("Module %s loaded from cache\n", filename);
+        list_append(aug->modules, module);
+    } else {
+        if (compile_module_file(aug, filename) == -1)
+            goto error;
+        /* The module we just compiled is the last one in the list */
+        for (module = aug->modules; module->next != NULL;
+             module = module->next);
+        lens_cache_store(aug, filename, module);
+    }
+
     free(filename);
     return 0;
 
@@ -2009,7 +2063,228 @@ static int load_module(struct augeas *aug, const char *name) {
     return -1;
 }
 
-int interpreter_init(struct augeas *aug) {
+/* Replace MODULE, which was restored from the lens cache without its
+ * functions or only indexed lazily, by compiling it from source. Return
+ * the compiled module */
+static struct module *reload_module(struct augeas *aug,
+                                    struct module *module) {
+    char *filename = NULL;
+    struct module *result = NULL;
+
+    if ((filename = module_filename(aug, module->name)) == NULL)
+        return NULL;
+
+    list_remove(module, aug->modules);
+    if (compile_module_file(aug, filename) < 0) {
+        list_append(aug->modules, module);
+    } else {
+        for (result = aug->modules; result->next != NULL;
+             result = result->next);
+        if (module->lazy)
+            lens_cache_store(aug, filename, result);
+        unref(module, module);
+    }
+    free(filename);
+    return result;
+}
+
+struct module *module_force(struct augeas *aug, struct module *module) {
+    struct module *result;
+
+    if (! module->lazy)
+        return module;
+    LOCK_COMPILE();
+    result = reload_module(aug, module);
+    UNLOCK_COMPILE();
+    return result;
+}
+
+/* Find the last binding for NAME among the first N declarations DECLS */
+static int decl_index(struct term **decls, int n, const char *name) {
+    for (int i = n - 1; i >= 0; i--) {
+        if (decls[i]->tag == A_BIND && STREQ(decls[i]->bname, name))
+            return i;
+    }
+    return -1;
+}
+
+/* Mark the declarations among the first N DECLS that TERM refers to as
+ * NEEDED, together with the ones they refer to in turn. We do not bother
+ * with names that are shadowed by let or function parameters; marking a
+ * few declarations too many is harmless */
+static void mark_needed(struct term *term, const char *mname,
+                        struct term **decls, int n, bool *needed) {
+    if (term == NULL)
+        return;
+
+    switch(term->tag) {
+    case A_IDENT: {
+        const char *name = term->ident->str;
+        int nlen = strlen(mname);
+        int i;
+
+        if (STREQLEN(mname, name, nlen) && name[nlen] == '.')
+            name += nlen + 1;
+        if (strchr(name, '.') != NULL)
+            break;
+        i = decl_index(decls, n, name);
+        if (i >= 0 && !needed[i]) {
+            needed[i] = true;
+            mark_needed(decls[i]->exp, mname, decls, i, needed);
+        }
+        break;
+    }
+    case A_BIND:
+        mark_needed(term->exp, mname, decls, n, needed);
+        break;
+    case A_COMPOSE:
+    case A_UNION:
+    case A_MINUS:
+    case A_CONCAT:
+    case A_APP:
+    case A_LET:
+        mark_needed(term->left, mname, decls, n, needed);
+        mark_needed(term->right, mname, decls, n, needed);
+        break;
+    case A_BRACKET:
+        mark_needed(term->brexp, mname, decls, n, needed);
+        break;
+    case A_FUNC:
+        mark_needed(term->body, mname, decls, n, needed);
+        break;
+    case A_REP:
+        mark_needed(term->rexp, mname, decls, n, needed);
+        break;
+    default:
+        break;
+    }
+}
+
+/* Build a lazy module for the module TERM. When the autoload transform is
+ * written as 'transform LENS FILTER', only FILTER and the declarations it
+ * needs are typechecked and compiled; the lens is compiled when the
+ * module is forced. Return NULL without reporting an error if the
+ * autoload transform does not have that form */
+static struct module *index_module(struct term *term, struct augeas *aug) {
+    struct term **decls = NULL, *filter = NULL;
+    bool *needed = NULL;
+    struct ctx tctx, cctx;
+    struct value *v = NULL;
+    struct module *module = NULL;
+    int ndecls = 0, a;
+
+    tctx.aug = cctx.aug = aug;
+    tctx.local = cctx.local = NULL;
+    tctx.name = cctx.name = term->mname;
+
+    list_for_each(dcl, term->decls)
+        ndecls += 1;
+    if (ALLOC_N(decls, ndecls) < 0 || ALLOC_N(needed, ndecls) < 0)
+        goto nomem;
+    ndecls = 0;
+    list_for_each(dcl, term->decls)
+        decls[ndecls++] = dcl;
+
+    a = decl_index(decls, ndecls, term->autoload);
+    if (a >= 0) {
+        struct term *exp = decls[a]->exp;
+        if (exp->tag == A_APP && exp->left->tag == A_APP
+            && exp->left->left->tag == A_IDENT
+            && STREQ(exp->left->left->ident->str, "transform")
+            && decl_index(decls, a, "transform") < 0)
+            filter = exp->right;
+    }
+    if (filter == NULL)
+        goto done;
+
+    mark_needed(filter, term->mname, decls, a, needed);
+    for (int i=0; i < a; i++) {
+        if (needed[i] && !check_decl(decls[i], &tctx))
+            goto error;
+    }
+    if (!check_exp(filter, &tctx))
+        goto error;
+    if (expect_types(filter->info, filter->type, 1, t_filter) == NULL)
+        goto error;
+    for (int i=0; i < a; i++) {
+        if (needed[i] && !compile_decl(decls[i], &cctx))
+            goto error;
+    }
+    v = compile_exp(filter->info, filter, &cctx);
+    if (EXN(v) || HAS_ERR(aug))
+        goto error;
+
+    module = module_create(term->mname);
+    if (module == NULL)
+        goto nomem;
+    module->lazy = 1;
+    module->autoload = make_transform(NULL, ref(v->filter));
+    if (module->autoload == NULL)
+        goto nomem;
+ done:
+    unref(v, value);
+    unref(tctx.local, binding);
+    unref(cctx.local, binding);
+    free(decls);
+    free(needed);
+    return module;
+ nomem:
+    report_error(aug->error, AUG_ENOMEM, NULL);
+ error:
+    if (! HAS_ERR(aug))
+        syntax_error(term->info, "Failed to index module %s", term->mname);
+    unref(module, module);
+    goto done;
+}
+
+/* With AUG_LAZY_MODULES, only modules with an autoload transform are put
+ * into AUG->MODULES at startup, and only as lazy modules. Everything else
+ * is compiled when it is first needed */
+static int index_module_file(struct augeas *aug, const char *name) {
+    char *filename = NULL;
+    struct term *term = NULL;
+    struct module *module = NULL;
+    int r, result = -1;
+
+    if (module_find(aug->modules, name) != NULL)
+        return 0;
+
+    if ((filename = module_filename(aug, name)) == NULL)
+        return -1;
+
+    r = lens_cache_load(aug, filename, &module);
+    if (r < 0)
+        goto error;
+
+    if (r == 0) {
+        augl_parse_file(aug, filename, &term);
+        ERR_BAIL(aug);
+
+        if (term->autoload == NULL) {
+            result = 0;
+            goto error;
+        }
+
+        module = index_module(term, aug);
+        ERR_BAIL(aug);
+        if (module == NULL) {
+            result = load_module(aug, name);
+            goto error;
+        }
+        if (aug->flags & AUG_TRACE_MODULE_LOADING)
+            printf("Module %s indexed\n", filename);
+    } else if (aug->flags & AUG_TRACE_MODULE_LOADING) {
+        printf("Module %s loaded from cache\n", filename);
+    }
+    list_append(aug->modules, module);
+    result = 0;
+ error:
+    unref(term, term);
+    free(filename);
+    return result;
+}
+
+static int load_modules(struct augeas *aug) {
     int r;
 
     r = init_fatal_exn(aug->error);
@@ -2056,7 +2331,11 @@ int interpreter_init(struct augeas *aug) {
         q = strchr(p, '.');
         name = strndup(p, q - p);
         name[0] = toupper(name[0]);
-        if (load_module(aug, name) == -1)
+        if (aug->flags & AUG_LAZY_MODULES)
+            r = index_module_file(aug, name);
+        else
+            r = load_module(aug, name);
+        if (r == -1)
             goto error;
         free(name);
     }
@@ -2067,6 +2346,42 @@ int interpreter_init(struct augeas *aug) {
     return -1;
 }
 
+int interpreter_init(struct augeas *aug) {
+    int r;
+
+    LOCK_COMPILE();
+    r = load_modules(aug);
+    UNLOCK_COMPILE();
+    return r;
+}
+
+int interpreter_share(struct augeas *aug, struct augeas *orig) {
+    struct module *modules = NULL;
+
+    if (init_fatal_exn(aug->error) < 0)
+        return -1;
+
+    list_for_each(m, orig->modules) {
+        struct module *copy = module_create(m->name);
+        if (copy == NULL || copy->name == NULL) {
+            unref(copy, module);
+            goto error;
+        }
+        copy->bindings = ref(m->bindings);
+        copy->autoload = ref(m->autoload);
+        copy->cached = m->cached;
+        copy->lazy = m->lazy;
+        copy->error = ref(m->error != NULL ? m->error : orig->error);
+        list_append(modules, copy);
+    }
+    aug->modules = modules;
+    return 0;
+ error:
+    unref(modules, module);
+    ERR_REPORT(aug, AUG_ENOMEM, NULL);
+    return -1;
+}
+
 /*
  * Local variables:
  *  indent-tabs-mode: nil
@@ -31,6 +31,9 @@
 #include "regexp.h"
 #include "info.h"
 
+/* Extension of source files */
+#define AUG_EXT ".aug"
+
 void syntax_error(struct info *info, const char *format, ...)
     ATTRIBUTE_FORMAT(printf, 2, 3);
 
@@ -210,6 +213,15 @@ struct module {
     struct transform  *autoload;
     char              *name;
     struct binding    *bindings;
+    /* Restored from the lens cache without its functions; the module
+     * needs to be compiled from source to look those up */
+    unsigned int       cached : 1;
+    /* Only indexed with AUG_LAZY_MODULES; the module has no bindings and
+     * its autoload transform has a filter, but no lens */
+    unsigned int       lazy : 1;
+    /* For a module shared with the handle that compiled it, the error of
+     * that handle, which the values in BINDINGS report errors to */
+    struct error      *error;
 };
 
 struct type *make_arrow_type(struct type *dom, struct type *img);
@@ -281,7 +293,17 @@ int load_module_file(struct augeas *aug, const char *filename);
 
 int interpreter_init(struct augeas *aug);
 
+/* Like INTERPRETER_INIT, but use the modules that ORIG has loaded instead
+ * of loading them again. AUG gets its own list of modules, which share
+ * their bindings and autoload transforms with those of ORIG */
+int interpreter_share(struct augeas *aug, struct augeas *orig);
+
 struct lens *lens_lookup(struct augeas *aug, const char *qname);
+
+/* Compile MODULE from source if it was only indexed lazily. Return the
+ * compiled module, which replaces MODULE in AUG->MODULES, or MODULE itself
+ * if it was not lazy. Return NULL on error */
+struct module *module_force(struct augeas *aug, struct module *module);
 #endif
 
 
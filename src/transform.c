@@ -31,13 +31,20 @@
 #include <unistd.h>
 #include <selinux/selinux.h>
 #include <stdbool.h>
+#if HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
 
 #include "internal.h"
 #include "memory.h"
 #include "augeas.h"
 #include "syntax.h"
 #include "transform.h"
+#include "watch.h"
 #include "errcode.h"
+#include "arena.h"
+#include "hash.h"
+#include "stat-time.h"
 
 static const int fnm_flags = FNM_PATHNAME;
 static const int glob_flags = GLOB_NOSORT;
@@ -201,6 +208,29 @@ static bool file_current(struct augeas *aug, const char *fname,
     return (file != NULL && ! file->dirty);
 }
 
+/* Return 1 if the file FNAME, which is at PATH relative to the root, is
+ * not excluded by any 'excl' entry of XFM and is a regular file, 0 if it
+ * is not, and -1 on error */
+static int filter_keep(struct tree *xfm, const char *path, const char *fname) {
+    int r;
+
+    list_for_each(e, xfm->children) {
+        if (! is_excl(e))
+            continue;
+
+        if (strchr(e->value, SEP) == NULL)
+            path = pathbase(path);
+
+        r = fnmatch_normalize(e->value, path, fnm_flags);
+        if (r < 0)
+            return -1;
+        else if (r == 0)
+            return 0;
+    }
+
+    return is_regular_file(fname);
+}
+
 static int filter_generate(struct tree *xfm, const char *root,
                            int *nmatches, char ***matches) {
     glob_t globbuf;
@@ -235,27 +265,12 @@ static int filter_generate(struct tree *xfm, const char *root,
         goto error;
 
     for (int i=0; i < pathc; i++) {
-        const char *path = globbuf.gl_pathv[i] + root_prefix;
-        bool include = true;
-
-        list_for_each(e, xfm->children) {
-            if (! is_excl(e))
-                continue;
-
-            if (strchr(e->value, SEP) == NULL)
-                path = pathbase(path);
-
-            r = fnmatch_normalize(e->value, path, fnm_flags);
-            if (r < 0)
-                goto error;
-            else if (r == 0)
-                include = false;
-        }
-
-        if (include)
-            include = is_regular_file(globbuf.gl_pathv[i]);
+        r = filter_keep(xfm, globbuf.gl_pathv[i] + root_prefix,
+                        globbuf.gl_pathv[i]);
+        if (r < 0)
+            goto error;
 
-        if (include) {
+        if (r) {
             pathv[pathind] = strdup(globbuf.gl_pathv[i]);
             if (pathv[pathind] == NULL)
                 goto error;
@@ -281,6 +296,65 @@ static int filter_generate(struct tree *xfm, const char *root,
     goto done;
 }
 
+/* Like filter_generate, but only consider the NFILES files in FILES,
+ * which all start with ROOT, instead of globbing the filesystem */
+static int filter_select(struct tree *xfm, const char *root,
+                         int nfiles, char **files,
+                         int *nmatches, char ***matches) {
+    char **pathv = NULL;
+    int pathc = 0;
+    int root_prefix = strlen(root) - 1;
+    int r;
+
+    *nmatches = 0;
+    *matches = NULL;
+
+    if (ALLOC_N(pathv, nfiles) < 0)
+        goto error;
+
+    for (int i=0; i < nfiles; i++) {
+        const char *path = files[i] + root_prefix;
+        bool include = false;
+
+        if (STRNEQLEN(files[i], root, root_prefix))
+            continue;
+
+        /* glob(3) does not match a leading '.' with a wildcard */
+        list_for_each(f, xfm->children) {
+            if (! is_incl(f))
+                continue;
+            r = fnmatch_normalize(f->value, path, fnm_flags|FNM_PERIOD);
+            if (r < 0)
+                goto error;
+            else if (r == 0) {
+                include = true;
+                break;
+            }
+        }
+        if (! include)
+            continue;
+
+        r = filter_keep(xfm, path, files[i]);
+        if (r < 0)
+            goto error;
+        if (r) {
+            pathv[pathc] = strdup(files[i]);
+            if (pathv[pathc] == NULL)
+                goto error;
+            pathc += 1;
+        }
+    }
+
+    *matches = pathv;
+    *nmatches = pathc;
+    return 0;
+ error:
+    for (int i=0; i < pathc; i++)
+        free(pathv[i]);
+    free(pathv);
+    return -1;
+}
+
 static int filter_matches(struct tree *xfm, const char *path) {
     int found = 0;
     list_for_each(f, xfm->children) {
@@ -493,19 +567,6 @@ static int add_file_info(struct augeas *aug, const char *node,
     return result;
 }
 
-static char *append_newline(char *text, size_t len) {
-    /* Try to append a newline; this is a big hack to work */
-    /* around the fact that lenses generally break if the  */
-    /* file does not end with a newline. */
-    if (len == 0 || text[len-1] != '\n') {
-        if (REALLOC_N(text, len+2) == 0) {
-            text[len] = '\n';
-            text[len+1] = '\0';
-        }
-    }
-    return text;
-}
-
 /* Turn the file name FNAME, which starts with aug->root, into
  * a path in the tree underneath /files */
 static char *file_name_path(struct augeas *aug, const char *fname) {
@@ -515,90 +576,378 @@ static char *file_name_path(struct augeas *aug, const char *fname) {
     return path;
 }
 
-/* Replace the subtree for FPATH with SUB */
-static void tree_freplace(struct augeas *aug, const char *fpath,
-                         struct tree *sub) {
+/* Replace the subtree for FPATH with SUB, and return the node for
+ * FPATH */
+static struct tree *tree_freplace(struct augeas *aug, const char *fpath,
+                                  struct tree *sub) {
     struct tree *parent;
 
     parent = tree_fpath_cr(aug, fpath);
-    ERR_RET(aug);
+    ERR_BAIL(aug);
 
     tree_unlink_children(aug, parent);
     list_append(parent->children, sub);
     list_for_each(s, sub) {
         s->parent = parent;
     }
+    tree_labels_changed(parent);
+    return parent;
+ error:
+    return NULL;
 }
 
-static int load_file(struct augeas *aug, struct lens *lens,
-                     const char *lens_name, char *filename) {
-    char *text = NULL;
-    const char *err_status = NULL;
-    struct tree *tree = NULL;
-    char *path = NULL;
-    struct lns_error *err = NULL;
-    struct span *span = NULL;
-    int result = -1, r, text_len = 0;
+/*
+ * With AUG_INCREMENTAL_SAVE, we keep the text of every file we load,
+ * together with the skeleton and dictionary that lns_get_skel makes from
+ * it while making the tree, with each dictionary entry bound to the node
+ * that was made from the same text. When the file is saved, lns_put_skel
+ * does not need to parse the file again, and copies the text of subtrees
+ * whose nodes have not been modified, rather than putting them again.
+ *
+ * An entry can only be used as long as the file on disk has not changed
+ * since we read TEXT from it, going by its modification time, size and
+ * inode, and none of the nodes underneath TREE were modified without
+ * marking them dirty. Since tree_clean clears the dirty flags, entries
+ * for modified files are dropped before it is called. The entry holds a
+ * reference to the arena the nodes were allocated from, so that no other
+ * node can ever have the address of one of them.
+ */
+struct parsed_file {
+    hnode_t       node;
+    char         *path;       /* The path of the file node; the key */
+    struct tree  *tree;       /* The file node underneath /files */
+    struct lens  *lens;
+    struct arena *arena;
+    struct stat   st;         /* Of the file when we read TEXT */
+    struct file_text text;
+    struct skel  *skel;
+    struct dict  *dict;
+};
+
+static void free_parsed_file(struct parsed_file *pf) {
+    if (pf == NULL)
+        return;
+    free(pf->path);
+    unref(pf->lens, lens);
+    unref(pf->arena, arena);
+    xunmap_file(&pf->text);
+    free_skel(pf->skel);
+    free_dict(pf->dict);
+    free(pf);
+}
 
-    path = file_name_path(aug, filename);
-    ERR_NOMEM(path == NULL, aug);
+/* Remove the entry for PATH from AUG->PARSED_FILES and return it */
+static struct parsed_file *take_parsed_file(struct augeas *aug,
+                                            const char *path) {
+    struct parsed_file *pf;
+    hnode_t *node;
 
-    r = add_file_info(aug, path, lens, lens_name, filename, false);
-    if (r < 0)
-        goto done;
+    if (aug->parsed_files == NULL)
+        return NULL;
+    node = hash_lookup(aug->parsed_files, path);
+    if (node == NULL)
+        return NULL;
+    pf = hnode_get(node);
+    hash_delete(aug->parsed_files, node);
+    return pf;
+}
 
-    text = xread_file(filename);
-    if (text == NULL) {
-        err_status = "read_failed";
-        goto done;
+/* Record PF for its path, replacing any older entry. PF is freed if we
+ * run out of memory */
+static void add_parsed_file(struct augeas *aug, struct parsed_file *pf) {
+    free_parsed_file(take_parsed_file(aug, pf->path));
+
+    if (aug->parsed_files == NULL) {
+        aug->parsed_files = hash_create(HASHCOUNT_T_MAX, NULL, NULL);
+        if (aug->parsed_files == NULL) {
+            free_parsed_file(pf);
+            return;
+        }
+    }
+    hnode_init(&pf->node, pf);
+    hash_insert(aug->parsed_files, &pf->node, pf->path);
+}
+
+/* Return true if the file that FP reads from is still the one PF->TEXT
+ * was read from */
+static bool parsed_file_current(const struct parsed_file *pf, FILE *fp) {
+    struct timespec m1, m2;
+    struct stat st;
+
+    if (fstat(fileno(fp), &st) < 0)
+        return false;
+    m1 = get_stat_mtime(&st);
+    m2 = get_stat_mtime(&pf->st);
+    return st.st_ino == pf->st.st_ino && st.st_dev == pf->st.st_dev
+        && st.st_size == pf->st.st_size
+        && m1.tv_sec == m2.tv_sec && m1.tv_nsec == m2.tv_nsec;
+}
+
+void transform_forget_files(struct augeas *aug, bool all) {
+    hscan_t scan;
+    hnode_t *node;
+
+    if (aug->parsed_files == NULL)
+        return;
+
+    hash_scan_begin(&scan, aug->parsed_files);
+    while ((node = hash_scan_next(&scan)) != NULL) {
+        struct parsed_file *pf = hnode_get(node);
+        struct tree *file = all ? NULL : tree_fpath(aug, pf->path);
+
+        if (file == NULL || file != pf->tree || file->dirty) {
+            hash_scan_delete(aug->parsed_files, node);
+            free_parsed_file(pf);
+        }
     }
-    text_len = strlen(text);
-    text = append_newline(text, text_len);
+    if (all) {
+        hash_destroy(aug->parsed_files);
+        aug->parsed_files = NULL;
+    }
+}
+
+/* Free the compiled regexps of LENS after using it. Lenses of modules that
+ * are shared with other handles might be in use in another thread, and
+ * keep them */
+static void release_lens(struct augeas *aug, struct lens *lens) {
+    if (! aug->shared_modules)
+        lens_release(lens);
+}
 
+/* A file that needs to be parsed. When files are loaded in parallel, the
+ * files matched by all transforms are queued, parsed by a pool of threads,
+ * and then put into the tree in the order in which they were queued */
+struct load_job {
+    struct lens      *lens;
+    char             *filename;
+    char             *path;       /* Where the file goes in the tree */
+    bool              cancelled;  /* Another transform also matched it */
+    /* Results of parse_file */
+    int               result;
+    struct file_text  text;
+    struct tree      *tree;
+    struct span      *span;
+    struct stat       st;         /* Only with AUG_INCREMENTAL_SAVE */
+    struct skel      *skel;
+    struct dict      *dict;
+    struct lns_error *err;
+    const char       *err_status;
+    int               errnum;
+    struct error      error;      /* Errors from a worker thread */
+};
+
+struct load_queue {
+    struct augeas    *aug;
+    unsigned int      nthreads;
+    size_t            njobs;
+    size_t            size;
+    struct load_job  *jobs;
+    size_t            next;       /* The next job to parse */
+#if HAVE_PTHREAD_H
+    pthread_mutex_t   lock;
+#endif
+};
+
+/* Read JOB->FILENAME and apply JOB->LENS to it. This must not change
+ * anything outside of JOB, since it runs in worker threads; errors that
+ * are not problems with the file are reported in ERROR */
+static void parse_file(struct augeas *aug, struct load_job *job,
+                       struct error *error) {
     struct info *info;
+    bool incremental = aug->flags & AUG_INCREMENTAL_SAVE;
+
+    /* Any change to the file after this changes its mtime */
+    if (incremental && stat(job->filename, &job->st) < 0)
+        incremental = false;
+
+    if (xmap_file(job->filename, &job->text) < 0) {
+        job->err_status = "read_failed";
+        job->errnum = errno;
+        return;
+    }
+
     make_ref(info);
     make_ref(info->filename);
-    info->filename->str = strdup(filename);
-    info->error = aug->error;
+    info->filename->str = strdup(job->filename);
+    info->error = error;
     info->flags = aug->flags;
     info->first_line = 1;
 
     if (aug->flags & AUG_ENABLE_SPAN) {
-        span = make_span(info);
-        ERR_NOMEM(span == NULL, info);
+        job->span = make_span(info);
+        ERR_NOMEM(job->span == NULL, info);
     }
 
-    tree = lns_get(info, lens, text, &err);
+    if (incremental)
+        job->tree = lns_get_skel(info, job->lens, job->text.text,
+                                 job->text.len, &job->skel, &job->dict,
+                                 &job->err);
+    else
+        job->tree = lns_get(info, job->lens, job->text.text, job->text.len,
+                            &job->err);
 
     unref(info, info);
 
-    if (err != NULL) {
-        err_status = "parse_failed";
-        goto done;
+    if (job->err != NULL)
+        job->err_status = "parse_failed";
+    return;
+ error:
+    unref(info, info);
+    job->result = -1;
+}
+
+/* Put the results of parsing JOB into the tree, and free them */
+static int commit_file(struct augeas *aug, struct load_job *job) {
+    struct parsed_file *pf = NULL;
+    int result = -1;
+
+    if (job->error.code != AUG_NOERROR) {
+        if (job->error.details != NULL)
+            report_error(aug->error, job->error.code, "%s",
+                         job->error.details);
+        else
+            report_error(aug->error, job->error.code, NULL);
     }
+    if (job->result < 0)
+        goto error;
 
-    tree_freplace(aug, path, tree);
-    ERR_BAIL(aug);
+    if (job->err_status == NULL) {
+        struct tree *file = tree_freplace(aug, job->path, job->tree);
+        ERR_BAIL(aug);
 
-    /* top level node span entire file length */
-    if (span != NULL && tree != NULL) {
-        tree->parent->span = span;
-        tree->parent->span->span_start = 0;
-        tree->parent->span->span_end = text_len;
+        /* top level node span entire file length */
+        if (job->span != NULL && job->tree != NULL) {
+            file->span = job->span;
+            file->span->span_start = 0;
+            file->span->span_end = job->text.len - job->text.newline;
+        }
+
+        if (job->skel != NULL && ALLOC(pf) == 0) {
+            pf->path = strdup(job->path);
+            pf->tree = file;
+            pf->lens = ref(job->lens);
+            if (job->tree != NULL)
+                pf->arena = ref(job->tree->arena);
+            pf->st = job->st;
+            pf->skel = job->skel;
+            pf->dict = job->dict;
+            job->skel = NULL;
+            job->dict = NULL;
+            if (pf->path == NULL) {
+                free_parsed_file(pf);
+                pf = NULL;
+            }
+        }
+
+        job->tree = NULL;
+        result = 0;
     }
 
-    tree = NULL;
+    store_error(aug, job->filename + strlen(aug->root) - 1, job->path,
+                job->err_status, job->errnum, job->err, job->text.text);
+    /* The entry is kept until the file is saved, and the file might be
+     * changed or truncated by then */
+    if (pf != NULL && xcopy_mapped_file(&job->text) < 0) {
+        free_parsed_file(pf);
+        pf = NULL;
+    }
+    if (pf != NULL) {
+        pf->text = job->text;
+        MEMZERO(&job->text, 1);
+        add_parsed_file(aug, pf);
+    }
+ error:
+    free_lns_error(job->err);
+    free_tree(job->tree);
+    xunmap_file(&job->text);
+    free_skel(job->skel);
+    free_dict(job->dict);
+    free(job->error.details);
+    return result;
+}
 
-    result = 0;
- done:
-    store_error(aug, filename + strlen(aug->root) - 1, path, err_status,
-                errno, err, text);
+static int queue_file(struct load_queue *queue, struct lens *lens,
+                      char *filename, char *path) {
+    struct load_job *job;
+
+    if (queue->njobs == queue->size) {
+        size_t size = queue->size == 0 ? 16 : 2 * queue->size;
+        if (REALLOC_N(queue->jobs, size) < 0)
+            return -1;
+        queue->size = size;
+    }
+    job = queue->jobs + queue->njobs;
+    MEMZERO(job, 1);
+    job->lens = lens;
+    job->filename = strdup(filename);
+    if (job->filename == NULL)
+        return -1;
+    job->path = path;
+    job->error.info = queue->aug->error->info;
+    job->error.aug = queue->aug;
+    queue->njobs += 1;
+    return 0;
+}
+
+/* FILENAME is matched by more than one transform; make sure that it does
+ * not get loaded by the first of them */
+static void unqueue_file(struct load_queue *queue, const char *filename) {
+    if (queue == NULL)
+        return;
+    for (int i=0; i < queue->njobs; i++) {
+        if (STREQ(queue->jobs[i].filename, filename))
+            queue->jobs[i].cancelled = true;
+    }
+}
+
+static int load_file(struct augeas *aug, struct lens *lens,
+                     const char *lens_name, char *filename) {
+    struct load_job job;
+    char *path = NULL;
+    int r;
+
+    path = file_name_path(aug, filename);
+    ERR_NOMEM(path == NULL, aug);
+
+    r = add_file_info(aug, path, lens, lens_name, filename, false);
+    if (r < 0) {
+        store_error(aug, filename + strlen(aug->root) - 1, path, NULL,
+                    errno, NULL, NULL);
+        goto error;
+    }
+
+    if (aug->load_queue != NULL) {
+        r = queue_file(aug->load_queue, lens, filename, path);
+        ERR_NOMEM(r < 0, aug);
+        return 0;
+    }
+
+    MEMZERO(&job, 1);
+    job.lens = lens;
+    job.filename = filename;
+    job.path = path;
+    parse_file(aug, &job, aug->error);
+    r = commit_file(aug, &job);
+    free(path);
+    return r;
  error:
-    free_lns_error(err);
     free(path);
-    free_tree(tree);
-    free(text);
-    return result;
+    return -1;
+}
+
+/* Find the module NAME and make sure it has an autoload transform */
+static struct module *autoload_module(struct augeas *aug, const char *name) {
+    struct module *modl = NULL;
+    for (modl = aug->modules;
+         modl != NULL && !streqv(modl->name, name);
+         modl = modl->next);
+    ERR_THROW(modl == NULL, aug, AUG_ENOLENS,
+              "Could not find module %s", name);
+    ERR_THROW(modl->autoload == NULL, aug, AUG_ENOLENS,
+              "No autoloaded lens in module %s", name);
+    return modl;
+ error:
+    return NULL;
 }
 
 /* The lens for a transform can be referred to in one of two ways:
@@ -610,14 +959,14 @@ static struct lens *lens_from_name(struct augeas *aug, const char *name) {
     struct lens *result = NULL;
 
     if (name[0] == '@') {
-        struct module *modl = NULL;
-        for (modl = aug->modules;
-             modl != NULL && !streqv(modl->name, name + 1);
-             modl = modl->next);
-        ERR_THROW(modl == NULL, aug, AUG_ENOLENS,
-                  "Could not find module %s", name + 1);
-        ERR_THROW(modl->autoload == NULL, aug, AUG_ENOLENS,
-                  "No autoloaded lens in module %s", name + 1);
+        struct module *modl = autoload_module(aug, name + 1);
+        ERR_BAIL(aug);
+        if (modl->lazy) {
+            modl = module_force(aug, modl);
+            ERR_BAIL(aug);
+            ERR_THROW(modl == NULL, aug, AUG_ENOLENS,
+                      "Could not compile module %s", name + 1);
+        }
         result = modl->autoload->lens;
     } else {
         result = lens_lookup(aug, name);
@@ -631,6 +980,7 @@ static struct lens *lens_from_name(struct augeas *aug, const char *name) {
 
 int text_store(struct augeas *aug, const char *lens_path,
                const char *path, const char *text) {
+    size_t len = strlen(text);
     struct info *info = NULL;
     struct lns_error *err = NULL;
     struct tree *tree = NULL;
@@ -646,9 +996,9 @@ int text_store(struct augeas *aug, const char *lens_path,
     info->first_line = 1;
     info->last_line = 1;
     info->first_column = 1;
-    info->last_column = strlen(text);
+    info->last_column = len;
 
-    tree = lns_get(info, lens, text, &err);
+    tree = lns_get(info, lens, text, len, &err);
     if (err != NULL) {
         err_status = "parse_failed";
         goto error;
@@ -743,7 +1093,11 @@ int transform_validate(struct augeas *aug, struct tree *xfm) {
         xfm_error(xfm, "the 'lens' node does not contain a lens name");
         return -1;
     }
-    lens_from_name(aug, l->value);
+    /* Lazy modules are only compiled when a file is actually loaded */
+    if (l->value[0] == '@')
+        autoload_module(aug, l->value + 1);
+    else
+        lens_from_name(aug, l->value);
     ERR_BAIL(aug);
 
     return 0;
@@ -795,20 +1149,32 @@ static struct tree *file_info(struct augeas *aug, const char *fname) {
     return result;
 }
 
-int transform_load(struct augeas *aug, struct tree *xfm) {
-    int nmatches = 0;
-    char **matches;
+/* Load the NMATCHES files in MATCHES with the lens of XFM, and free
+ * MATCHES. Files that have not changed since they were last loaded are
+ * only reloaded if FORCE is true */
+static int load_matches(struct augeas *aug, struct tree *xfm,
+                        int nmatches, char **matches, bool force) {
     const char *lens_name;
-    struct lens *lens = xfm_lens(aug, xfm, &lens_name);
-    int r;
+    struct lens *lens = NULL;
+    size_t queued = 0;
+
+    if (nmatches == 0) {
+        free(matches);
+        return 0;
+    }
 
+    /* Only look up the lens once we know it is needed, so that lazy
+     * modules for which there are no files are never compiled */
+    lens = xfm_lens(aug, xfm, &lens_name);
     if (lens == NULL) {
         // FIXME: Record an error and return 0
+        for (int i=0; i < nmatches; i++)
+            free(matches[i]);
+        free(matches);
         return -1;
     }
-    r = filter_generate(xfm, aug->root, &nmatches, &matches);
-    if (r == -1)
-        return -1;
+    if (aug->load_queue != NULL)
+        queued = aug->load_queue->njobs;
     for (int i=0; i < nmatches; i++) {
         const char *filename = matches[i] + strlen(aug->root) - 1;
         struct tree *finfo = file_info(aug, filename);
@@ -819,20 +1185,149 @@ int transform_load(struct augeas *aug, struct tree *xfm) {
             transform_file_error(aug, "mxfm_load", filename,
               "Lenses %s and %s could be used to load this file",
                                  s, lens_name);
+            unqueue_file(aug->load_queue, matches[i]);
             aug_rm(aug, fpath);
             free(fpath);
-        } else if (!file_current(aug, matches[i], finfo)) {
+        } else if (force || !file_current(aug, matches[i], finfo)) {
             load_file(aug, lens, lens_name, matches[i]);
         }
         if (finfo != NULL)
             finfo->dirty = 0;
+        watch_file(aug->watch, matches[i]);
         FREE(matches[i]);
     }
-    lens_release(lens);
+    /* Queued files still need the lens */
+    if (aug->load_queue == NULL || aug->load_queue->njobs == queued)
+        release_lens(aug, lens);
     free(matches);
     return 0;
 }
 
+int transform_load(struct augeas *aug, struct tree *xfm) {
+    int nmatches = 0;
+    char **matches;
+    int r;
+
+    r = filter_generate(xfm, aug->root, &nmatches, &matches);
+    if (r == -1)
+        return -1;
+    return load_matches(aug, xfm, nmatches, matches, false);
+}
+
+int transform_load_files(struct augeas *aug, struct tree *xfm,
+                         int nfiles, char **files) {
+    int nmatches = 0;
+    char **matches;
+    int r;
+
+    r = filter_select(xfm, aug->root, nfiles, files, &nmatches, &matches);
+    if (r == -1)
+        return -1;
+    return load_matches(aug, xfm, nmatches, matches, true);
+}
+
+int transform_load_start(struct augeas *aug, unsigned int nthreads) {
+    struct load_queue *queue = NULL;
+
+    if (ALLOC(queue) < 0)
+        return -1;
+#if HAVE_PTHREAD_H
+    if (pthread_mutex_init(&queue->lock, NULL) != 0) {
+        free(queue);
+        return -1;
+    }
+#endif
+    queue->aug = aug;
+    queue->nthreads = nthreads;
+    aug->load_queue = queue;
+    return 0;
+}
+
+/* Return the next job that needs to be parsed, or NULL if there is none */
+static struct load_job *next_job(struct load_queue *queue) {
+    struct load_job *job = NULL;
+
+#if HAVE_PTHREAD_H
+    pthread_mutex_lock(&queue->lock);
+#endif
+    while (job == NULL && queue->next < queue->njobs) {
+        job = queue->jobs + queue->next;
+        queue->next += 1;
+        if (job->cancelled)
+            job = NULL;
+    }
+#if HAVE_PTHREAD_H
+    pthread_mutex_unlock(&queue->lock);
+#endif
+    return job;
+}
+
+#if HAVE_PTHREAD_H
+static void *load_worker(void *data) {
+    struct load_queue *queue = data;
+    struct load_job *job;
+
+#if HAVE_USELOCALE
+    uselocale(queue->aug->c_locale);
+#endif
+    while ((job = next_job(queue)) != NULL)
+        parse_file(queue->aug, job, &job->error);
+    return NULL;
+}
+#endif
+
+int transform_load_finish(struct augeas *aug) {
+    struct load_queue *queue = aug->load_queue;
+    struct load_job *job;
+    int result = 0;
+
+    if (queue == NULL)
+        return 0;
+    aug->load_queue = NULL;
+
+#if HAVE_PTHREAD_H
+    if (queue->nthreads > 1 && queue->njobs > 1) {
+        size_t nworkers = queue->nthreads < queue->njobs ?
+            queue->nthreads - 1 : queue->njobs - 1;
+        pthread_t *workers = NULL;
+        size_t started = 0;
+
+        if (ALLOC_N(workers, nworkers) == 0) {
+            for (started = 0; started < nworkers; started++) {
+                if (pthread_create(workers + started, NULL,
+                                   load_worker, queue) != 0)
+                    break;
+            }
+        }
+        /* This thread is one of the workers, too */
+        load_worker(queue);
+        for (int i=0; i < started; i++)
+            pthread_join(workers[i], NULL);
+        free(workers);
+    }
+#endif
+
+    /* Parse whatever the workers did not get to */
+    while ((job = next_job(queue)) != NULL)
+        parse_file(aug, job, &job->error);
+
+    for (int i=0; i < queue->njobs; i++) {
+        job = queue->jobs + i;
+        if (! job->cancelled && commit_file(aug, job) < 0)
+            result = -1;
+        release_lens(aug, job->lens);
+        free(job->filename);
+        free(job->path);
+    }
+
+#if HAVE_PTHREAD_H
+    pthread_mutex_destroy(&queue->lock);
+#endif
+    free(queue->jobs);
+    free(queue);
+    return result;
+}
+
 int transform_applies(struct tree *xfm, const char *path) {
     if (STRNEQLEN(path, AUGEAS_FILES_TREE, strlen(AUGEAS_FILES_TREE))
         || path[strlen(AUGEAS_FILES_TREE)] != SEP)
@@ -1051,17 +1546,19 @@ int transform_save(struct augeas *aug, struct tree *xfm,
     char *augorig_canon = NULL, *augdest = NULL;
     int   augorig_exists;
     int   copy_if_rename_fails = 0;
-    char *text = NULL;
+    struct file_text text;
     const char *filename = path + strlen(AUGEAS_FILES_TREE) + 1;
     const char *err_status = NULL;
     char *dyn_err_status = NULL;
     struct lns_error *err = NULL;
     const char *lens_name;
     struct lens *lens = xfm_lens(aug, xfm, &lens_name);
+    struct parsed_file *pf = NULL;
     int result = -1, r;
-    bool force_reload;
+    bool force_reload, reuse = false;
 
     errno = 0;
+    MEMZERO(&text, 1);
 
     if (lens == NULL) {
         err_status = "lens_name";
@@ -1088,20 +1585,31 @@ int transform_save(struct augeas *aug, struct tree *xfm,
         }
     }
 
+    /* The entry for PATH can only be used for this save */
+    pf = take_parsed_file(aug, path);
     if (access(augorig_canon, R_OK) == 0) {
         augorig_canon_fp = fopen(augorig_canon, "r");
-        text = xfread_file(augorig_canon_fp);
+        reuse = pf != NULL && pf->tree == tree && pf->lens == lens
+            && augorig_canon_fp != NULL
+            && parsed_file_current(pf, augorig_canon_fp);
+        if (reuse) {
+            text = pf->text;
+            MEMZERO(&pf->text, 1);
+        } else {
+            xfmap_file(augorig_canon_fp, &text);
+        }
     } else {
-        text = strdup("");
+        /* What xmap_file makes of an empty file */
+        text.text = strdup("\n");
+        text.len = 1;
+        text.newline = true;
     }
 
-    if (text == NULL) {
+    if (text.text == NULL) {
         err_status = "put_read";
         goto done;
     }
 
-    text = append_newline(text, strlen(text));
-
     /* Figure out where to put the .augnew and temp file. If no .augnew file
        then put the temp file next to augorig_canon, else next to .augnew. */
     if (aug->flags & AUG_SAVE_NEWFILE) {
@@ -1150,8 +1658,13 @@ int transform_save(struct augeas *aug, struct tree *xfm,
         }
     }
 
-    if (tree != NULL)
-        lns_put(fp, lens, tree->children, text, &err);
+    if (tree != NULL) {
+        if (reuse)
+            lns_put_skel(fp, lens, tree->children, text.text, pf->skel,
+                         pf->dict, &err);
+        else
+            lns_put(fp, lens, tree->children, text.text, text.len, &err);
+    }
 
     if (ferror(fp)) {
         err_status = "error_augtemp";
@@ -1189,7 +1702,7 @@ int transform_save(struct augeas *aug, struct tree *xfm,
             err_status = "read_augtemp";
             goto done;
         }
-        same = STREQ(text, new_text);
+        same = STREQ(text.text, new_text);
         FREE(new_text);
         if (same) {
             result = 0;
@@ -1229,6 +1742,9 @@ int transform_save(struct augeas *aug, struct tree *xfm,
  done:
     force_reload = aug->flags & AUG_SAVE_NEWFILE;
     r = add_file_info(aug, path, lens, lens_name, augorig, force_reload);
+    /* The file on disk does not change, but we need to reload it */
+    if (r == 0 && force_reload)
+        r = watch_touch(aug->watch, augorig);
     if (r < 0) {
         err_status = "file_info";
         result = -1;
@@ -1243,11 +1759,12 @@ int transform_save(struct augeas *aug, struct tree *xfm,
     {
         const char *emsg =
             dyn_err_status == NULL ? err_status : dyn_err_status;
-        store_error(aug, filename, path, emsg, errno, err, text);
+        store_error(aug, filename, path, emsg, errno, err, text.text);
     }
     free(dyn_err_status);
-    lens_release(lens);
-    free(text);
+    free_parsed_file(pf);
+    release_lens(aug, lens);
+    xunmap_file(&text);
     free(augtemp);
     free(augnew);
     if (augorig_canon != augorig)
@@ -1291,7 +1808,8 @@ int text_retrieve(struct augeas *aug, const char *lens_name,
     ms_open = true;
 
     if (tree != NULL)
-        lns_put(ms.stream, lens, tree->children, text_in, &err);
+        lns_put(ms.stream, lens, tree->children, text_in, strlen(text_in),
+                &err);
 
     r = close_memstream(&ms);
     ms_open = false;
@@ -1317,7 +1835,7 @@ int text_retrieve(struct augeas *aug, const char *lens_name,
         store_error(aug, NULL, path, emsg, errno, err, text_in);
     }
     free(dyn_err_status);
-    lens_release(lens);
+    release_lens(aug, lens);
     if (result < 0) {
         free(*text_out);
         *text_out = NULL;
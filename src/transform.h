@@ -68,6 +68,26 @@ int transform_validate(struct augeas *aug, struct tree *xfm);
  */
 int transform_load(struct augeas *aug, struct tree *xfm);
 
+/* Like TRANSFORM_LOAD, but only look at the NFILES files in FILES, which
+ * are absolute file names including the root. Files that the TRANSFORM's
+ * filter does not match, or that do not exist, are ignored. All others
+ * are loaded again, even if they look unchanged
+ */
+int transform_load_files(struct augeas *aug, struct tree *xfm,
+                         int nfiles, char **files);
+
+/* Make TRANSFORM_LOAD and TRANSFORM_LOAD_FILES only queue the files that
+ * need to be parsed, so that they can all be parsed in parallel by
+ * NTHREADS threads when TRANSFORM_LOAD_FINISH is called. Return -1 if we
+ * run out of memory
+ */
+int transform_load_start(struct augeas *aug, unsigned int nthreads);
+
+/* Parse all the files queued since TRANSFORM_LOAD_START, and put them
+ * into the tree in the order in which they were queued
+ */
+int transform_load_finish(struct augeas *aug);
+
 /* Return 1 if TRANSFORM applies to PATH, 0 otherwise. The TRANSFORM
  * applies to PATH if (1) PATH starts with "/files/" and (2) the rest of
  * PATH matches the transform's filter
@@ -80,6 +100,12 @@ int transform_applies(struct tree *xfm, const char *path);
 int transform_save(struct augeas *aug, struct tree *xfm,
                    const char *path, struct tree *tree);
 
+/* Forget the text kept for AUG_INCREMENTAL_SAVE of files whose tree has
+ * been modified or replaced since they were loaded, or of all files if
+ * ALL is true
+ */
+void transform_forget_files(struct augeas *aug, bool all);
+
 /* Transform TEXT into a tree and store it at PATH
  */
 int text_store(struct augeas *aug, const char *lens_name,
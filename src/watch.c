@@ -0,0 +1,418 @@
+/*
+ * watch.c: track changes to loaded files with inotify
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#include <config.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <glob.h>
+#include <unistd.h>
+
+#if HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif
+
+#include "internal.h"
+#include "memory.h"
+#include "watch.h"
+
+#if HAVE_SYS_INOTIFY_H && HAVE_INOTIFY_INIT1
+
+#define WATCH_MASK                                                  \
+    (IN_CLOSE_WRITE|IN_MODIFY|IN_ATTRIB|IN_CREATE|IN_DELETE         \
+     |IN_MOVED_FROM|IN_MOVED_TO|IN_DELETE_SELF|IN_MOVE_SELF|IN_ONLYDIR)
+
+/* Events after which we can't tell anymore which files changed */
+#define WATCH_LOST                                                  \
+    (IN_Q_OVERFLOW|IN_IGNORED|IN_UNMOUNT|IN_DELETE_SELF|IN_MOVE_SELF|IN_ISDIR)
+
+/* A watched directory */
+struct watch_dir {
+    int   wd;
+    char *path;
+};
+
+/* A file that is a symlink; LINK needs to be reloaded when TARGET
+ * changes */
+struct watch_link {
+    char *link;
+    char *target;
+};
+
+struct watch {
+    int                fd;
+    const char        *root;
+    size_t             ndirs;
+    struct watch_dir  *dirs;      /* Sorted by WD */
+    size_t             nlinks;
+    struct watch_link *links;
+    size_t             nchanged;
+    char             **changed;
+    bool               lost;      /* Lost track of changes */
+};
+
+void free_watch(struct watch *watch) {
+    if (watch == NULL)
+        return;
+    if (watch->fd >= 0)
+        close(watch->fd);
+    for (int i=0; i < watch->ndirs; i++)
+        free(watch->dirs[i].path);
+    free(watch->dirs);
+    for (int i=0; i < watch->nlinks; i++) {
+        free(watch->links[i].link);
+        free(watch->links[i].target);
+    }
+    free(watch->links);
+    for (int i=0; i < watch->nchanged; i++)
+        free(watch->changed[i]);
+    free(watch->changed);
+    free(watch);
+}
+
+/* Return the index of WD in WATCH->DIRS, or where it needs to be
+ * inserted if it is not there */
+static size_t dir_index(struct watch *watch, int wd) {
+    size_t l = 0, h = watch->ndirs;
+
+    while (l < h) {
+        size_t m = (l + h) / 2;
+        if (watch->dirs[m].wd < wd)
+            l = m + 1;
+        else
+            h = m;
+    }
+    return l;
+}
+
+static struct watch_dir *find_dir(struct watch *watch, int wd) {
+    size_t i = dir_index(watch, wd);
+
+    if (i < watch->ndirs && watch->dirs[i].wd == wd)
+        return watch->dirs + i;
+    return NULL;
+}
+
+/* Watch the directory PATH. Set *DIR to the entry for the directory in
+ * WATCH->DIRS, or to NULL if PATH does not exist. The path in *DIR might
+ * differ from PATH if the directory is already watched under a different
+ * name.
+ *
+ * Return 0 on success, -1 on failure */
+static int watch_dir(struct watch *watch, const char *path,
+                     struct watch_dir **dir) {
+    int wd;
+    size_t i;
+
+    *dir = NULL;
+    wd = inotify_add_watch(watch->fd, path, WATCH_MASK);
+    if (wd < 0)
+        return (errno == ENOENT || errno == ENOTDIR) ? 0 : -1;
+
+    i = dir_index(watch, wd);
+    if (i == watch->ndirs || watch->dirs[i].wd != wd) {
+        char *p = strdup(path);
+        if (p == NULL || REALLOC_N(watch->dirs, watch->ndirs + 1) < 0) {
+            free(p);
+            return -1;
+        }
+        memmove(watch->dirs + i + 1, watch->dirs + i,
+                (watch->ndirs - i) * sizeof(*watch->dirs));
+        watch->dirs[i].wd = wd;
+        watch->dirs[i].path = p;
+        watch->ndirs += 1;
+    }
+    *dir = watch->dirs + i;
+    return 0;
+}
+
+/* Watch all directories that files matching the glob PATTERN can be in,
+ * and all their ancestors up to the root */
+static int watch_pattern(struct watch *watch, const char *pattern) {
+    char *path = NULL;
+    int result = -1;
+
+    if (pathjoin(&path, 2, watch->root, pattern) < 0)
+        goto done;
+
+    for (char *s = path + strlen(watch->root) - 1; s != NULL;
+         s = strchr(s + 1, SEP)) {
+        struct watch_dir *dir;
+        const char *prefix = path;
+
+        *s = '\0';
+        if (s == path)
+            prefix = "/";
+
+        if (strpbrk(prefix, "*?[") != NULL) {
+            glob_t globbuf;
+            int r;
+
+            MEMZERO(&globbuf, 1);
+            r = glob(prefix, GLOB_ONLYDIR|GLOB_NOSORT, NULL, &globbuf);
+            if (r != 0 && r != GLOB_NOMATCH) {
+                globfree(&globbuf);
+                goto done;
+            }
+            for (int i=0; i < globbuf.gl_pathc; i++) {
+                r = watch_dir(watch, globbuf.gl_pathv[i], &dir);
+                if (r == 0 && dir != NULL
+                    && STRNEQ(dir->path, globbuf.gl_pathv[i]))
+                    r = -1;
+                if (r < 0)
+                    break;
+            }
+            globfree(&globbuf);
+            if (r < 0)
+                goto done;
+        } else {
+            /* A directory that is watched under two different names
+             * would only report changes under one of them */
+            if (watch_dir(watch, prefix, &dir) < 0)
+                goto done;
+            if (dir != NULL && STRNEQ(dir->path, prefix))
+                goto done;
+        }
+        *s = SEP;
+    }
+    result = 0;
+ done:
+    free(path);
+    return result;
+}
+
+int watch_start(struct augeas *aug, struct tree *load) {
+    struct watch *watch = NULL;
+
+    free_watch(aug->watch);
+    aug->watch = NULL;
+
+    if (ALLOC(watch) < 0)
+        goto error;
+    watch->root = aug->root;
+    watch->fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+    if (watch->fd < 0)
+        goto error;
+
+    list_for_each(xfm, load->children) {
+        list_for_each(f, xfm->children) {
+            if (streqv(f->label, "incl") && f->value != NULL) {
+                if (watch_pattern(watch, f->value) < 0)
+                    goto error;
+            }
+        }
+    }
+    aug->watch = watch;
+    return 0;
+ error:
+    free_watch(watch);
+    return -1;
+}
+
+int watch_file(struct watch *watch, const char *filename) {
+    struct watch_link *link;
+    struct watch_dir *dir;
+    struct stat st;
+    char *target = NULL, *base;
+    int r;
+
+    if (watch == NULL)
+        return 0;
+    if (lstat(filename, &st) < 0 || ! S_ISLNK(st.st_mode))
+        return 0;
+
+    target = realpath(filename, NULL);
+    if (target == NULL)
+        return 0;
+
+    base = strrchr(target, SEP);
+    *base = '\0';
+    r = watch_dir(watch, base == target ? "/" : target, &dir);
+    *base = SEP;
+    if (r < 0 || dir == NULL)
+        goto error;
+
+    /* Record the target under the name we know its directory by */
+    r = xasprintf(&base, "%s/%s", dir->path, base + 1);
+    free(target);
+    target = base;
+    if (r < 0)
+        goto error;
+
+    for (int i=0; i < watch->nlinks; i++) {
+        if (STREQ(watch->links[i].link, filename)
+            && STREQ(watch->links[i].target, target)) {
+            free(target);
+            return 0;
+        }
+    }
+
+    if (REALLOC_N(watch->links, watch->nlinks + 1) < 0)
+        goto error;
+    link = watch->links + watch->nlinks;
+    link->target = target;
+    link->link = strdup(filename);
+    if (link->link == NULL)
+        goto error;
+    watch->nlinks += 1;
+    return 0;
+ error:
+    free(target);
+    watch->lost = true;
+    return -1;
+}
+
+/* Add PATH to the changed files; takes ownership of PATH */
+static int add_changed(struct watch *watch, char *path) {
+    if (path == NULL || REALLOC_N(watch->changed, watch->nchanged + 1) < 0) {
+        free(path);
+        return -1;
+    }
+    watch->changed[watch->nchanged++] = path;
+    return 0;
+}
+
+int watch_touch(struct watch *watch, const char *filename) {
+    if (watch == NULL)
+        return 0;
+    return add_changed(watch, strdup(filename));
+}
+
+/* Process one event; return -1 if we run out of memory */
+static int watch_event(struct watch *watch, const struct inotify_event *ev) {
+    struct watch_dir *dir;
+    char *path = NULL;
+
+    if (ev->mask & WATCH_LOST) {
+        watch->lost = true;
+        return 0;
+    }
+    dir = find_dir(watch, ev->wd);
+    if (dir == NULL) {
+        watch->lost = true;
+        return 0;
+    }
+    if (ev->len == 0)
+        return 0;
+
+    if (pathjoin(&path, 2, dir->path, ev->name) < 0)
+        return -1;
+    for (int i=0; i < watch->nlinks; i++) {
+        if (STREQ(watch->links[i].target, path)) {
+            if (add_changed(watch, strdup(watch->links[i].link)) < 0) {
+                free(path);
+                return -1;
+            }
+        }
+    }
+    return add_changed(watch, path);
+}
+
+static int str_cmp(const void *p1, const void *p2) {
+    return strcmp(*(char * const *) p1, *(char * const *) p2);
+}
+
+int watch_changes(struct watch *watch, char ***changed, int *nchanged) {
+    char buf[4096]
+        __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+    size_t n = 0;
+
+    *changed = NULL;
+    *nchanged = 0;
+
+    while ((len = read(watch->fd, buf, sizeof(buf))) != 0) {
+        if (len < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN)
+                watch->lost = true;
+            break;
+        }
+        for (char *p = buf; p < buf + len; ) {
+            const struct inotify_event *ev = (struct inotify_event *) p;
+            if (watch_event(watch, ev) < 0)
+                return -1;
+            p += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+
+    if (watch->lost) {
+        for (int i=0; i < watch->nchanged; i++)
+            free(watch->changed[i]);
+        FREE(watch->changed);
+        watch->nchanged = 0;
+        watch->lost = false;
+        return 0;
+    }
+
+    /* Drop duplicates */
+    qsort(watch->changed, watch->nchanged, sizeof(char *), str_cmp);
+    for (int i=0; i < watch->nchanged; i++) {
+        if (n > 0 && STREQ(watch->changed[n-1], watch->changed[i]))
+            free(watch->changed[i]);
+        else
+            watch->changed[n++] = watch->changed[i];
+    }
+
+    *changed = watch->changed;
+    *nchanged = n;
+    watch->changed = NULL;
+    watch->nchanged = 0;
+    return 1;
+}
+
+#else
+
+int watch_start(struct augeas *aug, ATTRIBUTE_UNUSED struct tree *load) {
+    aug->watch = NULL;
+    return -1;
+}
+
+int watch_file(ATTRIBUTE_UNUSED struct watch *watch,
+               ATTRIBUTE_UNUSED const char *filename) {
+    return 0;
+}
+
+int watch_touch(ATTRIBUTE_UNUSED struct watch *watch,
+                ATTRIBUTE_UNUSED const char *filename) {
+    return 0;
+}
+
+int watch_changes(ATTRIBUTE_UNUSED struct watch *watch,
+                  char ***changed, int *nchanged) {
+    *changed = NULL;
+    *nchanged = 0;
+    return 0;
+}
+
+void free_watch(ATTRIBUTE_UNUSED struct watch *watch) {
+}
+
+#endif
+
+/*
+ * Local variables:
+ *  indent-tabs-mode: nil
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  tab-width: 4
+ * End:
+ */
@@ -0,0 +1,82 @@
+/*
+ * watch.h: track changes to loaded files with inotify
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#ifndef WATCH_H_
+#define WATCH_H_
+
+/*
+ * With AUG_ENABLE_WATCH, aug_load does not glob and stat all the files
+ * that transforms could load every time. Before loading all files, it
+ * watches every directory that an include pattern could match files in,
+ * together with all their ancestors up to the root, and, while loading,
+ * the directories that symlinked files point into. The next aug_load then
+ * only needs to look at the files that the kernel reported as changed.
+ *
+ * Whenever a directory is created, removed or renamed in a watched
+ * directory, or events are lost, the watch can not tell which files
+ * changed anymore, and aug_load has to look at all files again.
+ *
+ * Without inotify, watch_start always fails, and aug_load always looks
+ * at all files.
+ */
+
+struct watch;
+
+/* Start watching the directories that the transforms underneath LOAD can
+ * load files from. Any previous watch in AUG->WATCH is replaced.
+ *
+ * Return 0 on success, and -1 if the files can not be watched, in which
+ * case AUG->WATCH is NULL.
+ */
+int watch_start(struct augeas *aug, struct tree *load);
+
+/* Note that FILENAME was loaded. If it is a symlink, also watch the
+ * directory it points into, and report FILENAME as changed whenever its
+ * target changes. It is fine to pass a NULL WATCH.
+ */
+int watch_file(struct watch *watch, const char *filename);
+
+/* Set *CHANGED to the sorted list of files that have changed since the
+ * last call, as absolute paths that include the root of WATCH, and
+ * *NCHANGED to its length. The caller must free the list.
+ *
+ * Return 1 if the list contains all files that need to be loaded again,
+ * 0 if all files need to be checked, and -1 if we run out of memory. In
+ * the last two cases, *CHANGED is NULL.
+ */
+int watch_changes(struct watch *watch, char ***changed, int *nchanged);
+
+/* Record that FILENAME needs to be loaded again, even though it has not
+ * changed on disk */
+int watch_touch(struct watch *watch, const char *filename);
+
+void free_watch(struct watch *watch);
+
+#endif
+
+
+/*
+ * Local variables:
+ *  indent-tabs-mode: nil
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  tab-width: 4
+ * End:
+ */
@@ -641,6 +641,38 @@ static void testEnumerate(CuTest *tc) {
     CuAssertStrEquals(tc, "a", words[1]);
 }
 
+static void testDFA(CuTest *tc) {
+    struct fa *fa = make_good_fa(tc, "a+(bc|b)?");
+    struct fa *nocase = make_good_fa(tc, "(Ab|ac)x");
+    struct fa_dfa *dfa;
+
+    dfa = fa_make_dfa(fa, 0);
+    CuAssertPtrNotNull(tc, dfa);
+    CuAssertIntEquals(tc, -1, fa_dfa_match(dfa, "", 0));
+    CuAssertIntEquals(tc, -1, fa_dfa_match(dfa, "ba", 2));
+    CuAssertIntEquals(tc, 3, fa_dfa_match(dfa, "aab", 3));
+    CuAssertIntEquals(tc, 4, fa_dfa_match(dfa, "aabcd", 5));
+    CuAssertIntEquals(tc, 3, fa_dfa_match(dfa, "aabd", 4));
+    /* Only LEN characters are looked at */
+    CuAssertIntEquals(tc, 2, fa_dfa_match(dfa, "aabc", 2));
+    fa_dfa_free(dfa);
+
+    /* A matcher that can only keep one state at a time still works */
+    dfa = fa_make_dfa(fa, 1);
+    CuAssertPtrNotNull(tc, dfa);
+    CuAssertIntEquals(tc, 4, fa_dfa_match(dfa, "aabcd", 5));
+    CuAssertIntEquals(tc, 3, fa_dfa_match(dfa, "aabd", 4));
+    fa_dfa_free(dfa);
+
+    fa_nocase(nocase);
+    dfa = fa_make_dfa(nocase, 0);
+    CuAssertPtrNotNull(tc, dfa);
+    CuAssertIntEquals(tc, 3, fa_dfa_match(dfa, "abx", 3));
+    CuAssertIntEquals(tc, 3, fa_dfa_match(dfa, "ACX", 3));
+    CuAssertIntEquals(tc, -1, fa_dfa_match(dfa, "adx", 3));
+    fa_dfa_free(dfa);
+}
+
 int main(int argc, char **argv) {
     if (argc == 1) {
         char *output = NULL;
@@ -667,6 +699,7 @@ int main(int argc, char **argv) {
         SUITE_ADD_TEST(suite, testExpandNoCase);
         SUITE_ADD_TEST(suite, testNoCaseComplement);
         SUITE_ADD_TEST(suite, testEnumerate);
+        SUITE_ADD_TEST(suite, testDFA);
 
         CuSuiteRun(suite);
         CuSuiteSummary(suite, &output);
@@ -28,6 +28,9 @@
 #include "internal.h"
 
 #include <unistd.h>
+#if HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
 
 #include <libxml/tree.h>
 
@@ -642,6 +645,626 @@ static void testAugEscape(CuTest *tc) {
     free(out);
 }
 
+/* Change, move and remove nodes that aug_text_store put into the tree,
+ * and make sure the nodes that are left keep their labels and values */
+static void testChangeStoredTree(CuTest *tc) {
+    static const char *const hosts =
+        "192.168.0.1 rtr.example.com router\n"
+        "192.168.0.2 www.example.com www\n";
+    static const char *const hosts_out =
+        "192.168.0.1 gw.example.com router\n";
+    const char *v;
+    struct augeas *aug;
+    int r;
+
+    aug = aug_init(root, loadpath, AUG_NO_STDINC|AUG_NO_LOAD);
+    CuAssertPtrNotNull(tc, aug);
+
+    r = aug_set(aug, "/raw/hosts", hosts);
+    CuAssertRetSuccess(tc, r);
+    r = aug_text_store(aug, "Hosts.lns", "/raw/hosts", "/t1");
+    CuAssertRetSuccess(tc, r);
+
+    r = aug_set(aug, "/t1/1/canonical", "gw.example.com");
+    CuAssertRetSuccess(tc, r);
+    r = aug_rename(aug, "/t1/2/alias", "nickname");
+    CuAssertIntEquals(tc, 1, r);
+
+    /* Move a node out of the tree, then replace and remove the rest */
+    r = aug_mv(aug, "/t1/2/ipaddr", "/saved/ipaddr");
+    CuAssertRetSuccess(tc, r);
+    r = aug_mv(aug, "/t1/2/canonical", "/t1/1/alias");
+    CuAssertRetSuccess(tc, r);
+    r = aug_mv(aug, "/t1/2", "/saved/host");
+    CuAssertRetSuccess(tc, r);
+    r = aug_text_store(aug, "Hosts.lns", "/raw/hosts", "/t1");
+    CuAssertRetSuccess(tc, r);
+    r = aug_rm(aug, "/t1");
+    CuAssertTrue(tc, r > 0);
+
+    r = aug_get(aug, "/saved/ipaddr", &v);
+    CuAssertIntEquals(tc, 1, r);
+    CuAssertStrEquals(tc, "192.168.0.2", v);
+    r = aug_get(aug, "/saved/host/nickname", &v);
+    CuAssertIntEquals(tc, 1, r);
+    CuAssertStrEquals(tc, "www", v);
+
+    r = aug_text_store(aug, "Hosts.lns", "/raw/hosts", "/t2");
+    CuAssertRetSuccess(tc, r);
+    r = aug_set(aug, "/t2/1/canonical", "gw.example.com");
+    CuAssertRetSuccess(tc, r);
+    r = aug_rm(aug, "/t2/2");
+    CuAssertTrue(tc, r > 0);
+    r = aug_text_retrieve(aug, "Hosts.lns", "/raw/hosts", "/t2", "/out/hosts");
+    CuAssertRetSuccess(tc, r);
+    r = aug_get(aug, "/out/hosts", &v);
+    CuAssertIntEquals(tc, 1, r);
+    CuAssertStrEquals(tc, hosts_out, v);
+
+    aug_close(aug);
+}
+
+/* Lookups by label in a node with enough children to be indexed have to
+ * see all changes to its children */
+static void testManyChildren(CuTest *tc) {
+    struct augeas *aug;
+    char path[64];
+    const char *v;
+    int r;
+
+    aug = aug_init(root, loadpath, AUG_NO_STDINC|AUG_NO_LOAD);
+    CuAssertPtrNotNull(tc, aug);
+
+    for (int i=0; i < 100; i++) {
+        snprintf(path, sizeof(path), "/t/node%d", i % 50);
+        r = aug_set(aug, "/t/new", path + 3);
+        CuAssertRetSuccess(tc, r);
+        r = aug_rename(aug, "/t/new", path + 3);
+        CuAssertIntEquals(tc, 1, r);
+    }
+    r = aug_match(aug, "/t/node7", NULL);
+    CuAssertIntEquals(tc, 2, r);
+    r = aug_get(aug, "/t/node7[2]", &v);
+    CuAssertIntEquals(tc, 1, r);
+    CuAssertStrEquals(tc, "node7", v);
+
+    r = aug_rm(aug, "/t/node7[1]");
+    CuAssertIntEquals(tc, 1, r);
+    r = aug_insert(aug, "/t/node8[2]", "node7", 0);
+    CuAssertRetSuccess(tc, r);
+    r = aug_insert(aug, "/t/node1[1]", "node7", 1);
+    CuAssertRetSuccess(tc, r);
+    r = aug_match(aug, "/t/node7", NULL);
+    CuAssertIntEquals(tc, 3, r);
+    r = aug_match(aug, "/t/node7[preceding-sibling::node1]", NULL);
+    CuAssertIntEquals(tc, 2, r);
+
+    r = aug_mv(aug, "/t/node9[1]", "/t/moved");
+    CuAssertRetSuccess(tc, r);
+    r = aug_match(aug, "/t/node9", NULL);
+    CuAssertIntEquals(tc, 1, r);
+    r = aug_get(aug, "/t/moved", &v);
+    CuAssertIntEquals(tc, 1, r);
+    CuAssertStrEquals(tc, "node9", v);
+
+    r = aug_rm(aug, "/t/*[position() > 40]");
+    CuAssertIntEquals(tc, 61, r);
+    r = aug_match(aug, "/t/*", NULL);
+    CuAssertIntEquals(tc, 40, r);
+
+    /* The paths of the children must still number them correctly after
+     * removing children from the middle of a run of equal labels */
+    for (int i=0; i < 3; i++) {
+        r = aug_set(aug, "/t/dup[last()+1]", "dup");
+        CuAssertRetSuccess(tc, r);
+    }
+    r = aug_rm(aug, "/t/dup[1]");
+    CuAssertIntEquals(tc, 1, r);
+    r = aug_set(aug, "/t/dup[last()+1]", "appended");
+    CuAssertRetSuccess(tc, r);
+    {
+        char **matches;
+        int n = aug_match(aug, "/t/*", &matches);
+        CuAssertIntEquals(tc, 43, n);
+        CuAssertStrEquals(tc, "/t/dup[3]", matches[42]);
+        for (int j=0; j < n; j++) {
+            char **m;
+            r = aug_match(aug, matches[j], &m);
+            CuAssertIntEquals(tc, 1, r);
+            CuAssertStrEquals(tc, matches[j], m[0]);
+            free(m[0]);
+            free(m);
+            free(matches[j]);
+        }
+        free(matches);
+    }
+    r = aug_get(aug, "/t/dup[3]", &v);
+    CuAssertIntEquals(tc, 1, r);
+    CuAssertStrEquals(tc, "appended", v);
+    r = aug_rm(aug, "/t/dup");
+    CuAssertIntEquals(tc, 3, r);
+
+    for (int i=0; i < 50; i++) {
+        char **matches;
+        int n, expected = 0;
+        snprintf(path, sizeof(path), "/t/node%d", i);
+        r = aug_match(aug, "/t/*", &matches);
+        for (int j=0; j < r; j++) {
+            if (strncmp(matches[j], path, strlen(path)) == 0
+                && (matches[j][strlen(path)] == '\0'
+                    || matches[j][strlen(path)] == '['))
+                expected += 1;
+            free(matches[j]);
+        }
+        free(matches);
+        n = aug_match(aug, path, NULL);
+        CuAssertIntEquals(tc, expected, n);
+    }
+
+    aug_close(aug);
+}
+
+static unsigned long pathxCacheCount(CuTest *tc, struct augeas *aug,
+                                     const char *counter) {
+    char path[64];
+    const char *v;
+    int r;
+
+    snprintf(path, sizeof(path), "/augeas/pathx/cache/%s", counter);
+    r = aug_get(aug, path, &v);
+    CuAssertIntEquals(tc, 1, r);
+    CuAssertPtrNotNull(tc, v);
+    return strtoul(v, NULL, 10);
+}
+
+static void testPathxCache(CuTest *tc) {
+    struct augeas *aug;
+    unsigned long hits, misses;
+    const char *v;
+    int r;
+
+    aug = aug_init(root, loadpath, AUG_NO_STDINC|AUG_NO_LOAD);
+    CuAssertPtrNotNull(tc, aug);
+
+    r = aug_set(aug, "/t/a", "1");
+    CuAssertRetSuccess(tc, r);
+
+    /* Once we've seen a path, we don't parse it again */
+    for (int i=0; i < 2; i++) {
+        r = aug_match(aug, "/t/a[. = '1']", NULL);
+        CuAssertIntEquals(tc, 1, r);
+        r = aug_match(aug, "/t/a[. = '2']", NULL);
+        CuAssertIntEquals(tc, 0, r);
+        misses = pathxCacheCount(tc, aug, "misses");
+        hits = pathxCacheCount(tc, aug, "hits");
+    }
+    for (int i=0; i < 10; i++) {
+        r = aug_match(aug, "/t/a[. = '1']", NULL);
+        CuAssertIntEquals(tc, 1, r);
+    }
+    CuAssertTrue(tc, pathxCacheCount(tc, aug, "hits") >= hits + 10);
+    CuAssertTrue(tc, pathxCacheCount(tc, aug, "misses") == misses);
+
+    /* The counters include the lookup of the path that reads them */
+    misses = pathxCacheCount(tc, aug, "misses");
+    r = aug_get(aug, "/augeas/pathx/cache/misses[1]", &v);
+    CuAssertIntEquals(tc, 1, r);
+    CuAssertIntEquals(tc, misses + 1, strtoul(v, NULL, 10));
+
+    /* Changing variables invalidates the cache */
+    r = aug_defvar(aug, "x", "/t/a");
+    CuAssertIntEquals(tc, 1, r);
+    r = aug_match(aug, "$x", NULL);
+    CuAssertIntEquals(tc, 1, r);
+    r = aug_defvar(aug, "x", "'a'");
+    CuAssertIntEquals(tc, 0, r);
+    r = aug_match(aug, "$x", NULL);
+    CuAssertIntEquals(tc, -1, r);
+    CuAssertIntEquals(tc, AUG_EPATHX, aug_error(aug));
+    r = aug_defvar(aug, "x", "/t/*");
+    CuAssertIntEquals(tc, 1, r);
+    r = aug_match(aug, "$x", NULL);
+    CuAssertIntEquals(tc, 1, r);
+    r = aug_defvar(aug, "x", NULL);
+    CuAssertRetSuccess(tc, r);
+    r = aug_match(aug, "$x", NULL);
+    CuAssertIntEquals(tc, -1, r);
+
+    /* Using the same path twice at once */
+    r = aug_cp(aug, "/t/a", "/t/a");
+    CuAssertIntEquals(tc, -1, r);
+    CuAssertIntEquals(tc, AUG_ECPDESC, aug_error(aug));
+    r = aug_match(aug, "/t/a", NULL);
+    CuAssertIntEquals(tc, 1, r);
+
+    aug_close(aug);
+}
+
+static void testPrepared(CuTest *tc) {
+    struct augeas *aug;
+    struct aug_stmt *get, *set, *rm, *pos, *big;
+    const char *v;
+    char **matches;
+    char name[16];
+    int r;
+
+    aug = aug_init(root, loadpath, AUG_NO_STDINC|AUG_NO_LOAD);
+    CuAssertPtrNotNull(tc, aug);
+
+    set = aug_prepare(aug, "/t/entry[name = $1]/value");
+    CuAssertPtrNotNull(tc, set);
+    get = aug_prepare(aug, "/t/entry[name = $1]/value");
+    CuAssertPtrNotNull(tc, get);
+
+    for (int i=0; i < 10; i++) {
+        snprintf(name, sizeof(name), "e%d", i);
+        r = aug_set(aug, "/t/entry[last()+1]/name", name);
+        CuAssertRetSuccess(tc, r);
+        r = aug_bind(set, 1, name);
+        CuAssertRetSuccess(tc, r);
+        r = aug_stmt_set(set, name + 1);
+        CuAssertRetSuccess(tc, r);
+    }
+
+    /* Parameters must be bound before they are used */
+    r = aug_stmt_get(get, &v);
+    CuAssertIntEquals(tc, -1, r);
+    CuAssertIntEquals(tc, AUG_EPATHX, aug_error(aug));
+    r = aug_bind(get, 2, "x");
+    CuAssertIntEquals(tc, -1, r);
+    CuAssertIntEquals(tc, AUG_EBADARG, aug_error(aug));
+
+    /* Parameters go up to $1024 */
+    big = aug_prepare(aug, "/t/entry[name = $1024]");
+    CuAssertPtrNotNull(tc, big);
+    r = aug_bind(big, 1024, "e1");
+    CuAssertRetSuccess(tc, r);
+    r = aug_stmt_match(big, NULL);
+    CuAssertIntEquals(tc, 1, r);
+    aug_finalize(big);
+    big = aug_prepare(aug, "/t/entry[name = $1025]");
+    CuAssertPtrEquals(tc, NULL, big);
+    CuAssertIntEquals(tc, AUG_EPATHX, aug_error(aug));
+    big = aug_prepare(aug, "/t/entry[name = $99999999999]");
+    CuAssertPtrEquals(tc, NULL, big);
+    CuAssertIntEquals(tc, AUG_EPATHX, aug_error(aug));
+
+    /* Values are strings, even if they look like paths */
+    r = aug_bind(get, 1, "e3");
+    CuAssertRetSuccess(tc, r);
+    r = aug_stmt_get(get, &v);
+    CuAssertIntEquals(tc, 1, r);
+    CuAssertStrEquals(tc, "3", v);
+    r = aug_bind(get, 1, "/t/entry[1]/name");
+    CuAssertRetSuccess(tc, r);
+    r = aug_stmt_get(get, &v);
+    CuAssertIntEquals(tc, 0, r);
+    CuAssertPtrEquals(tc, NULL, v);
+
+    rm = aug_prepare(aug, "$entries[name = $1 or name = $2]");
+    CuAssertPtrEquals(tc, NULL, rm);
+    CuAssertIntEquals(tc, AUG_EPATHX, aug_error(aug));
+    r = aug_defvar(aug, "entries", "/t/entry");
+    CuAssertIntEquals(tc, 10, r);
+    rm = aug_prepare(aug, "$entries[name = $1 or name = $2]");
+    CuAssertPtrNotNull(tc, rm);
+    r = aug_bind(rm, 1, "e4");
+    CuAssertRetSuccess(tc, r);
+    r = aug_bind(rm, 2, "e7");
+    CuAssertRetSuccess(tc, r);
+    r = aug_stmt_match(rm, &matches);
+    CuAssertIntEquals(tc, 2, r);
+    CuAssertStrEquals(tc, "/t/entry[5]", matches[0]);
+    CuAssertStrEquals(tc, "/t/entry[8]", matches[1]);
+    free(matches[0]);
+    free(matches[1]);
+    free(matches);
+    r = aug_stmt_rm(rm);
+    CuAssertIntEquals(tc, 6, r);
+    r = aug_match(aug, "/t/entry", NULL);
+    CuAssertIntEquals(tc, 8, r);
+
+    /* Changing the variable to a string makes the statement invalid */
+    r = aug_defvar(aug, "entries", "'e1'");
+    CuAssertRetSuccess(tc, r);
+    r = aug_stmt_match(rm, NULL);
+    CuAssertIntEquals(tc, -1, r);
+    CuAssertIntEquals(tc, AUG_EPATHX, aug_error(aug));
+    r = aug_defvar(aug, "entries", "/t/entry[position() > 5]");
+    CuAssertIntEquals(tc, 3, r);
+    r = aug_stmt_match(rm, NULL);
+    CuAssertIntEquals(tc, 0, r);
+    r = aug_bind(rm, 1, "e9");
+    CuAssertRetSuccess(tc, r);
+    r = aug_stmt_match(rm, NULL);
+    CuAssertIntEquals(tc, 1, r);
+
+    /* A predicate that turns into a position when its variable changes */
+    for (int i=0; i < 5; i++) {
+        r = aug_set(aug, "/u/a[last()+1]", NULL);
+        CuAssertRetSuccess(tc, r);
+    }
+    r = aug_defvar(aug, "x", "/u");
+    CuAssertIntEquals(tc, 1, r);
+    pos = aug_prepare(aug, "/u/a[$x]");
+    CuAssertPtrNotNull(tc, pos);
+    r = aug_stmt_match(pos, NULL);
+    CuAssertIntEquals(tc, 5, r);
+    r = aug_defvar(aug, "x", "2");
+    CuAssertRetSuccess(tc, r);
+    r = aug_stmt_match(pos, &matches);
+    CuAssertIntEquals(tc, 1, r);
+    CuAssertStrEquals(tc, "/u/a[2]", matches[0]);
+    free(matches[0]);
+    free(matches);
+
+    aug_finalize(pos);
+    aug_finalize(rm);
+    aug_finalize(get);
+    aug_finalize(set);
+    aug_close(aug);
+}
+
+static void testIterMatch(CuTest *tc) {
+    struct augeas *aug;
+    struct aug_iter *iter;
+    struct aug_node *node;
+    const char *labels[] = { "a", "b", "c", "b" };
+    const char *values[] = { "1", "2", NULL, "4" };
+    char *path;
+    int r, i;
+
+    aug = aug_init(root, loadpath, AUG_NO_STDINC|AUG_NO_LOAD);
+    CuAssertPtrNotNull(tc, aug);
+
+    for (i=0; i < 4; i++) {
+        r = aug_set(aug, "/t/new", values[i]);
+        CuAssertRetSuccess(tc, r);
+        r = aug_rename(aug, "/t/new", labels[i]);
+        CuAssertIntEquals(tc, 1, r);
+    }
+
+    iter = aug_iter_match(aug, "/t/*");
+    CuAssertPtrNotNull(tc, iter);
+    for (i=0; (node = aug_iter_next(iter)) != NULL; i++) {
+        CuAssertTrue(tc, i < 4);
+        CuAssertStrEquals(tc, labels[i], aug_node_label(node));
+        CuAssertStrEquals(tc, values[i], aug_node_value(node));
+    }
+    CuAssertIntEquals(tc, 4, i);
+    CuAssertPtrEquals(tc, NULL, aug_iter_next(iter));
+    aug_iter_free(iter);
+
+    iter = aug_iter_match(aug, "/t/b[. = '4']");
+    CuAssertPtrNotNull(tc, iter);
+    node = aug_iter_next(iter);
+    CuAssertPtrNotNull(tc, node);
+    path = aug_node_path(node);
+    CuAssertStrEquals(tc, "/t/b[2]", path);
+    free(path);
+    CuAssertPtrEquals(tc, NULL, aug_iter_next(iter));
+    aug_iter_free(iter);
+
+    /* Like aug_match, skip hidden nodes */
+    iter = aug_iter_match(aug, "/");
+    CuAssertPtrNotNull(tc, iter);
+    for (i=0; (node = aug_iter_next(iter)) != NULL; i++)
+        CuAssertPtrNotNull(tc, aug_node_label(node));
+    r = aug_match(aug, "/", NULL);
+    CuAssertIntEquals(tc, r, i);
+    aug_iter_free(iter);
+
+    iter = aug_iter_match(aug, "/t/d");
+    CuAssertPtrNotNull(tc, iter);
+    CuAssertPtrEquals(tc, NULL, aug_iter_next(iter));
+    aug_iter_free(iter);
+
+    iter = aug_iter_match(aug, "/t/[");
+    CuAssertPtrEquals(tc, NULL, iter);
+    CuAssertIntEquals(tc, AUG_EPATHX, aug_error(aug));
+
+    aug_close(aug);
+}
+
+/* Check that AUG1 and AUG2 have the same nodes with the same values
+ * under PATTERN */
+static void assertSameNodes(CuTest *tc, struct augeas *aug1,
+                            struct augeas *aug2, const char *pattern) {
+    char **paths1, **paths2;
+    int n1, n2;
+
+    n1 = aug_match(aug1, pattern, &paths1);
+    n2 = aug_match(aug2, pattern, &paths2);
+    CuAssertTrue(tc, n1 >= 0);
+    CuAssertIntEquals(tc, n1, n2);
+    for (int i=0; i < n1; i++) {
+        const char *v1, *v2;
+        CuAssertStrEquals(tc, paths1[i], paths2[i]);
+        CuAssertIntEquals(tc, 1, aug_get(aug1, paths1[i], &v1));
+        CuAssertIntEquals(tc, 1, aug_get(aug2, paths2[i], &v2));
+        if (v1 == NULL || v2 == NULL)
+            CuAssertPtrEquals(tc, (void *) v1, (void *) v2);
+        else
+            CuAssertStrEquals(tc, v1, v2);
+        free(paths1[i]);
+        free(paths2[i]);
+    }
+    free(paths1);
+    free(paths2);
+}
+
+static void *load_shared(void *data) {
+    aug_load(data);
+    return NULL;
+}
+
+static void testInitShared(CuTest *tc) {
+    static const char *const hosts = "192.168.0.1 rtr.example.com router\n";
+    struct augeas *aug, *shared[2];
+    const char *hosts_out;
+    int r;
+
+    aug = aug_init(root, loadpath, AUG_NO_STDINC|AUG_NO_LOAD);
+    CuAssertPtrNotNull(tc, aug);
+
+    for (int i=0; i < 2; i++) {
+        shared[i] = aug_init_shared(aug, root, AUG_NO_LOAD);
+        CuAssertPtrNotNull(tc, shared[i]);
+        CuAssertIntEquals(tc, AUG_NOERROR, aug_error(shared[i]));
+    }
+
+    r = aug_load(aug);
+    CuAssertRetSuccess(tc, r);
+
+    /* The shared handles keep working after AUG is gone, and can be used
+     * from different threads at the same time */
+    r = aug_load(shared[0]);
+    CuAssertRetSuccess(tc, r);
+    CuAssertTrue(tc, aug_match(shared[0], "/files/etc/hosts/*", NULL) > 0);
+    assertSameNodes(tc, aug, shared[0], "/files//*");
+    assertSameNodes(tc, aug, shared[0], "/augeas/files//error");
+    aug_close(aug);
+
+#if HAVE_PTHREAD_H
+    /* Threads that exit leave their DFAs and pattern buffers to the
+     * threads that come after them; the second round reuses them */
+    pthread_t threads[2];
+    for (int round=0; round < 2; round++) {
+        for (int i=0; i < 2; i++) {
+            r = pthread_create(threads + i, NULL, load_shared, shared[i]);
+            CuAssertIntEquals(tc, 0, r);
+        }
+        for (int i=0; i < 2; i++)
+            pthread_join(threads[i], NULL);
+    }
+#else
+    for (int i=0; i < 2; i++)
+        load_shared(shared[i]);
+#endif
+    assertSameNodes(tc, shared[0], shared[1], "/files//*");
+
+    r = aug_set(shared[1], "/raw/hosts", hosts);
+    CuAssertRetSuccess(tc, r);
+    r = aug_text_store(shared[1], "Hosts.lns", "/raw/hosts", "/t1");
+    CuAssertRetSuccess(tc, r);
+    r = aug_text_retrieve(shared[1], "Hosts.lns", "/raw/hosts", "/t1",
+                          "/out/hosts");
+    CuAssertRetSuccess(tc, r);
+    r = aug_get(shared[1], "/out/hosts", &hosts_out);
+    CuAssertIntEquals(tc, 1, r);
+    CuAssertStrEquals(tc, hosts, hosts_out);
+
+    aug_close(shared[0]);
+    aug_close(shared[1]);
+}
+
+static void testBatch(CuTest *tc) {
+    struct augeas *aug;
+    struct aug_op ops[] = {
+        { .op = AUG_OP_SET, .path = "/t/a", .value = "1" },
+        { .op = AUG_OP_SET, .path = "/t/b", .value = "2" },
+        { .op = AUG_OP_INSERT, .path = "/t/b", .value = "c", .before = 0 },
+        { .op = AUG_OP_SET, .path = "/t/c", .value = "3" },
+        { .op = AUG_OP_SET, .path = "/t/*", .value = "4" },
+        { .op = AUG_OP_INSERT, .path = "/t/none", .value = "d", .before = 1 },
+        { .op = AUG_OP_RM, .path = "/t/a" },
+        { .op = AUG_OP_SET, .path = "/t[", .value = "5" }
+    };
+    const int nops = sizeof(ops)/sizeof(ops[0]);
+    const char *v;
+    int r;
+
+    aug = aug_init(root, loadpath, AUG_NO_STDINC|AUG_NO_LOAD);
+    CuAssertPtrNotNull(tc, aug);
+
+    r = aug_batch(aug, ops, nops);
+    CuAssertIntEquals(tc, 3, r);
+
+    /* Failing operations do not stop the ones after them */
+    CuAssertIntEquals(tc, 0, ops[3].result);
+    CuAssertIntEquals(tc, AUG_NOERROR, ops[3].code);
+    CuAssertIntEquals(tc, -1, ops[4].result);
+    CuAssertIntEquals(tc, AUG_EMMATCH, ops[4].code);
+    CuAssertIntEquals(tc, -1, ops[5].result);
+    CuAssertIntEquals(tc, AUG_ENOMATCH, ops[5].code);
+    CuAssertIntEquals(tc, 1, ops[6].result);
+    CuAssertIntEquals(tc, AUG_NOERROR, ops[6].code);
+    CuAssertIntEquals(tc, -1, ops[7].result);
+    CuAssertIntEquals(tc, AUG_EPATHX, ops[7].code);
+
+    /* The error of the last failed operation is reported */
+    CuAssertIntEquals(tc, AUG_EPATHX, aug_error(aug));
+    CuAssertPtrNotNull(tc, aug_error_details(aug));
+
+    r = aug_match(aug, "/t/*", NULL);
+    CuAssertIntEquals(tc, 2, r);
+    r = aug_get(aug, "/t/*[1]", &v);
+    CuAssertIntEquals(tc, 1, r);
+    CuAssertStrEquals(tc, "2", v);
+    r = aug_get(aug, "/t/c", &v);
+    CuAssertIntEquals(tc, 1, r);
+    CuAssertStrEquals(tc, "3", v);
+
+    r = aug_batch(aug, ops, 2);
+    CuAssertIntEquals(tc, 0, r);
+    CuAssertIntEquals(tc, AUG_NOERROR, aug_error(aug));
+
+    aug_close(aug);
+}
+
+/* Descendant steps skip subtrees by their label summary; check that the
+ * summaries follow changes to the tree */
+static void testDescendantLabels(CuTest *tc) {
+    struct augeas *aug;
+    int r;
+
+    aug = aug_init(root, loadpath, AUG_NO_STDINC|AUG_NO_LOAD);
+    CuAssertPtrNotNull(tc, aug);
+
+    r = aug_set(aug, "/a/b/c/d", "1");
+    CuAssertRetSuccess(tc, r);
+    r = aug_set(aug, "/x/y", "2");
+    CuAssertRetSuccess(tc, r);
+
+    r = aug_match(aug, "//d", NULL);
+    CuAssertIntEquals(tc, 1, r);
+    r = aug_match(aug, "//e", NULL);
+    CuAssertIntEquals(tc, 0, r);
+
+    r = aug_rename(aug, "/a/b/c/d", "e");
+    CuAssertIntEquals(tc, 1, r);
+    r = aug_match(aug, "//d", NULL);
+    CuAssertIntEquals(tc, 0, r);
+    r = aug_match(aug, "/a/descendant::e", NULL);
+    CuAssertIntEquals(tc, 1, r);
+
+    r = aug_mv(aug, "/a/b/c", "/x/y");
+    CuAssertRetSuccess(tc, r);
+    r = aug_match(aug, "/x//e", NULL);
+    CuAssertIntEquals(tc, 1, r);
+    r = aug_match(aug, "/a//e", NULL);
+    CuAssertIntEquals(tc, 0, r);
+
+    r = aug_cp(aug, "/x/y", "/a/b/z");
+    CuAssertRetSuccess(tc, r);
+    r = aug_match(aug, "/a//e", NULL);
+    CuAssertIntEquals(tc, 1, r);
+
+    r = aug_insert(aug, "/a/b/z/e", "f", 1);
+    CuAssertRetSuccess(tc, r);
+    r = aug_match(aug, "//f", NULL);
+    CuAssertIntEquals(tc, 1, r);
+
+    r = aug_rm(aug, "/a/b/z");
+    CuAssertIntEquals(tc, 3, r);
+    r = aug_match(aug, "//e", NULL);
+    CuAssertIntEquals(tc, 1, r);
+    r = aug_match(aug, "//f", NULL);
+    CuAssertIntEquals(tc, 0, r);
+
+    aug_close(aug);
+}
+
 int main(void) {
     char *output = NULL;
     CuSuite* suite = CuSuiteNew();
@@ -661,6 +1284,14 @@ int main(void) {
     SUITE_ADD_TEST(suite, testTextStore);
     SUITE_ADD_TEST(suite, testTextRetrieve);
     SUITE_ADD_TEST(suite, testAugEscape);
+    SUITE_ADD_TEST(suite, testChangeStoredTree);
+    SUITE_ADD_TEST(suite, testManyChildren);
+    SUITE_ADD_TEST(suite, testPathxCache);
+    SUITE_ADD_TEST(suite, testPrepared);
+    SUITE_ADD_TEST(suite, testIterMatch);
+    SUITE_ADD_TEST(suite, testInitShared);
+    SUITE_ADD_TEST(suite, testBatch);
+    SUITE_ADD_TEST(suite, testDescendantLabels);
 
     abs_top_srcdir = getenv("abs_top_srcdir");
     if (abs_top_srcdir == NULL)
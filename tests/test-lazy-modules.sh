@@ -0,0 +1,61 @@
+#! /bin/bash
+
+# Test lazy module loading: with --lazy, augtool must load the same tree
+# as without it, and modules must only be compiled when a file they apply
+# to is loaded
+
+ROOT=$abs_top_builddir/build/test-lazy-modules
+LENSES=$ROOT/lenses
+FSROOT=$ROOT/root
+
+rm -rf $ROOT
+mkdir -p $LENSES $FSROOT/etc
+for m in hosts util sep rx; do
+    cp $abs_top_srcdir/lenses/$m.aug $LENSES
+done
+cp $abs_top_srcdir/tests/root/etc/hosts $FSROOT/etc
+
+# A module whose lens fails to compile; its filter is fine
+cat > $LENSES/broken.aug <<EOF
+module Broken =
+  autoload xfm
+  let filter = incl "/etc/broken"
+  let lns = del /a/ "b"
+  let xfm = transform lns filter
+EOF
+
+AUGTOOL="augtool --nostdinc -I $LENSES -r $FSROOT"
+
+out=$($AUGTOOL print /augeas/load/Broken 2>&1)
+if [ $? = 0 ]; then
+    echo "Loading broken module did not fail"
+    echo "$out"
+    exit 1
+fi
+
+expected=$($AUGTOOL -A -t "Hosts incl /etc/hosts" print /files | sort)
+actual=$($AUGTOOL --lazy print /files | sort)
+if [ "$expected" != "$actual" ]; then
+    echo "Lazy loading produced a different tree"
+    echo "Expected: $expected"
+    echo "Actual:   $actual"
+    exit 1
+fi
+
+actual=$($AUGTOOL --lazy print /augeas/load/Broken/incl)
+expected='/augeas/load/Broken/incl = "/etc/broken"'
+if [ "$expected" != "$actual" ]; then
+    echo "Filter of lazy module not in the tree"
+    echo "Expected: $expected"
+    echo "Actual:   $actual"
+    exit 1
+fi
+
+# Once a file for the broken module exists, it needs to be compiled
+echo a > $FSROOT/etc/broken
+out=$($AUGTOOL --lazy print /files 2>&1)
+if [ $? = 0 ]; then
+    echo "Compiling broken module on demand did not fail"
+    echo "$out"
+    exit 1
+fi
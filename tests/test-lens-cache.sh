@@ -0,0 +1,73 @@
+#! /bin/bash
+
+# Test the lens cache: modules restored from the cache must behave like
+# modules compiled from source, and changing a module must invalidate the
+# cache entries of all modules that use it
+
+ROOT=$abs_top_builddir/build/test-lens-cache
+LENSES=$ROOT/lenses
+CACHE=$ROOT/cache
+TEST=$ROOT/test_cache.aug
+
+rm -rf $ROOT
+mkdir -p $LENSES $CACHE
+for m in hosts util sep rx; do
+    cp $abs_top_srcdir/lenses/$m.aug $LENSES
+done
+
+cat > $TEST <<EOF
+module Test_cache =
+  test Hosts.lns get "127.0.0.1 localhost\n" =
+    { "1" { "ipaddr" = "127.0.0.1" } { "canonical" = "localhost" } }
+  test Hosts.lns put "127.0.0.1 localhost\n" after
+    set "*/canonical" "home" = "127.0.0.1 home\n"
+  (* Util.del_str is a function, and not in the cache *)
+  test [ label "a" . Util.del_str "x" ] get "x" = { "a" }
+EOF
+
+# Run the tests and print which modules were loaded from the cache
+cached() {
+    local out
+    if ! out=$(AUGEAS_LENS_CACHE=$CACHE augparse --nostdinc -I $LENSES -t $TEST)
+    then
+        echo "$out" >&2
+        echo "augparse failed"
+        return
+    fi
+    echo "$out" \
+        | sed -n -e "s|^Module $LENSES/\(.*\) loaded from cache$|\1|p" \
+        | sort | tr '\n' ' '
+}
+
+check() {
+    if [ "$1" != "$2" ]; then
+        echo "$3"
+        echo "Expected: '$2'"
+        echo "Actual:   '$1'"
+        exit 1
+    fi
+}
+
+check "$(cached)" "" "Modules loaded from an empty cache"
+for m in hosts util sep rx; do
+    if [ ! -f $CACHE/$m.augc ]; then
+        echo "No cache entry for $m.aug"
+        exit 1
+    fi
+done
+# Only modules that are actually used get loaded; Util needs to be
+# compiled from source after that for Util.del_str
+check "$(cached)" "hosts.aug util.aug " \
+    "Modules not loaded from a warm cache"
+
+# Changing the mtime without changing the contents keeps the cache valid
+touch -d '2001-01-01' $LENSES/hosts.aug
+check "$(cached)" "hosts.aug util.aug " \
+    "Touching a module invalidated the cache"
+
+# Sep is used by Hosts; changing it needs to invalidate both
+echo '(* changed *)' >> $LENSES/sep.aug
+check "$(cached)" "rx.aug util.aug " \
+    "Changing a module did not invalidate the modules using it"
+check "$(cached)" "hosts.aug util.aug " \
+    "Modules not loaded from the refreshed cache"
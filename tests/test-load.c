@@ -502,6 +502,116 @@ static void testReloadAfterSaveNewfile(CuTest *tc) {
     aug_close(aug);
 }
 
+static void testReloadWatched(CuTest *tc) {
+    augeas *aug = NULL;
+    const char *build_root;
+    int r;
+
+    aug = setup_writable_hosts(tc);
+
+    r = aug_set(aug, "/augeas/watch", "enable");
+    CuAssertRetSuccess(tc, r);
+
+    r = aug_get(aug, "/augeas/root", &build_root);
+    CuAssertIntEquals(tc, 1, r);
+
+    run(tc, "touch -d 2001-01-01 %setc/hosts", build_root);
+
+    r = aug_load(aug);
+    CuAssertRetSuccess(tc, r);
+
+    /* With inotify, changes are noticed even if the mtime stays the same */
+    run(tc, "echo '192.168.0.1 other.example.com' >> %setc/hosts",
+        build_root);
+#if HAVE_SYS_INOTIFY_H && HAVE_INOTIFY_INIT1
+    run(tc, "touch -d 2001-01-01 %setc/hosts", build_root);
+#endif
+
+    r = aug_load(aug);
+    CuAssertRetSuccess(tc, r);
+
+    r = aug_match(aug, "/files/etc/hosts/*[ipaddr = '192.168.0.1']", NULL);
+    CuAssertIntEquals(tc, 1, r);
+
+    /* Deleted files disappear from the tree */
+    run(tc, "rm %setc/hosts", build_root);
+
+    r = aug_load(aug);
+    CuAssertRetSuccess(tc, r);
+
+    r = aug_match(aug, "/files/etc/hosts", NULL);
+    CuAssertIntEquals(tc, 0, r);
+
+    r = aug_match(aug, "/augeas/files/etc/hosts", NULL);
+    CuAssertIntEquals(tc, 0, r);
+
+    /* And come back when they are recreated */
+    run(tc, "cp -p %s/etc/hosts %setc/hosts", root, build_root);
+
+    r = aug_load(aug);
+    CuAssertRetSuccess(tc, r);
+
+    r = aug_match(aug, "/files/etc/hosts/1[ipaddr = '127.0.0.1']", NULL);
+    CuAssertIntEquals(tc, 1, r);
+
+    /* Unsaved changes are still discarded */
+    r = aug_set(aug, "/files/etc/hosts/1/ipaddr", "127.0.0.2");
+    CuAssertRetSuccess(tc, r);
+
+    r = aug_load(aug);
+    CuAssertRetSuccess(tc, r);
+
+    r = aug_match(aug, "/files/etc/hosts/1[ipaddr = '127.0.0.1']", NULL);
+    CuAssertIntEquals(tc, 1, r);
+
+    aug_close(aug);
+}
+
+/* Parsing files in parallel must produce exactly the same tree */
+static void testParallelLoad(CuTest *tc) {
+    augeas *aug1 = NULL, *aug2 = NULL;
+    char **paths1 = NULL, **paths2 = NULL;
+    int n1, n2, r;
+
+    aug1 = aug_init(root, loadpath, AUG_NO_STDINC);
+    CuAssertPtrNotNull(tc, aug1);
+
+    aug2 = aug_init(root, loadpath, AUG_NO_STDINC|AUG_NO_LOAD);
+    CuAssertPtrNotNull(tc, aug2);
+
+    r = aug_set(aug2, "/augeas/threads", "4");
+    CuAssertRetSuccess(tc, r);
+
+    r = aug_load(aug2);
+    CuAssertRetSuccess(tc, r);
+
+    n1 = aug_match(aug1, "/files//* | /augeas/files//error", &paths1);
+    CuAssertPositive(tc, n1);
+    n2 = aug_match(aug2, "/files//* | /augeas/files//error", &paths2);
+    CuAssertIntEquals(tc, n1, n2);
+
+    for (int i=0; i < n1; i++) {
+        const char *v1, *v2;
+
+        CuAssertStrEquals(tc, paths1[i], paths2[i]);
+        r = aug_get(aug1, paths1[i], &v1);
+        CuAssertIntEquals(tc, 1, r);
+        r = aug_get(aug2, paths2[i], &v2);
+        CuAssertIntEquals(tc, 1, r);
+        if (v1 == NULL)
+            CuAssertPtrEquals(tc, NULL, (void *) v2);
+        else
+            CuAssertStrEquals(tc, v1, v2);
+        free(paths1[i]);
+        free(paths2[i]);
+    }
+    free(paths1);
+    free(paths2);
+
+    aug_close(aug1);
+    aug_close(aug2);
+}
+
 /* Make sure parse errors from applying a lens to a file that does not
  * match get reported under /augeas//error
  *
@@ -529,6 +639,116 @@ static void testParseErrorReported(CuTest *tc) {
     aug_close(aug);
 }
 
+/* A NUL byte in a file is reported as a parse error, rather than
+ * silently cutting the file short */
+static void testNulByteReported(CuTest *tc) {
+    static const char line[] = "192.168.0.1 other\0example.com\n";
+    FILE *fp;
+    augeas *aug = NULL;
+    const char *build_root, *s;
+    char *hosts = NULL;
+    int r;
+
+    aug = setup_writable_hosts(tc);
+
+    r = aug_get(aug, "/augeas/root", &build_root);
+    CuAssertIntEquals(tc, 1, r);
+
+    r = asprintf(&hosts, "%setc/hosts", build_root);
+    CuAssertPositive(tc, r);
+
+    fp = fopen(hosts, "a");
+    CuAssertPtrNotNull(tc, fp);
+
+    r = fwrite(line, 1, sizeof(line) - 1, fp);
+    CuAssertIntEquals(tc, sizeof(line) - 1, r);
+
+    r = fclose(fp);
+    CuAssertRetSuccess(tc, r);
+
+    r = aug_load(aug);
+    CuAssertRetSuccess(tc, r);
+
+    r = aug_get(aug, "/augeas/files/etc/hosts/error", &s);
+    CuAssertIntEquals(tc, 1, r);
+    CuAssertStrEquals(tc, "parse_failed", s);
+
+    r = aug_get(aug, "/augeas/files/etc/hosts/error/message", &s);
+    CuAssertIntEquals(tc, 1, r);
+    CuAssertStrEquals(tc, "input contains a NUL byte", s);
+
+    free(hosts);
+    aug_close(aug);
+}
+
+/* Files whose size is a multiple of the page size, or one less, can not
+ * be mapped with room for the newline and NUL we need, and are read
+ * instead; check that they load and save just like other files */
+static void testPageSizedFiles(CuTest *tc) {
+    static const char head[] = "127.0.0.1 localhost\n#";
+    long pagesize = sysconf(_SC_PAGESIZE);
+    augeas *aug = NULL;
+    const char *build_root, *s;
+    char *hosts = NULL, *text = NULL, *saved = NULL;
+    FILE *fp;
+    int r;
+
+    CuAssertPositive(tc, pagesize);
+    text = malloc(pagesize + 2);
+    CuAssertPtrNotNull(tc, text);
+
+    for (long size = pagesize - 2; size <= pagesize + 1; size++) {
+        for (int newline = 0; newline <= 1; newline++) {
+            aug = setup_writable_hosts(tc);
+            r = aug_get(aug, "/augeas/root", &build_root);
+            CuAssertIntEquals(tc, 1, r);
+            r = asprintf(&hosts, "%setc/hosts", build_root);
+            CuAssertPositive(tc, r);
+
+            /* A comment fills the file up to SIZE bytes */
+            memset(text, 'x', size);
+            memcpy(text, head, strlen(head));
+            if (newline)
+                text[size - 1] = '\n';
+            text[size] = '\0';
+
+            fp = fopen(hosts, "w");
+            CuAssertPtrNotNull(tc, fp);
+            r = fwrite(text, 1, size, fp);
+            CuAssertIntEquals(tc, size, r);
+            r = fclose(fp);
+            CuAssertRetSuccess(tc, r);
+
+            r = aug_load(aug);
+            CuAssertRetSuccess(tc, r);
+            r = aug_match(aug, "/augeas/files/etc/hosts/error", NULL);
+            CuAssertIntEquals(tc, 0, r);
+            r = aug_get(aug, "/files/etc/hosts/#comment", &s);
+            CuAssertIntEquals(tc, 1, r);
+            CuAssertIntEquals(tc, size - newline - strlen(head), strlen(s));
+
+            r = aug_set(aug, "/files/etc/hosts/1/canonical", "localhost0");
+            CuAssertRetSuccess(tc, r);
+            r = aug_save(aug);
+            CuAssertRetSuccess(tc, r);
+
+            /* The newline that was missing is added */
+            saved = xread_file(hosts);
+            CuAssertPtrNotNull(tc, saved);
+            CuAssertIntEquals(tc, size + 1 + !newline, strlen(saved));
+            CuAssertIntEquals(tc, 0,
+                              strncmp(saved, "127.0.0.1 localhost0", 20));
+            CuAssertIntEquals(tc, 0,
+                              strncmp(saved + 20, text + 19, size - 19));
+
+            free(saved);
+            free(hosts);
+            aug_close(aug);
+        }
+    }
+    free(text);
+}
+
 /* Test failed file opening is reported, e.g. EACCES */
 static void testPermsErrorReported(CuTest *tc) {
     if (getuid() == 0) {
@@ -620,7 +840,11 @@ int main(void) {
     SUITE_ADD_TEST(suite, testReloadDeletedMeta);
     SUITE_ADD_TEST(suite, testReloadExternalMod);
     SUITE_ADD_TEST(suite, testReloadAfterSaveNewfile);
+    SUITE_ADD_TEST(suite, testReloadWatched);
+    SUITE_ADD_TEST(suite, testParallelLoad);
     SUITE_ADD_TEST(suite, testParseErrorReported);
+    SUITE_ADD_TEST(suite, testNulByteReported);
+    SUITE_ADD_TEST(suite, testPageSizedFiles);
     SUITE_ADD_TEST(suite, testPermsErrorReported);
     SUITE_ADD_TEST(suite, testLoadExclWithRoot);
     SUITE_ADD_TEST(suite, testLoadTrailingExcl);
@@ -348,6 +348,110 @@ static void testPathEscaping(CuTest *tc) {
     CuAssertIntEquals(tc, ENOENT, errno);
 }
 
+/* Make the same changes to hosts and fstab for testIncrementalSave */
+static void change_files(CuTest *tc, struct augeas *a) {
+    int r;
+
+    r = aug_set(a, "/files/etc/hosts/1/alias[last() + 1]", "new");
+    CuAssertRetSuccess(tc, r);
+    r = aug_rm(a, "/files/etc/hosts/2");
+    CuAssertPositive(tc, r);
+    r = aug_set(a, "/files/etc/hosts/01/ipaddr", "192.168.0.1");
+    CuAssertRetSuccess(tc, r);
+    r = aug_set(a, "/files/etc/hosts/01/canonical", "new.example.com");
+    CuAssertRetSuccess(tc, r);
+    r = aug_set(a, "/files/etc/fstab/3/file", "/dev/pts2");
+    CuAssertRetSuccess(tc, r);
+    r = aug_insert(a, "/files/etc/fstab/4", "01", 1);
+    CuAssertRetSuccess(tc, r);
+    r = aug_set(a, "/files/etc/fstab/01/spec", "/dev/sdb1");
+    CuAssertRetSuccess(tc, r);
+    r = aug_set(a, "/files/etc/fstab/01/file", "/mnt");
+    CuAssertRetSuccess(tc, r);
+    r = aug_set(a, "/files/etc/fstab/01/vfstype", "ext4");
+    CuAssertRetSuccess(tc, r);
+    r = aug_set(a, "/files/etc/fstab/01/opt", "defaults");
+    CuAssertRetSuccess(tc, r);
+}
+
+/* Saving files incrementally must produce the same text as putting the
+ * whole tree */
+static void testIncrementalSave(CuTest *tc) {
+    struct augeas *aug2;
+    char *lensdir;
+    int r;
+
+    r = aug_set(aug, "/augeas/save/incremental", "enable");
+    CuAssertRetSuccess(tc, r);
+    r = aug_rm(aug, "/augeas/files//mtime");
+    CuAssertPositive(tc, r);
+    r = aug_load(aug);
+    CuAssertRetSuccess(tc, r);
+
+    change_files(tc, aug);
+    r = aug_set(aug, "/augeas/save", "newfile");
+    CuAssertRetSuccess(tc, r);
+    r = aug_save(aug);
+    CuAssertRetSuccess(tc, r);
+    r = aug_match(aug, "/augeas//error", NULL);
+    CuAssertIntEquals(tc, 0, r);
+
+    run(tc, "mv %s/etc/hosts.augnew %s/etc/hosts.incr", root, root);
+    run(tc, "mv %s/etc/fstab.augnew %s/etc/fstab.incr", root, root);
+
+    if (asprintf(&lensdir, "%s/lenses", abs_top_srcdir) < 0)
+        CuFail(tc, "asprintf lensdir failed");
+    aug2 = aug_init(root, lensdir, AUG_NO_STDINC);
+    CuAssertPtrNotNull(tc, aug2);
+    free(lensdir);
+    change_files(tc, aug2);
+    r = aug_save(aug2);
+    CuAssertRetSuccess(tc, r);
+    aug_close(aug2);
+
+    run(tc, "cmp %s/etc/hosts %s/etc/hosts.incr", root, root);
+    run(tc, "cmp %s/etc/fstab %s/etc/fstab.incr", root, root);
+
+    /* The whitespace after '#' is not in the tree; a file that changed on
+     * disk since it was loaded must not be copied from the old text */
+    r = aug_load(aug);
+    CuAssertRetSuccess(tc, r);
+    run(tc, "sed -i -e 's/^# Do not/#  Do not/' %s/etc/hosts", root);
+    r = aug_set(aug, "/files/etc/hosts/1/canonical", "other");
+    CuAssertRetSuccess(tc, r);
+    r = aug_save(aug);
+    CuAssertRetSuccess(tc, r);
+    run(tc, "grep -q '^#  Do not' %s/etc/hosts.augnew", root);
+}
+
+/* Files read with recursive lenses can be saved incrementally, too. Json
+ * does not keep the whitespace inside arrays in the tree */
+static void testIncrementalSaveRecursive(CuTest *tc) {
+    int r;
+
+    run(tc, "printf '{ \"a\": [ 1,   2 ],\\n  \"b\": \"x\" }\\n' > %s/etc/test.json",
+        root);
+
+    r = aug_set(aug, "/augeas/load/Json/lens", "Json.lns");
+    CuAssertRetSuccess(tc, r);
+    r = aug_set(aug, "/augeas/load/Json/incl[last()+1]", "/etc/test.json");
+    CuAssertRetSuccess(tc, r);
+    r = aug_set(aug, "/augeas/save/incremental", "enable");
+    CuAssertRetSuccess(tc, r);
+    r = aug_load(aug);
+    CuAssertRetSuccess(tc, r);
+
+    r = aug_set(aug, "/files/etc/test.json/dict/entry[. = 'b']/string", "y");
+    CuAssertRetSuccess(tc, r);
+    r = aug_save(aug);
+    CuAssertRetSuccess(tc, r);
+    r = aug_match(aug, "/augeas//error", NULL);
+    CuAssertIntEquals(tc, 0, r);
+
+    run(tc, "grep -q '\"a\": \\[ 1,   2 \\]' %s/etc/test.json", root);
+    run(tc, "grep -q '\"b\": \"y\"' %s/etc/test.json", root);
+}
+
 int main(void) {
     char *output = NULL;
     CuSuite* suite = CuSuiteNew();
@@ -377,6 +481,8 @@ int main(void) {
     SUITE_ADD_TEST(suite, testUmask027);
     SUITE_ADD_TEST(suite, testUmask022);
     SUITE_ADD_TEST(suite, testPathEscaping);
+    SUITE_ADD_TEST(suite, testIncrementalSave);
+    SUITE_ADD_TEST(suite, testIncrementalSaveRecursive);
 
     CuSuiteRun(suite);
     CuSuiteSummary(suite, &output);